@@ -74,6 +74,19 @@ Renderer::Renderer(int width, int height, int depthBits, int stencilBits)
 	m_primativeMode = PM_TRIANGLES;
 	m_activeViewport = -1;
 
+	// Quad indices, two triangles per quad
+	m_pQuadIndices = new unsigned short[MAX_PACKED_QUADS_PER_BATCH * 6];
+	for (int i = 0; i < MAX_PACKED_QUADS_PER_BATCH; i++)
+	{
+		unsigned short firstVertex = (unsigned short)(i * 4);
+		m_pQuadIndices[i * 6 + 0] = firstVertex;
+		m_pQuadIndices[i * 6 + 1] = firstVertex + 1;
+		m_pQuadIndices[i * 6 + 2] = firstVertex + 2;
+		m_pQuadIndices[i * 6 + 3] = firstVertex;
+		m_pQuadIndices[i * 6 + 4] = firstVertex + 2;
+		m_pQuadIndices[i * 6 + 5] = firstVertex + 3;
+	}
+
 	InitOpenGLExtensions();
 }
 
@@ -89,6 +102,10 @@ Renderer::~Renderer()
 	}
 	m_vertexArrays.clear();
 
+	// Delete the quad indices
+	delete[] m_pQuadIndices;
+	m_pQuadIndices = NULL;
+
 	// Delete the viewports
 	for (i = 0; i < m_viewports.size(); i++)
 	{
@@ -1446,6 +1463,10 @@ bool Renderer::CreateStaticBuffer(VertexType type, unsigned int materialID, unsi
 			pVertexArray->textureCoordinateSize = sizeof(OGLUVCoordinate);
 			pVertexArray->pTextureCoordinates = new float[nTextureCoordinates * 2];
 			break;
+		case VT_POSITION_NORMAL_COLOUR_PACKED:
+			pVertexArray->vertexSize = sizeof(OpenGLMesh_PackedVertex);
+			pVertexArray->pVA = new float[nVerts * 3]; // 12 bytes per packed vertex
+			break;
 		}
 	}
 
@@ -1526,6 +1547,10 @@ bool Renderer::RecreateStaticBuffer(unsigned int ID, VertexType type, unsigned i
 			pVertexArray->textureCoordinateSize = sizeof(OGLUVCoordinate);
 			pVertexArray->pTextureCoordinates = new float[nTextureCoordinates * 2];
 			break;
+		case VT_POSITION_NORMAL_COLOUR_PACKED:
+			pVertexArray->vertexSize = sizeof(OpenGLMesh_PackedVertex);
+			pVertexArray->pVA = new float[nVerts * 3]; // 12 bytes per packed vertex
+			break;
 		}
 	}
 
@@ -1585,6 +1610,19 @@ bool Renderer::RenderStaticBuffer(unsigned int id)
 			}
 		}
 
+		if (pVertexArray->type == VT_POSITION_NORMAL_COLOUR_PACKED)
+		{
+			glEnableClientState(GL_VERTEX_ARRAY);
+			glEnableClientState(GL_NORMAL_ARRAY);
+			glEnableClientState(GL_COLOR_ARRAY);
+			RenderPackedQuads(pVertexArray, true);
+			glDisableClientState(GL_VERTEX_ARRAY);
+			glDisableClientState(GL_NORMAL_ARRAY);
+			glDisableClientState(GL_COLOR_ARRAY);
+
+			return true;
+		}
+
 		// Calculate the stride
 		GLsizei totalStride = GetStride(pVertexArray->type);
 
@@ -1669,6 +1707,17 @@ bool Renderer::RenderStaticBuffer_NoColour(unsigned int id)
 			}
 		}
 
+		if (pVertexArray->type == VT_POSITION_NORMAL_COLOUR_PACKED)
+		{
+			glEnableClientState(GL_VERTEX_ARRAY);
+			glEnableClientState(GL_NORMAL_ARRAY);
+			RenderPackedQuads(pVertexArray, false);
+			glDisableClientState(GL_VERTEX_ARRAY);
+			glDisableClientState(GL_NORMAL_ARRAY);
+
+			return true;
+		}
+
 		// Calculate the stride
 		GLsizei totalStride = GetStride(pVertexArray->type);
 
@@ -1801,6 +1850,9 @@ bool Renderer::RenderFromArray(VertexType type, unsigned int materialID, unsigne
 
 unsigned int Renderer::GetStride(VertexType type)
 {
+	if (type == VT_POSITION_NORMAL_COLOUR_PACKED)
+		return sizeof(OpenGLMesh_PackedVertex);
+
 	// Add xyz stride
 	unsigned int totalStride = sizeof(float) * 3;
 
@@ -1947,6 +1999,11 @@ void Renderer::ModifyMeshAlpha(float alpha, OpenGLTriangleMesh* pMesh)
 {
 	VertexArray* pArray = m_vertexArrays[pMesh->m_staticMeshId];
 
+	if (pArray->type == VT_POSITION_NORMAL_COLOUR_PACKED)
+	{
+		return;  // Packed colours are not modifiable
+	}
+
 	GLsizei totalStride = GetStride(pArray->type) / 4;
 	int alphaIndex = totalStride - 1;
 
@@ -1962,6 +2019,11 @@ void Renderer::ModifyMeshColour(float r, float g, float b, OpenGLTriangleMesh* p
 {
 	VertexArray* pArray = m_vertexArrays[pMesh->m_staticMeshId];
 
+	if (pArray->type == VT_POSITION_NORMAL_COLOUR_PACKED)
+	{
+		return;  // Packed colours are not modifiable
+	}
+
 	GLsizei totalStride = GetStride(pArray->type) / 4;
 	int rIndex = totalStride - 4;
 	int gIndex = totalStride - 3;
@@ -1989,6 +2051,27 @@ void Renderer::FinishMesh(unsigned int textureID, unsigned int materialID, OpenG
 	pMesh->m_materialId = materialID;
 	pMesh->m_textureId = textureID;
 
+	if (pMesh->m_meshType == OGLMeshType_PackedQuads)
+	{
+		// Packed quads are copied straight into the static buffer, their triangles come from the shared quad indices
+		unsigned int numPackedVertices = (int)pMesh->m_packedVertices.size();
+		const void* pPackedVertices = (numPackedVertices > 0) ? &pMesh->m_packedVertices[0] : NULL;
+
+		if (pMesh->m_staticMeshId == -1)
+		{
+			CreateStaticBuffer(VT_POSITION_NORMAL_COLOUR_PACKED, pMesh->m_materialId, -1, numPackedVertices, 0, 0, pPackedVertices, NULL, NULL, &pMesh->m_staticMeshId);
+		}
+		else
+		{
+			RecreateStaticBuffer(pMesh->m_staticMeshId, VT_POSITION_NORMAL_COLOUR_PACKED, pMesh->m_materialId, -1, numPackedVertices, 0, 0, pPackedVertices, NULL, NULL);
+		}
+
+		// The static buffer has its own copy now
+		vector<OpenGLMesh_PackedVertex>().swap(pMesh->m_packedVertices);
+
+		return;
+	}
+
 	// Vertices
 	OGLPositionNormalColourVertex* meshBuffer;
 	meshBuffer = new OGLPositionNormalColourVertex[numVertices];
@@ -2087,6 +2170,19 @@ void Renderer::RenderMesh_NoColour(OpenGLTriangleMesh* pMesh)
 
 void Renderer::GetMeshInformation(int *numVerts, int *numTris, OpenGLTriangleMesh* pMesh)
 {
+	if (pMesh->m_meshType == OGLMeshType_PackedQuads)
+	{
+		// Packed vertices only live in the static buffer once the mesh is finished
+		*numVerts = (int)pMesh->m_packedVertices.size();
+		if (pMesh->m_staticMeshId != -1 && m_vertexArrays[pMesh->m_staticMeshId] != NULL)
+		{
+			*numVerts = m_vertexArrays[pMesh->m_staticMeshId]->nVerts;
+		}
+		*numTris = (*numVerts / 4) * 2;
+
+		return;
+	}
+
 	*numVerts = (int)pMesh->m_vertices.size();
 	*numTris = (int)pMesh->m_triangles.size();
 }
@@ -2135,6 +2231,13 @@ bool Renderer::MeshStaticBufferRender(OpenGLTriangleMesh* pMesh)
 			}
 		}
 
+		if (pVertexArray->type == VT_POSITION_NORMAL_COLOUR_PACKED)
+		{
+			RenderPackedQuads(pVertexArray, true);
+
+			return true;
+		}
+
 		// Calculate the stride
 		GLsizei totalStride = GetStride(pVertexArray->type);
 
@@ -2180,6 +2283,62 @@ bool Renderer::MeshStaticBufferRender(OpenGLTriangleMesh* pMesh)
 	return false;
 }
 
+// Packed quad mesh
+unsigned int Renderer::AddPackedVertexToMesh(short x, short y, short z, signed char nx, signed char ny, signed char nz, unsigned char r, unsigned char g, unsigned char b, OpenGLTriangleMesh* pMesh)
+{
+	if (pMesh == NULL)
+	{
+		return -1;
+	}
+
+	OpenGLMesh_PackedVertex newVertex;
+	newVertex.vertexPosition[0] = x;
+	newVertex.vertexPosition[1] = y;
+	newVertex.vertexPosition[2] = z;
+
+	newVertex.vertexNormals[0] = nx;
+	newVertex.vertexNormals[1] = ny;
+	newVertex.vertexNormals[2] = nz;
+
+	newVertex.vertexColour[0] = r;
+	newVertex.vertexColour[1] = g;
+	newVertex.vertexColour[2] = b;
+
+	pMesh->m_packedVertices.push_back(newVertex);
+
+	unsigned int vertex_id = (int)pMesh->m_packedVertices.size() - 1;
+
+	return vertex_id;
+}
+
+void Renderer::RenderPackedQuads(VertexArray* pVertexArray, bool colour)
+{
+	GLsizei totalStride = GetStride(pVertexArray->type);
+	OpenGLMesh_PackedVertex* pVertices = (OpenGLMesh_PackedVertex*)pVertexArray->pVA;
+
+	// Render in batches, so that every batch can use the shared 16 bit quad indices
+	int maxBatchVertices = MAX_PACKED_QUADS_PER_BATCH * 4;
+	for (int firstVertex = 0; firstVertex < pVertexArray->nVerts; firstVertex += maxBatchVertices)
+	{
+		int numBatchVertices = pVertexArray->nVerts - firstVertex;
+		if (numBatchVertices > maxBatchVertices)
+		{
+			numBatchVertices = maxBatchVertices;
+		}
+
+		OpenGLMesh_PackedVertex* pBatch = &pVertices[firstVertex];
+
+		glVertexPointer(3, GL_SHORT, totalStride, pBatch->vertexPosition);
+		glNormalPointer(GL_BYTE, totalStride, pBatch->vertexNormals);
+		if (colour)
+		{
+			glColorPointer(3, GL_UNSIGNED_BYTE, totalStride, pBatch->vertexColour);
+		}
+
+		glDrawElements(GL_TRIANGLES, (numBatchVertices / 4) * 6, GL_UNSIGNED_SHORT, m_pQuadIndices);
+	}
+}
+
 // Name rendering and name picking
 void Renderer::InitNameStack()
 {
@@ -332,6 +332,9 @@ public:
 	void EndMeshRender();
 	bool MeshStaticBufferRender(OpenGLTriangleMesh* pMesh);
 
+	// Packed quad mesh
+	unsigned int AddPackedVertexToMesh(short x, short y, short z, signed char nx, signed char ny, signed char nz, unsigned char r, unsigned char g, unsigned char b, OpenGLTriangleMesh* pMesh);
+
 	// Name rendering and name picking
 	void InitNameStack();
 	void LoadNameOntoStack(int lName);
@@ -369,6 +372,7 @@ protected:
 
 private:
 	/* Private methods */
+	void RenderPackedQuads(VertexArray* pVertexArray, bool colour);
 
 public:
 	/* Public members */
@@ -420,6 +424,10 @@ private:
 	// Vertex arrays, for storing static vertex data
 	vector<VertexArray *> m_vertexArrays;
 
+	// Shared 16 bit quad indices, used by every packed quad mesh
+	static const int MAX_PACKED_QUADS_PER_BATCH = 16384;
+	unsigned short* m_pQuadIndices;
+
 	// Frame buffers
 	vector<FrameBuffer*> m_vFrameBuffers;
 
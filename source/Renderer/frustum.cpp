@@ -39,6 +39,21 @@ void Frustum::SetFrustum(float angle, float ratio, float nearD, float farD)
 	farWidth = farHeight * ratio;
 }
 
+void Frustum::SetOrthographic(float halfWidth, float halfHeight, float nearD, float farD)
+{
+	// An orthographic frustum is a box, the near and far planes are the same size
+	this->ratio = halfWidth / halfHeight;
+	this->angle = 0.0f;
+	this->nearDistance = nearD;
+	this->farDistance = farD;
+
+	tang = 0.0f;
+	nearHeight = halfHeight;
+	nearWidth = halfWidth;
+	farHeight = halfHeight;
+	farWidth = halfWidth;
+}
+
 void Frustum::SetCamera(const vec3 &pos, const vec3 &target, const vec3 &up)
 {
 	vec3 dir, nc, fc, X, Y, Z;
@@ -26,6 +26,7 @@ public:
 	~Frustum();
 
 	void SetFrustum(float angle, float ratio, float nearD, float farD);
+	void SetOrthographic(float halfWidth, float halfHeight, float nearD, float farD);
 	void SetCamera(const vec3 &pos, const vec3 &target, const vec3 &up);
 
 	int PointInFrustum(const vec3 &point);
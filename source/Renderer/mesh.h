@@ -28,6 +28,15 @@ typedef struct OpenGLMesh_Vertex
 } OpenGLMesh_Vertex;
 
 
+// Packed vertex data, 12 bytes. Used for quad meshes, where every 4 vertices make a quad
+typedef struct OpenGLMesh_PackedVertex
+{
+	short vertexPosition[3];
+	signed char vertexNormals[3];
+	unsigned char vertexColour[3];
+} OpenGLMesh_PackedVertex;
+
+
 // Texture coordinate
 typedef struct OpenGLMesh_TextureCoordinate
 {
@@ -46,6 +55,7 @@ enum OGLMeshType
 {
 	OGLMeshType_Colour = 0,
 	OGLMeshType_Textured,
+	OGLMeshType_PackedQuads,
 };
 
 class OpenGLTriangleMesh
@@ -58,6 +68,7 @@ public:
     vector<OpenGLMesh_Triangle*> m_triangles;
 	vector<OpenGLMesh_Vertex*> m_vertices;
 	vector<OpenGLMesh_TextureCoordinate*> m_textureCoordinates;
+	vector<OpenGLMesh_PackedVertex> m_packedVertices;
 
     unsigned int m_staticMeshId;
 
@@ -24,6 +24,7 @@ enum VertexType {
 	VT_POSITION_NORMAL_COLOUR,
 	VT_POSITION_NORMAL_UV,
 	VT_POSITION_NORMAL_UV_COLOUR,
+	VT_POSITION_NORMAL_COLOUR_PACKED,
 };
 
 class VertexArray {
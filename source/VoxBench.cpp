@@ -0,0 +1,380 @@
+// ******************************************************************************
+// Filename:	VoxBench.cpp
+// Project:	Vox
+// Author:	Steven Ball
+//
+// Purpose:
+//   Headless benchmark for the chunk generation and meshing. Streams the
+//   world in around a fixed position without a window or renderer, for
+//   every combination of seed, loader radius and worker thread count, and
+//   writes the throughput and memory use of each run as JSON. With --revisit
+//   each run also walks away and back, to time the chunk cache. Exits with a
+//   failure if any blocks stamped across chunk borders didn't reach their chunk,
+//   or if a run completes without streaming past its start chunk.
+//
+//   Run from the root folder, so that the settings and models are found:
+//     VoxBench --seeds 0,1 --radii 64,128 --threads 1,4 --output bench.json
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#include "VoxSettings.h"
+#include "blocks/ChunkManager.h"
+#include "models/QubicleBinaryManager.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif //__APPLE__
+#ifdef __linux__
+#include <malloc.h>
+#endif //__linux__
+#endif //_WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "tinythread/tinythread.h"
+using namespace tthread;
+
+// The noise has no seed, so each seed streams in a different part of the world instead
+static const float SEED_OFFSET = 4099.0f;
+
+struct BenchRun
+{
+	int m_seed;
+	float m_loaderRadius;
+	int m_workerThreads;
+
+	bool m_completed;
+	double m_seconds;
+	int m_numChunks;
+	int m_numMeshesCompleted;
+	long long m_numVertices;
+	float m_averageGenerateTime;
+	long m_peakRSSKB;
+
+	// Blocks stamped or edited into chunk storage that the chunk never picked up
+	int m_numStrandedBlocks;
+
+	// Walking away and back again, the returning chunks come from the chunk cache
+	bool m_revisited;
+	double m_revisitSeconds;
+	int m_numCacheHits;
+	int m_numCacheMisses;
+	int m_numCacheEvictions;
+};
+
+static double GetBenchTimerSeconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER ticks;
+	LARGE_INTEGER ticksPerSecond;
+	QueryPerformanceCounter(&ticks);
+	QueryPerformanceFrequency(&ticksPerSecond);
+	return (double)ticks.QuadPart / (double)ticksPerSecond.QuadPart;
+#else
+	struct timeval tm;
+	gettimeofday(&tm, NULL);
+	return (double)tm.tv_sec + (double)tm.tv_usec / 1000000.0;
+#endif //_WIN32
+}
+
+// Current resident memory of the process, in kilobytes. The process wide peak would carry over
+// from earlier runs, so each run samples this while streaming and keeps its own maximum.
+static long GetCurrentRSSKB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return (long)(counters.WorkingSetSize / 1024);
+#elif defined(__APPLE__)
+	mach_task_basic_info_data_t info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+	{
+		return 0;
+	}
+	return (long)(info.resident_size / 1024);
+#else
+	long numPages = 0;
+	long numResidentPages = 0;
+	FILE* pFile = fopen("/proc/self/statm", "r");
+	if (pFile == NULL)
+	{
+		return 0;
+	}
+	if (fscanf(pFile, "%ld %ld", &numPages, &numResidentPages) != 2)
+	{
+		numResidentPages = 0;
+	}
+	fclose(pFile);
+	return numResidentPages * (sysconf(_SC_PAGESIZE) / 1024);
+#endif //_WIN32
+}
+
+static void SampleRSS(long* pPeakRSSKB)
+{
+	long rss = GetCurrentRSSKB();
+	if (rss > *pPeakRSSKB)
+	{
+		*pPeakRSSKB = rss;
+	}
+}
+
+// Comma separated list of numbers
+static vector<float> ParseList(const char* text)
+{
+	vector<float> values;
+
+	string list = text;
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == string::npos)
+		{
+			end = list.size();
+		}
+
+		if (end > start)
+		{
+			values.push_back((float)atof(list.substr(start, end - start).c_str()));
+		}
+
+		start = end + 1;
+	}
+
+	return values;
+}
+
+// Stand in for the main thread, completing the meshes until there is nothing left to load or rebuild
+static bool StreamUntilComplete(ChunkManager* pChunkManager, vec3 position, double startTime, double timeout, long* pPeakRSSKB)
+{
+	pChunkManager->SetStreamingPosition(position, vec3(0.0f, 0.0f, 1.0f), 0.0f);
+
+	while (GetBenchTimerSeconds() - startTime < timeout)
+	{
+		pChunkManager->Update(0.0f);
+		SampleRSS(pPeakRSSKB);
+
+		if (pChunkManager->IsStreamingComplete())
+		{
+			return true;
+		}
+
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+
+	return false;
+}
+
+static BenchRun RunBenchmark(VoxSettings* pVoxSettings, QubicleBinaryManager* pQubicleBinaryManager, int seed, float loaderRadius, int workerThreads, bool revisit, double timeout)
+{
+	BenchRun run;
+	run.m_seed = seed;
+	run.m_loaderRadius = loaderRadius;
+	run.m_workerThreads = workerThreads;
+
+	pVoxSettings->m_chunkWorkerThreads = workerThreads;
+
+	run.m_peakRSSKB = 0;
+	SampleRSS(&run.m_peakRSSKB);
+
+	ChunkManager* pChunkManager = new ChunkManager(NULL, pVoxSettings, pQubicleBinaryManager);
+	pChunkManager->SetLoaderRadius(loaderRadius);
+
+	double startTime = GetBenchTimerSeconds();
+
+	// Start half way up grid row 0, which holds the ground for any chunk height
+	float streamingHeight = Chunk::CHUNK_SIZE_Y * Chunk::BLOCK_RENDER_SIZE;
+	vec3 origin = vec3(seed * SEED_OFFSET, streamingHeight, seed * SEED_OFFSET);
+	run.m_completed = StreamUntilComplete(pChunkManager, origin, startTime, timeout, &run.m_peakRSSKB);
+
+	run.m_seconds = GetBenchTimerSeconds() - startTime;
+
+	run.m_numChunks = 0;
+	run.m_numVertices = 0;
+	shared_ptr<ChunkRenderList> pRenderList = pChunkManager->GetRenderList();
+	for (unsigned int i = 0; pRenderList != NULL && i < pRenderList->m_vpChunks.size(); i++)
+	{
+		Chunk* pChunk = pRenderList->m_vpChunks[i];
+		if (pChunk != NULL && pChunk->IsCreated())
+		{
+			run.m_numChunks++;
+			run.m_numVertices += pChunk->GetNumMeshVertices();
+		}
+	}
+	pRenderList.reset();
+
+	run.m_numMeshesCompleted = pChunkManager->GetNumMeshesCompleted();
+	run.m_numStrandedBlocks = pChunkManager->GetNumStrandedStorageBlocks();
+
+	int numGenerated;
+	int numLoaded;
+	float averageLoadTime;
+	pChunkManager->GetChunkSetupTimings(&numGenerated, &run.m_averageGenerateTime, &numLoaded, &averageLoadTime);
+
+	// Move far enough away for every chunk to be unloaded, then time coming back to the start
+	run.m_revisited = false;
+	run.m_revisitSeconds = 0.0;
+	if (revisit && run.m_completed)
+	{
+		vec3 awayPosition = origin + vec3(pChunkManager->GetUnloaderRadius() * 2.0f + Chunk::CHUNK_SIZE_X * Chunk::BLOCK_RENDER_SIZE * 2.0f, 0.0f, 0.0f);
+		if (StreamUntilComplete(pChunkManager, awayPosition, GetBenchTimerSeconds(), timeout, &run.m_peakRSSKB))
+		{
+			double revisitStartTime = GetBenchTimerSeconds();
+			run.m_revisited = StreamUntilComplete(pChunkManager, origin, revisitStartTime, timeout, &run.m_peakRSSKB);
+			run.m_revisitSeconds = GetBenchTimerSeconds() - revisitStartTime;
+		}
+	}
+
+	int numCachedChunks;
+	unsigned int numCachedBytes;
+	pChunkManager->GetChunkCacheStatistics(&numCachedChunks, &numCachedBytes, &run.m_numCacheHits, &run.m_numCacheMisses, &run.m_numCacheEvictions);
+
+	delete pChunkManager;
+
+#ifdef __GLIBC__
+	// Hand the freed chunks back to the system, so the next run's resident memory starts from the baseline
+	malloc_trim(0);
+#endif //__GLIBC__
+
+	return run;
+}
+
+static void WriteResults(FILE* pFile, const vector<BenchRun>& vRuns)
+{
+	fprintf(pFile, "{\n  \"runs\": [\n");
+	for (unsigned int i = 0; i < vRuns.size(); i++)
+	{
+		const BenchRun& run = vRuns[i];
+
+		double chunksPerSecond = (run.m_seconds > 0.0) ? run.m_numChunks / run.m_seconds : 0.0;
+		double verticesPerChunk = (run.m_numChunks > 0) ? (double)run.m_numVertices / run.m_numChunks : 0.0;
+
+		fprintf(pFile, "    { \"seed\": %i, \"loaderRadius\": %g, \"workerThreads\": %i, \"completed\": %s, \"seconds\": %.4f, \"chunks\": %i, \"chunksPerSecond\": %.2f, \"meshesBuilt\": %i, \"verticesPerChunk\": %.2f, \"averageGenerateMs\": %.4f, \"peakRSSKB\": %ld, \"strandedStorageBlocks\": %i, ",
+			run.m_seed, run.m_loaderRadius, run.m_workerThreads, run.m_completed ? "true" : "false", run.m_seconds, run.m_numChunks, chunksPerSecond,
+			run.m_numMeshesCompleted, verticesPerChunk, run.m_averageGenerateTime * 1000.0f, run.m_peakRSSKB, run.m_numStrandedBlocks);
+		fprintf(pFile, "\"revisited\": %s, \"revisitSeconds\": %.4f, \"cacheHits\": %i, \"cacheMisses\": %i, \"cacheEvictions\": %i }%s\n",
+			run.m_revisited ? "true" : "false", run.m_revisitSeconds, run.m_numCacheHits, run.m_numCacheMisses, run.m_numCacheEvictions, (i + 1 < vRuns.size()) ? "," : "");
+	}
+	fprintf(pFile, "  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+	vector<float> seeds(1, 0.0f);
+	vector<float> radii;
+	radii.push_back(64.0f);
+	radii.push_back(128.0f);
+	vector<float> threads;
+	threads.push_back(1.0f);
+	threads.push_back((float)thread::hardware_concurrency());
+	double timeout = 300.0;
+	bool revisit = false;
+	const char* outputFile = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = (i + 1 < argc);
+		if (strcmp(argv[i], "--seeds") == 0 && hasValue)
+			seeds = ParseList(argv[++i]);
+		else if (strcmp(argv[i], "--radii") == 0 && hasValue)
+			radii = ParseList(argv[++i]);
+		else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+			threads = ParseList(argv[++i]);
+		else if (strcmp(argv[i], "--timeout") == 0 && hasValue)
+			timeout = atof(argv[++i]);
+		else if (strcmp(argv[i], "--output") == 0 && hasValue)
+			outputFile = argv[++i];
+		else if (strcmp(argv[i], "--revisit") == 0)
+			revisit = true;
+		else
+		{
+			cout << "Usage: VoxBench [--seeds 0,1] [--radii 64,128] [--threads 1,4] [--timeout seconds] [--revisit] [--output file.json]\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* Load the settings, the benchmark always generates the chunks instead of loading them */
+	VoxSettings* pVoxSettings = new VoxSettings();
+	pVoxSettings->LoadSettings();
+	pVoxSettings->m_saveChunks = false;
+
+	/* The models used by the world generation, without meshes */
+	QubicleBinaryManager* pQubicleBinaryManager = new QubicleBinaryManager(NULL);
+
+	vector<BenchRun> vRuns;
+	for (unsigned int seedIndex = 0; seedIndex < seeds.size(); seedIndex++)
+	{
+		for (unsigned int radiusIndex = 0; radiusIndex < radii.size(); radiusIndex++)
+		{
+			for (unsigned int threadIndex = 0; threadIndex < threads.size(); threadIndex++)
+			{
+				int workerThreads = (int)threads[threadIndex];
+				if (workerThreads < 1)
+				{
+					workerThreads = 1;
+				}
+
+				vRuns.push_back(RunBenchmark(pVoxSettings, pQubicleBinaryManager, (int)seeds[seedIndex], radii[radiusIndex], workerThreads, revisit, timeout));
+			}
+		}
+	}
+
+	/* Results */
+	FILE* pFile = stdout;
+	if (outputFile != NULL)
+	{
+		pFile = fopen(outputFile, "w");
+		if (pFile == NULL)
+		{
+			cout << "Can't write '" << outputFile << "'\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	WriteResults(pFile, vRuns);
+
+	// Every block that the world generation stamps across chunk borders must end up in its chunk,
+	// and a run that never streams past its start chunk hasn't measured anything
+	int exitCode = EXIT_SUCCESS;
+	for (unsigned int i = 0; i < vRuns.size(); i++)
+	{
+		if (vRuns[i].m_numStrandedBlocks > 0)
+		{
+			cout << "Run " << i << " left " << vRuns[i].m_numStrandedBlocks << " blocks in storage for chunks that are already setup\n";
+			exitCode = EXIT_FAILURE;
+		}
+		if (vRuns[i].m_completed && vRuns[i].m_numChunks <= 1)
+		{
+			cout << "Run " << i << " completed with only " << vRuns[i].m_numChunks << " chunk, the world didn't stream in around the start position\n";
+			exitCode = EXIT_FAILURE;
+		}
+	}
+
+	if (pFile != stdout)
+	{
+		fclose(pFile);
+	}
+
+	/* Cleanup */
+	delete pQubicleBinaryManager;
+	delete pVoxSettings;
+
+	return exitCode;
+}
@@ -164,65 +164,28 @@ void VoxGame::UpdateCameraClipping(float dt)
 
 	if (m_gameMode == GameMode_Game && m_cameraMode != CameraMode_Debug)
 	{
-		int numIterations = 0;
-		int maxNumIterations = 100;
-		vec3 basePos;
-		vec3 testPos;
-		vec3 cameraFacingUnit = normalize(m_pGameCamera->GetFacing());
-		bool collides = true;
-		int blockX, blockY, blockZ;
-		vec3 blockPos;
-		bool active = false;
-		vec3 toPlayer = ((m_pPlayer->GetCenter() + Player::PLAYER_CENTER_OFFSET) - m_pGameCamera->GetFakePosition());
-		float distance = length(toPlayer);
-		float incrementAmount = distance / maxNumIterations;
-		while (collides == true && numIterations < maxNumIterations)
+		// Cast from the player to the camera, along the middle and the edges of the camera, and pull the camera in to the closest hit
+		vec3 playerCenter = m_pPlayer->GetCenter() + Player::PLAYER_CENTER_OFFSET;
+		vec3 toCamera = cameraPosition - playerCenter;
+		float distance = length(toCamera);
+		if (distance > 0.0f)
 		{
-			collides = false;
-			basePos = cameraPosition;
-
+			vec3 cameraDirection = toCamera / distance;
 			vec3 playerRight = m_pPlayer->GetRightVector() * 0.25f;
-			testPos = basePos + playerRight;
-			Chunk* pChunk = NULL;
-			active = m_pChunkManager->GetBlockActiveFrom3DPosition(testPos.x, testPos.y, testPos.z, &blockPos, &blockX, &blockY, &blockZ, &pChunk);
-			if (active)
-			{
-				collides = true;
-			}
-
-			playerRight = m_pPlayer->GetRightVector() * -0.25f;
-			testPos = basePos + playerRight;
-			pChunk = NULL;
-			active = m_pChunkManager->GetBlockActiveFrom3DPosition(testPos.x, testPos.y, testPos.z, &blockPos, &blockX, &blockY, &blockZ, &pChunk);
-			if (active)
-			{
-				collides = true;
-			}
-
-			vec3 playerUp = m_pPlayer->GetUpVector() * -0.25f;
-			testPos = basePos + playerUp;
-			pChunk = NULL;
-			active = m_pChunkManager->GetBlockActiveFrom3DPosition(testPos.x, testPos.y, testPos.z, &blockPos, &blockX, &blockY, &blockZ, &pChunk);
-			if (active)
-			{
-				collides = true;
-			}
-
-			playerUp = m_pPlayer->GetUpVector() * 0.25f;
-			testPos = basePos + playerUp;
-			pChunk = NULL;
-			active = m_pChunkManager->GetBlockActiveFrom3DPosition(testPos.x, testPos.y, testPos.z, &blockPos, &blockX, &blockY, &blockZ, &pChunk);
-			if (active)
-			{
-				collides = true;
-			}
+			vec3 playerUp = m_pPlayer->GetUpVector() * 0.25f;
+			vec3 offsets[5] = { vec3(0.0f, 0.0f, 0.0f), playerRight, -playerRight, playerUp, -playerUp };
 
-			if (collides == true)
+			float clippedDistance = distance;
+			for (int i = 0; i < 5; i++)
 			{
-				cameraPosition += m_pGameCamera->GetFacing() * incrementAmount;
+				ChunkRaycastHit hit;
+				if (m_pChunkManager->Raycast(playerCenter + offsets[i], cameraDirection, clippedDistance, &hit))
+				{
+					clippedDistance = hit.m_distance;
+				}
 			}
 
-			numIterations++;
+			cameraPosition = playerCenter + cameraDirection * clippedDistance;
 		}
 	}
 
@@ -109,6 +109,9 @@ void VoxGame::Create(VoxSettings* pVoxSettings)
 	frameBufferCreated = m_pRenderer->CreateFrameBuffer(-1, true, true, true, true, m_windowWidth, m_windowHeight, 1.0f, "FullScreen 1st Pass", &m_firstPassFullscreenBuffer);
 	frameBufferCreated = m_pRenderer->CreateFrameBuffer(-1, true, true, true, true, m_windowWidth, m_windowHeight, 1.0f, "FullScreen 2nd Pass", &m_secondPassFullscreenBuffer);
 
+	/* Create the shadow frustum */
+	m_pShadowFrustum = new Frustum();
+
 	/* Create the shaders */
 	bool shaderLoaded = false;
 	m_defaultShader = -1;
@@ -239,6 +242,7 @@ void VoxGame::Destroy()
 	if (c_instance)
 	{
 		delete m_pSkybox;
+		delete m_pShadowFrustum;
 		delete m_pLightingManager;
 		delete m_pPlayer;
 		delete m_pSceneryManager;
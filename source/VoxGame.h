@@ -270,6 +270,9 @@ private:
 	unsigned int m_firstPassFullscreenBuffer;
 	unsigned int m_secondPassFullscreenBuffer;
 
+	// Light frustum, for culling the shadow render
+	Frustum* m_pShadowFrustum;
+
 	// Shaders
 	unsigned int m_defaultShader;
 	unsigned int m_phongShader;
@@ -93,7 +93,8 @@ void VoxGame::Render()
 			}
 
 			// Render the chunks
-			m_pChunkManager->Render();
+			m_pChunkManager->UpdateOcclusionCulling(m_pGameCamera->GetPosition(), m_pRenderer->GetFrustum(m_defaultViewport));
+			m_pChunkManager->Render(m_pRenderer->GetFrustum(m_defaultViewport), m_pGameCamera->GetPosition(), false);
 
 			// Scenery
 			m_pSceneryManager->Render(false, false, false, false, false);
@@ -131,7 +132,7 @@ void VoxGame::Render()
 
 				m_pSceneryManager->RenderDebug();
 
-				m_pChunkManager->RenderDebug();
+				m_pChunkManager->RenderDebug(m_pRenderer->GetFrustum(m_defaultViewport));
 			}
 		m_pRenderer->PopMatrix();
 
@@ -184,7 +185,7 @@ void VoxGame::Render()
 		// Render the chunks 2d
 		if (m_debugRender)
 		{
-			//m_pChunkManager->Render2D(m_pGameCamera, m_defaultViewport, m_defaultFont);
+			//m_pChunkManager->Render2D(m_pGameCamera, m_defaultViewport, m_defaultFont, m_pRenderer->GetFrustum(m_defaultViewport));
 		}
 
 		// Render the GUI
@@ -239,11 +240,15 @@ void VoxGame::RenderShadows()
 		vec3 lightPos = m_defaultLightPosition + m_pPlayer->GetCenter(); // Make sure our light is always offset from the player
 		m_pRenderer->SetLookAtCamera(vec3(lightPos.x, lightPos.y, lightPos.z), m_pPlayer->GetCenter(), vec3(0.0f, 1.0f, 0.0f));
 
+		// Match the light frustum to the shadow projection, so chunks that can't cast into the shadow map are culled
+		m_pShadowFrustum->SetOrthographic(loaderRadius, loaderRadius, 0.01f, 1000.0f);
+		m_pShadowFrustum->SetCamera(vec3(lightPos.x, lightPos.y, lightPos.z), m_pPlayer->GetCenter(), vec3(0.0f, 1.0f, 0.0f));
+
 		m_pRenderer->PushMatrix();
 			m_pRenderer->SetCullMode(CM_FRONT);
 
 			// Render the chunks
-			m_pChunkManager->Render();
+			m_pChunkManager->Render(m_pShadowFrustum, m_pGameCamera->GetPosition(), true);
 
 			// Render the player
 			m_pPlayer->Render();
@@ -614,6 +619,29 @@ void VoxGame::RenderDebugInformation()
 	{
 		snprintf(lFPSBuff, 128, "FPS: %.0f", m_fps);
 	}
+	char lChunksBuff[128];
+	int numGeneratedChunks;
+	int numLoadedChunks;
+	float averageGenerateTime;
+	float averageLoadTime;
+	m_pChunkManager->GetChunkSetupTimings(&numGeneratedChunks, &averageGenerateTime, &numLoadedChunks, &averageLoadTime);
+	snprintf(lChunksBuff, 128, "Chunks generated: %i (%.2fms)  Chunks loaded: %i (%.2fms)", numGeneratedChunks, averageGenerateTime * 1000.0f, numLoadedChunks, averageLoadTime * 1000.0f);
+	char lCullingBuff[128];
+	int numRenderedChunks;
+	int numCulledChunks;
+	int numOccludedChunks;
+	int numShadowRenderedChunks;
+	int numShadowCulledChunks;
+	m_pChunkManager->GetRenderCounters(&numRenderedChunks, &numCulledChunks, &numOccludedChunks, &numShadowRenderedChunks, &numShadowCulledChunks);
+	snprintf(lCullingBuff, 128, "Chunks rendered: %i (%i culled, %i occluded)  Shadow chunks rendered: %i (%i culled)", numRenderedChunks, numCulledChunks, numOccludedChunks, numShadowRenderedChunks, numShadowCulledChunks);
+	char lChunkCacheBuff[128];
+	int numCachedChunks;
+	unsigned int numCachedBytes;
+	int numCacheHits;
+	int numCacheMisses;
+	int numCacheEvictions;
+	m_pChunkManager->GetChunkCacheStatistics(&numCachedChunks, &numCachedBytes, &numCacheHits, &numCacheMisses, &numCacheEvictions);
+	snprintf(lChunkCacheBuff, 128, "Chunk cache: %i chunks (%.2fMB)  Hits: %i  Misses: %i  Evictions: %i", numCachedChunks, numCachedBytes / (1024.0f * 1024.0f), numCacheHits, numCacheMisses, numCacheEvictions);
 
 	int l_nTextHeight = m_pRenderer->GetFreeTypeTextHeight(m_defaultFont, "a");
 
@@ -626,6 +654,9 @@ void VoxGame::RenderDebugInformation()
 		if (m_debugRender)
 		{
 			m_pRenderer->RenderFreeTypeText(m_defaultFont, 15.0f, m_windowHeight - l_nTextHeight - 10.0f, 1.0f, Colour(1.0f, 1.0f, 1.0f), 1.0f, lCameraBuff);
+			m_pRenderer->RenderFreeTypeText(m_defaultFont, 15.0f, m_windowHeight - (l_nTextHeight * 2) - 14.0f, 1.0f, Colour(1.0f, 1.0f, 1.0f), 1.0f, lChunksBuff);
+			m_pRenderer->RenderFreeTypeText(m_defaultFont, 15.0f, m_windowHeight - (l_nTextHeight * 3) - 18.0f, 1.0f, Colour(1.0f, 1.0f, 1.0f), 1.0f, lCullingBuff);
+			m_pRenderer->RenderFreeTypeText(m_defaultFont, 15.0f, m_windowHeight - (l_nTextHeight * 4) - 22.0f, 1.0f, Colour(1.0f, 1.0f, 1.0f), 1.0f, lChunkCacheBuff);
 		}
 
 		m_pRenderer->RenderFreeTypeText(m_defaultFont, 15.0f, 15.0f, 1.0f, Colour(1.0f, 1.0f, 1.0f), 1.0f, lFPSBuff);
@@ -54,6 +54,8 @@ void VoxSettings::LoadSettings()
 	m_msaa = reader.GetBoolean("Graphics", "MSAA", false);
 	m_instancedParticles = reader.GetBoolean("Graphics", "InstancedParticles", false);
 	m_faceMerging = reader.GetBoolean("Graphics", "FaceMerging", false);
+	m_occlusionCulling = reader.GetBoolean("Graphics", "OcclusionCulling", true);
+	m_bakedAO = reader.GetBoolean("Graphics", "BakedAO", true);
 
 	// Landscape generation
 	m_landscapeOctaves = (float)reader.GetReal("Landscape", "LandscapeOctaves", 4.0f);
@@ -64,6 +66,16 @@ void VoxSettings::LoadSettings()
 	m_mountainScale = (float)reader.GetReal("Landscape", "MountainScale", 0.0075f);
 	m_mountainMultiplier = (float)reader.GetReal("Landscape", "MountainMultiplier", 3.0f);
 
+	// Chunks
+	m_chunkWorkerThreads = reader.GetInteger("Chunks", "WorkerThreads", 0);
+	m_saveChunks = reader.GetBoolean("Chunks", "SaveChunks", true);
+	m_regionFolder = reader.Get("Chunks", "RegionFolder", "saves/world/");
+	m_chunkLOD = reader.GetBoolean("Chunks", "LOD", true);
+	m_chunkLOD1Distance = (float)reader.GetReal("Chunks", "LOD1Distance", 64.0f);
+	m_chunkLOD2Distance = (float)reader.GetReal("Chunks", "LOD2Distance", 128.0f);
+	m_chunkLOD3Distance = (float)reader.GetReal("Chunks", "LOD3Distance", 192.0f);
+	m_chunkCacheSize = reader.GetInteger("Chunks", "CacheSize", 64);
+
 	// Debug
 	m_debugRendering = reader.GetBoolean("Debug", "DebugRendering", false);
 	m_stepUpdating = reader.GetBoolean("Debug", "StepUpdatng", false);
@@ -55,6 +55,8 @@ public:
 	bool m_msaa;
 	bool m_instancedParticles;
 	bool m_faceMerging;
+	bool m_occlusionCulling;
+	bool m_bakedAO;
 
 	// Landscape generation
 	float m_landscapeOctaves;
@@ -65,6 +67,16 @@ public:
 	float m_mountainScale;
 	float m_mountainMultiplier;
 
+	// Chunks
+	int m_chunkWorkerThreads;
+	bool m_saveChunks;
+	string m_regionFolder;
+	bool m_chunkLOD;
+	float m_chunkLOD1Distance;
+	float m_chunkLOD2Distance;
+	float m_chunkLOD3Distance;
+	int m_chunkCacheSize;
+
 	// Debug
 	bool m_debugRendering;
 	bool m_wireframeRendering;
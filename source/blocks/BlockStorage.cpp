@@ -0,0 +1,391 @@
+// ******************************************************************************
+// Filename:	BlockStorage.cpp
+// Project:	Game
+// Author:	Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#include "BlockStorage.h"
+
+#include <algorithm>
+
+
+BlockStorage::BlockStorage(int numBlocks)
+{
+	m_numBlocks = numBlocks;
+
+	// Start with every block empty
+	BlockStorageLayout* pLayout = new BlockStorageLayout();
+	pLayout->m_bitsPerBlock = 0;
+	pLayout->m_bitsShift = 0;
+	pLayout->m_indexMask = 0;
+	pLayout->m_blocksPerWordMask = 0;
+	pLayout->m_paletteSize = 1;
+	pLayout->m_paletteCapacity = 1;
+	pLayout->m_pPalette = new unsigned int[1];
+	pLayout->m_pPalette[0] = 0;
+	pLayout->m_numWords = 0;
+	pLayout->m_pWords = NULL;
+
+	m_pLayout.store(pLayout);
+
+	m_numOccupancyWords = (numBlocks + 63) / 64;
+	m_pOccupancy = new atomic<unsigned long long>[m_numOccupancyWords];
+	for (int i = 0; i < m_numOccupancyWords; i++)
+	{
+		m_pOccupancy[i].store(0, memory_order_relaxed);
+	}
+}
+
+BlockStorage::~BlockStorage()
+{
+	DeleteLayout(m_pLayout.load());
+
+	for (unsigned int i = 0; i < m_vpRetiredLayouts.size(); i++)
+	{
+		DeleteLayout(m_vpRetiredLayouts[i]);
+		m_vpRetiredLayouts[i] = 0;
+	}
+	m_vpRetiredLayouts.clear();
+
+	delete[] m_pOccupancy;
+}
+
+// Blocks
+unsigned int BlockStorage::GetColour(int index) const
+{
+	return GetColour(m_pLayout.load(memory_order_acquire), index);
+}
+
+bool BlockStorage::SetColour(int index, unsigned int colour)
+{
+	lock_guard<mutex> lock(m_writeLock);
+
+	BlockStorageLayout* pLayout = m_pLayout.load(memory_order_relaxed);
+
+	if (GetColour(pLayout, index) == colour)
+	{
+		return false;
+	}
+
+	SetActive(index, colour);
+
+	unsigned int value = colour;
+	if (pLayout->m_bitsPerBlock != 32)
+	{
+		int paletteIndex = -1;
+		for (int i = 0; i < pLayout->m_paletteSize && paletteIndex == -1; i++)
+		{
+			if (pLayout->m_pPalette[i] == colour)
+			{
+				paletteIndex = i;
+			}
+		}
+
+		if (paletteIndex == -1 && pLayout->m_bitsPerBlock != 0 && pLayout->m_paletteSize < pLayout->m_paletteCapacity)
+		{
+			// The new entry is written before any block index that uses it is published
+			paletteIndex = pLayout->m_paletteSize;
+			pLayout->m_pPalette[paletteIndex] = colour;
+			pLayout->m_paletteSize++;
+		}
+
+		if (paletteIndex == -1)
+		{
+			// The palette is full, rebuild with more bits per block
+			unsigned int* pColours = new unsigned int[m_numBlocks];
+			GetColours(pLayout, pColours);
+			pColours[index] = colour;
+			PublishLayout(CreateLayout(pColours, pLayout));
+			delete[] pColours;
+
+			return true;
+		}
+
+		value = (unsigned int)paletteIndex;
+	}
+
+	atomic<unsigned int>* pWord = &pLayout->m_pWords[index >> (5 - pLayout->m_bitsShift)];
+	int bitOffset = (index & pLayout->m_blocksPerWordMask) << pLayout->m_bitsShift;
+
+	unsigned int word = pWord->load(memory_order_relaxed);
+	word = (word & ~(pLayout->m_indexMask << bitOffset)) | (value << bitOffset);
+	pWord->store(word, memory_order_release);
+
+	return true;
+}
+
+// Bulk access
+void BlockStorage::GetColours(unsigned int* pColours) const
+{
+	GetColours(m_pLayout.load(memory_order_acquire), pColours);
+}
+
+void BlockStorage::SetColours(const unsigned int* pColours)
+{
+	// Sets every block that has a non-zero colour in pColours, the other blocks are left as they are
+	bool anyColours = false;
+	for (int i = 0; i < m_numBlocks && anyColours == false; i++)
+	{
+		if (pColours[i] != 0)
+		{
+			anyColours = true;
+		}
+	}
+
+	if (anyColours == false)
+	{
+		return;
+	}
+
+	lock_guard<mutex> lock(m_writeLock);
+
+	unsigned int* pMergedColours = new unsigned int[m_numBlocks];
+	GetColours(m_pLayout.load(memory_order_relaxed), pMergedColours);
+	for (int i = 0; i < m_numBlocks; i++)
+	{
+		if (pColours[i] != 0)
+		{
+			pMergedColours[i] = pColours[i];
+		}
+	}
+
+	PublishLayout(CreateLayout(pMergedColours, m_pLayout.load(memory_order_relaxed)));
+	SetOccupancy(pMergedColours);
+
+	delete[] pMergedColours;
+}
+
+// Occupancy
+bool BlockStorage::GetActive(int index) const
+{
+	return (m_pOccupancy[index >> 6].load(memory_order_acquire) & (1ULL << (index & 63))) != 0;
+}
+
+int BlockStorage::GetNumOccupancyWords() const
+{
+	return m_numOccupancyWords;
+}
+
+void BlockStorage::GetOccupancy(unsigned long long* pWords) const
+{
+	for (int i = 0; i < m_numOccupancyWords; i++)
+	{
+		pWords[i] = m_pOccupancy[i].load(memory_order_acquire);
+	}
+}
+
+// Information
+bool BlockStorage::IsUniform() const
+{
+	return m_pLayout.load(memory_order_acquire)->m_bitsPerBlock == 0;
+}
+
+int BlockStorage::GetBitsPerBlock() const
+{
+	return m_pLayout.load(memory_order_acquire)->m_bitsPerBlock;
+}
+
+unsigned int BlockStorage::GetMemoryUsage()
+{
+	lock_guard<mutex> lock(m_writeLock);
+
+	unsigned int memoryUsage = sizeof(BlockStorage);
+	memoryUsage += m_numOccupancyWords * sizeof(unsigned long long);
+	memoryUsage += GetLayoutMemoryUsage(m_pLayout.load(memory_order_relaxed));
+	for (unsigned int i = 0; i < m_vpRetiredLayouts.size(); i++)
+	{
+		memoryUsage += GetLayoutMemoryUsage(m_vpRetiredLayouts[i]);
+	}
+
+	return memoryUsage;
+}
+
+// Private methods
+unsigned int BlockStorage::GetColour(const BlockStorageLayout* pLayout, int index)
+{
+	if (pLayout->m_bitsPerBlock == 0)
+	{
+		return pLayout->m_pPalette[0];
+	}
+
+	unsigned int word = pLayout->m_pWords[index >> (5 - pLayout->m_bitsShift)].load(memory_order_acquire);
+	unsigned int value = (word >> ((index & pLayout->m_blocksPerWordMask) << pLayout->m_bitsShift)) & pLayout->m_indexMask;
+
+	if (pLayout->m_bitsPerBlock == 32)
+	{
+		return value;
+	}
+
+	return pLayout->m_pPalette[value];
+}
+
+void BlockStorage::GetColours(const BlockStorageLayout* pLayout, unsigned int* pColours) const
+{
+	if (pLayout->m_bitsPerBlock == 0)
+	{
+		for (int i = 0; i < m_numBlocks; i++)
+		{
+			pColours[i] = pLayout->m_pPalette[0];
+		}
+	}
+	else if (pLayout->m_bitsPerBlock == 32)
+	{
+		for (int i = 0; i < m_numBlocks; i++)
+		{
+			pColours[i] = pLayout->m_pWords[i].load(memory_order_acquire);
+		}
+	}
+	else
+	{
+		// Unpack a whole word at a time
+		int blocksPerWord = pLayout->m_blocksPerWordMask + 1;
+		int index = 0;
+		for (int i = 0; i < pLayout->m_numWords; i++)
+		{
+			unsigned int word = pLayout->m_pWords[i].load(memory_order_acquire);
+			for (int j = 0; j < blocksPerWord && index < m_numBlocks; j++)
+			{
+				pColours[index] = pLayout->m_pPalette[word & pLayout->m_indexMask];
+				word >>= pLayout->m_bitsPerBlock;
+				index++;
+			}
+		}
+	}
+}
+
+BlockStorageLayout* BlockStorage::CreateLayout(const unsigned int* pColours, const BlockStorageLayout* pPreviousLayout)
+{
+	// Find the different colours, keeping the previous palette so that it only ever grows and a layout is
+	// only replaced when the palette outgrows its bits per block, instead of on every new colour once it is full
+	vector<unsigned int> vPalette(pColours, pColours + m_numBlocks);
+	vPalette.insert(vPalette.end(), pPreviousLayout->m_pPalette, pPreviousLayout->m_pPalette + pPreviousLayout->m_paletteSize);
+	sort(vPalette.begin(), vPalette.end());
+	vPalette.erase(unique(vPalette.begin(), vPalette.end()), vPalette.end());
+	int numColours = (int)vPalette.size();
+
+	// Bits per block are a power of 2, so that block indices never straddle two words
+	int bitsPerBlock = 0;
+	if (numColours > MAX_PALETTE_SIZE)
+	{
+		bitsPerBlock = 32;
+	}
+	else if (numColours > 1)
+	{
+		bitsPerBlock = 1;
+		while ((1 << bitsPerBlock) < numColours)
+		{
+			bitsPerBlock *= 2;
+		}
+	}
+
+	BlockStorageLayout* pLayout = new BlockStorageLayout();
+	pLayout->m_bitsPerBlock = bitsPerBlock;
+	pLayout->m_bitsShift = 0;
+	for (int bits = bitsPerBlock; bits > 1; bits >>= 1)
+	{
+		pLayout->m_bitsShift++;
+	}
+	pLayout->m_indexMask = (bitsPerBlock == 32) ? 0xFFFFFFFF : ((1u << bitsPerBlock) - 1);
+	pLayout->m_blocksPerWordMask = (bitsPerBlock == 0) ? 0 : (32 / bitsPerBlock) - 1;
+
+	// Palette
+	if (bitsPerBlock == 32)
+	{
+		pLayout->m_paletteSize = 0;
+		pLayout->m_paletteCapacity = 0;
+		pLayout->m_pPalette = NULL;
+	}
+	else
+	{
+		pLayout->m_paletteSize = numColours;
+		pLayout->m_paletteCapacity = 1 << bitsPerBlock;
+		pLayout->m_pPalette = new unsigned int[pLayout->m_paletteCapacity];
+		for (int i = 0; i < numColours; i++)
+		{
+			pLayout->m_pPalette[i] = vPalette[i];
+		}
+	}
+
+	// Block indices
+	pLayout->m_numWords = 0;
+	pLayout->m_pWords = NULL;
+	if (bitsPerBlock != 0)
+	{
+		pLayout->m_numWords = (m_numBlocks * bitsPerBlock + 31) / 32;
+
+		vector<unsigned int> vWords(pLayout->m_numWords, 0);
+		for (int i = 0; i < m_numBlocks; i++)
+		{
+			unsigned int value = pColours[i];
+			if (bitsPerBlock != 32)
+			{
+				value = (unsigned int)(lower_bound(vPalette.begin(), vPalette.end(), pColours[i]) - vPalette.begin());
+			}
+
+			vWords[i >> (5 - pLayout->m_bitsShift)] |= value << ((i & pLayout->m_blocksPerWordMask) << pLayout->m_bitsShift);
+		}
+
+		pLayout->m_pWords = new atomic<unsigned int>[pLayout->m_numWords];
+		for (int i = 0; i < pLayout->m_numWords; i++)
+		{
+			pLayout->m_pWords[i].store(vWords[i], memory_order_relaxed);
+		}
+	}
+
+	return pLayout;
+}
+
+void BlockStorage::PublishLayout(BlockStorageLayout* pLayout)
+{
+	// Readers may still be using the old layout, so it is only deleted along with the storage
+	BlockStorageLayout* pOldLayout = m_pLayout.load(memory_order_relaxed);
+	m_pLayout.store(pLayout, memory_order_release);
+	m_vpRetiredLayouts.push_back(pOldLayout);
+}
+
+void BlockStorage::DeleteLayout(BlockStorageLayout* pLayout)
+{
+	delete[] pLayout->m_pPalette;
+	delete[] pLayout->m_pWords;
+	delete pLayout;
+}
+
+unsigned int BlockStorage::GetLayoutMemoryUsage(const BlockStorageLayout* pLayout)
+{
+	return sizeof(BlockStorageLayout) + (pLayout->m_paletteCapacity * sizeof(unsigned int)) + (pLayout->m_numWords * sizeof(unsigned int));
+}
+
+void BlockStorage::SetActive(int index, unsigned int colour)
+{
+	unsigned long long bit = 1ULL << (index & 63);
+	if ((colour & 0xFF000000) != 0)
+	{
+		m_pOccupancy[index >> 6].fetch_or(bit, memory_order_release);
+	}
+	else
+	{
+		m_pOccupancy[index >> 6].fetch_and(~bit, memory_order_release);
+	}
+}
+
+void BlockStorage::SetOccupancy(const unsigned int* pColours)
+{
+	for (int i = 0; i < m_numOccupancyWords; i++)
+	{
+		unsigned long long word = 0;
+		for (int j = 0; j < 64 && (i * 64 + j) < m_numBlocks; j++)
+		{
+			if ((pColours[i * 64 + j] & 0xFF000000) != 0)
+			{
+				word |= (1ULL << j);
+			}
+		}
+
+		m_pOccupancy[i].store(word, memory_order_release);
+	}
+}
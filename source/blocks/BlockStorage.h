@@ -0,0 +1,120 @@
+// ******************************************************************************
+// Filename:	BlockStorage.h
+// Project:	Game
+// Author:	Steven Ball
+//
+// Purpose:
+//   Palette compressed block colour storage for a chunk. Blocks are stored as
+//   small indices into a per-chunk colour palette, using as few bits as the
+//   number of different colours needs. A chunk that is all one colour (e.g.
+//   all air) has no index data at all.
+//
+//   Reads are lock free, so worker threads can mesh a chunk while blocks are
+//   being written. A write that needs a bigger palette builds a new layout and
+//   publishes it, old layouts are kept alive until the storage is deleted.
+//   Palette entries are never dropped, so a chunk only retires a layout when
+//   its palette outgrows the bits per block, at most once per bit width, plus
+//   one for each bulk SetColours().
+//
+//   An occupancy bitfield with one bit per solid block is kept alongside the
+//   colours, so solidity queries never have to unpack a colour.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "../tinythread/tinythread.h"
+using namespace tthread;
+
+#include <atomic>
+#include <vector>
+using namespace std;
+
+struct BlockStorageLayout
+{
+	// Bits per block index, 0 means every block is m_pPalette[0], 32 means the blocks are raw colours with no palette
+	int m_bitsPerBlock;
+	int m_bitsShift;
+	unsigned int m_indexMask;
+	unsigned int m_blocksPerWordMask;
+
+	// Palette
+	int m_paletteSize;
+	int m_paletteCapacity;
+	unsigned int* m_pPalette;
+
+	// Packed block indices
+	int m_numWords;
+	atomic<unsigned int>* m_pWords;
+};
+
+typedef vector<BlockStorageLayout*> BlockStorageLayoutList;
+
+class BlockStorage
+{
+public:
+	/* Public methods */
+	BlockStorage(int numBlocks);
+	~BlockStorage();
+
+	// Blocks
+	unsigned int GetColour(int index) const;
+	bool SetColour(int index, unsigned int colour);
+
+	// Bulk access
+	void GetColours(unsigned int* pColours) const;
+	void SetColours(const unsigned int* pColours);
+
+	// Occupancy, bit (index & 63) of word (index >> 6) is set for a block with a non-zero alpha
+	bool GetActive(int index) const;
+	int GetNumOccupancyWords() const;
+	void GetOccupancy(unsigned long long* pWords) const;
+
+	// Information
+	bool IsUniform() const;
+	int GetBitsPerBlock() const;
+	unsigned int GetMemoryUsage();
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	static unsigned int GetColour(const BlockStorageLayout* pLayout, int index);
+	void GetColours(const BlockStorageLayout* pLayout, unsigned int* pColours) const;
+	BlockStorageLayout* CreateLayout(const unsigned int* pColours, const BlockStorageLayout* pPreviousLayout);
+	void PublishLayout(BlockStorageLayout* pLayout);
+	static void DeleteLayout(BlockStorageLayout* pLayout);
+	static unsigned int GetLayoutMemoryUsage(const BlockStorageLayout* pLayout);
+	void SetActive(int index, unsigned int colour);
+	void SetOccupancy(const unsigned int* pColours);
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	static const int MAX_PALETTE_SIZE = 256;
+
+	int m_numBlocks;
+
+	// The current layout, readers load this without locking
+	atomic<BlockStorageLayout*> m_pLayout;
+
+	// Layouts that have been replaced, a reader may still be using them
+	BlockStorageLayoutList m_vpRetiredLayouts;
+
+	// Occupancy bitfield, only written under the write lock
+	int m_numOccupancyWords;
+	atomic<unsigned long long>* m_pOccupancy;
+
+	// Writers are serialized
+	mutex m_writeLock;
+};
@@ -11,6 +11,7 @@
 
 #include "Chunk.h"
 #include "ChunkManager.h"
+#include "Prefab.h"
 #include "../Player/Player.h"
 #include "../scenery/SceneryManager.h"
 #include "../models/QubicleBinary.h"
@@ -18,8 +19,83 @@
 #include "../simplex/simplexnoise.h"
 #include "../VoxSettings.h"
 
+#include <string.h>
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif //_WIN32
+
 const float Chunk::BLOCK_RENDER_SIZE = 0.5f;
-const float Chunk::CHUNK_RADIUS = sqrt(((CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f)*(CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f))*2.0f) / 2.0f + ((Chunk::BLOCK_RENDER_SIZE*2.0f)*2.0f);
+const float Chunk::CHUNK_RADIUS = sqrt((CHUNK_SIZE_X * Chunk::BLOCK_RENDER_SIZE*2.0f)*(CHUNK_SIZE_X * Chunk::BLOCK_RENDER_SIZE*2.0f) + (CHUNK_SIZE_Z * Chunk::BLOCK_RENDER_SIZE*2.0f)*(CHUNK_SIZE_Z * Chunk::BLOCK_RENDER_SIZE*2.0f)) / 2.0f + ((Chunk::BLOCK_RENDER_SIZE*2.0f)*2.0f);
+
+// Index of the lowest set bit, value must not be zero
+inline int CountTrailingZeros(unsigned int value)
+{
+#ifdef _WIN32
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return (int)index;
+#else
+	return __builtin_ctz(value);
+#endif //_WIN32
+}
+
+// The blocks on each face of a chunk, as occupancy words
+struct ChunkWallMasks
+{
+	unsigned long long m_masks[ChunkFace_NUM][Chunk::OCCUPANCY_WORDS];
+
+	ChunkWallMasks()
+	{
+		memset(m_masks, 0, sizeof(m_masks));
+
+		for (int index = 0; index < Chunk::CHUNK_NUM_BLOCKS; index++)
+		{
+			int x = index % Chunk::CHUNK_SIZE_X;
+			int y = (index / Chunk::CHUNK_SIZE_X) % Chunk::CHUNK_SIZE_Y;
+			int z = index / Chunk::CHUNK_SIZE_XY;
+			unsigned long long bit = 1ULL << (index & 63);
+
+			if (x == 0) m_masks[ChunkFace_Left][index >> 6] |= bit;
+			if (x == Chunk::CHUNK_SIZE_X - 1) m_masks[ChunkFace_Right][index >> 6] |= bit;
+			if (y == 0) m_masks[ChunkFace_Bottom][index >> 6] |= bit;
+			if (y == Chunk::CHUNK_SIZE_Y - 1) m_masks[ChunkFace_Top][index >> 6] |= bit;
+			if (z == 0) m_masks[ChunkFace_Back][index >> 6] |= bit;
+			if (z == Chunk::CHUNK_SIZE_Z - 1) m_masks[ChunkFace_Front][index >> 6] |= bit;
+		}
+	}
+};
+
+static const ChunkWallMasks s_wallMasks;
+
+// Baked ambient occlusion. The offset to the air in front of each face, and the directions of the face's u and v axes.
+static const int s_faceNormals[ChunkFace_NUM][3] = { { 0, 0, 1 }, { 0, 0, -1 }, { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 } };
+static const int s_faceAxisU[ChunkFace_NUM][3] = { { 1, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 0, 1, 0 }, { 1, 0, 0 }, { 1, 0, 0 } };
+static const int s_faceAxisV[ChunkFace_NUM][3] = { { 0, 1, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 } };
+
+// The u, v corner of each of a quad's vertices, in the order they are added to the mesh
+static const int s_faceVertexCorners[ChunkFace_NUM][4] = { { 0, 1, 2, 3 }, { 1, 0, 3, 2 }, { 3, 0, 1, 2 }, { 0, 3, 2, 1 }, { 3, 2, 1, 0 }, { 0, 1, 2, 3 } };
+
+// The number of layers for each face, and the u and v size of each layer
+static const int s_faceSizes[ChunkFace_NUM][3] = {
+	{ Chunk::CHUNK_SIZE_Z, Chunk::CHUNK_SIZE_X, Chunk::CHUNK_SIZE_Y }, { Chunk::CHUNK_SIZE_Z, Chunk::CHUNK_SIZE_X, Chunk::CHUNK_SIZE_Y },
+	{ Chunk::CHUNK_SIZE_X, Chunk::CHUNK_SIZE_Y, Chunk::CHUNK_SIZE_Z }, { Chunk::CHUNK_SIZE_X, Chunk::CHUNK_SIZE_Y, Chunk::CHUNK_SIZE_Z },
+	{ Chunk::CHUNK_SIZE_Y, Chunk::CHUNK_SIZE_X, Chunk::CHUNK_SIZE_Z }, { Chunk::CHUNK_SIZE_Y, Chunk::CHUNK_SIZE_X, Chunk::CHUNK_SIZE_Z } };
+
+// Vertex brightness for each ambient occlusion level, from fully occluded to open
+static const unsigned int s_aoBrightness[4] = { 128, 166, 209, 255 };
+static const unsigned char AO_UNOCCLUDED = 0xFF;
+
+inline int GetPaddedIndex(int x, int y, int z)
+{
+	return (x + 1) + (y + 1) * Chunk::PADDED_CHUNK_SIZE_X + (z + 1) * Chunk::PADDED_CHUNK_SIZE_X * Chunk::PADDED_CHUNK_SIZE_Y;
+}
+
+// Bit in the rebuild neighbours mask for the neighbour chunk at offset -1, 0 or 1 on each axis
+inline unsigned int GetNeighbourBit(int x, int y, int z)
+{
+	return 1u << ((x + 1) + (y + 1) * 3 + (z + 1) * 9);
+}
 
 
 Chunk::Chunk(Renderer* pRenderer, ChunkManager* pChunkManager, VoxSettings* pVoxSettings)
@@ -36,7 +112,7 @@ Chunk::~Chunk()
 {
 	Unload();
 
-	delete m_colour;
+	delete m_pBlockStorage;
 }
 
 // Player pointer
@@ -65,6 +141,10 @@ void Chunk::Initialize()
 
 	// Flag for change during a batch update
 	m_chunkChangedDuringBatchUpdate = false;
+	m_dirtyMinX = CHUNK_SIZE_X;
+	m_dirtyMinY = CHUNK_SIZE_Y;
+	m_dirtyMinZ = CHUNK_SIZE_Z;
+	m_dirtyMaxX = m_dirtyMaxY = m_dirtyMaxZ = -1;
 
 	// Grid
 	m_gridX = 0;
@@ -81,168 +161,215 @@ void Chunk::Initialize()
 	m_z_minus_full = false;
 	m_z_plus_full = false;
 
-	// Setup and creation
-	m_created = false;
-	m_setup = false;
-	m_isUnloading = false;
+	// Lifecycle state, a new chunk has its setup job queued straight away
+	m_state = ChunkState_Queued;
 	m_rebuild = false;
-	m_rebuildNeighours = false;
-	m_isRebuildingMesh = false;
-	m_deleteCachedMesh = false;
+	m_rebuildNeighbours = 0;
+	m_loadedFromFile = false;
 
 	// Counters
 	m_numRebuilds = 0;
 
+	// Level of detail
+	m_lodLevel = 0;
+
+	// Mesh
+	m_numMeshVertices = 0;
+
 	// Mesh
-	m_pMesh = NULL;
-	m_pCachedMesh = NULL;
+	m_pMesh.store(NULL);
 
 	// Blocks data
-	m_colour = new unsigned int[CHUNK_SIZE_CUBED];
-	for (int i = 0; i < CHUNK_SIZE_CUBED; i++)
-	{
-		m_colour[i] = 0;
-	}
+	m_pBlockStorage = new BlockStorage(CHUNK_NUM_BLOCKS);
+
+	// Occlusion culling, until we have been meshed assume that we can be seen through
+	m_faceConnections = ALL_FACES_CONNECTED;
+	m_visibleFrame = 0;
 }
 
-// Creation and destruction
-void Chunk::SetCreated(bool created)
+// Lifecycle state
+ChunkState Chunk::GetState()
+{
+	return m_state.load();
+}
+
+bool Chunk::TransitionState(ChunkState fromState, ChunkState toState)
+{
+	return m_state.compare_exchange_strong(fromState, toState);
+}
+
+ChunkState Chunk::ExchangeState(ChunkState state)
+{
+	return m_state.exchange(state);
+}
+
+bool Chunk::IsSetupState(ChunkState state)
 {
-	m_created = created;
+	return state >= ChunkState_Generated && state <= ChunkState_Rebuilding;
 }
 
+// Creation and destruction
 bool Chunk::IsCreated()
 {
-	return m_created;
+	ChunkState state = m_state.load();
+	return state == ChunkState_Ready || state == ChunkState_Rebuilding;
 }
 
 void Chunk::Unload()
 {
-	m_isUnloading = true;
-
-	if (m_pMesh != NULL)
+	// Unloading happens off the render thread, so the chunk manager deletes the mesh later
+	OpenGLTriangleMesh* pMesh = m_pMesh.exchange(NULL);
+	if (pMesh != NULL)
 	{
-		m_pRenderer->ClearMesh(m_pMesh);
-		m_pMesh = NULL;
+		m_pChunkManager->ReleaseMesh(pMesh);
 	}
 
-	if (m_setup == true)
-	{
-		Chunk* pChunkXMinus = m_pChunkManager->GetChunk(m_gridX - 1, m_gridY, m_gridZ);
-		Chunk* pChunkXPlus = m_pChunkManager->GetChunk(m_gridX + 1, m_gridY, m_gridZ);
-		Chunk* pChunkYMinus = m_pChunkManager->GetChunk(m_gridX, m_gridY - 1, m_gridZ);
-		Chunk* pChunkYPlus = m_pChunkManager->GetChunk(m_gridX, m_gridY + 1, m_gridZ);
-		Chunk* pChunkZMinus = m_pChunkManager->GetChunk(m_gridX, m_gridY, m_gridZ - 1);
-		Chunk* pChunkZPlus = m_pChunkManager->GetChunk(m_gridX, m_gridY, m_gridZ + 1);
-
-		if (pChunkXMinus != NULL && pChunkXMinus->IsSetup() == true)
-			pChunkXMinus->UpdateSurroundedFlag();
-		if (pChunkXPlus != NULL && pChunkXPlus->IsSetup() == true)
-			pChunkXPlus->UpdateSurroundedFlag();
-		if (pChunkYMinus != NULL && pChunkYMinus->IsSetup() == true)
-			pChunkYMinus->UpdateSurroundedFlag();
-		if (pChunkYPlus != NULL && pChunkYPlus->IsSetup() == true)
-			pChunkYPlus->UpdateSurroundedFlag();
-		if (pChunkZMinus != NULL && pChunkZMinus->IsSetup() == true)
-			pChunkZMinus->UpdateSurroundedFlag();
-		if (pChunkZPlus != NULL && pChunkZPlus->IsSetup() == true)
-			pChunkZPlus->UpdateSurroundedFlag();
-	}
+	// We are already out of the chunk index, let our neighbours know that they aren't surrounded any more
+	Chunk* pChunkXMinus = m_pChunkManager->GetChunk(m_gridX - 1, m_gridY, m_gridZ);
+	Chunk* pChunkXPlus = m_pChunkManager->GetChunk(m_gridX + 1, m_gridY, m_gridZ);
+	Chunk* pChunkYMinus = m_pChunkManager->GetChunk(m_gridX, m_gridY - 1, m_gridZ);
+	Chunk* pChunkYPlus = m_pChunkManager->GetChunk(m_gridX, m_gridY + 1, m_gridZ);
+	Chunk* pChunkZMinus = m_pChunkManager->GetChunk(m_gridX, m_gridY, m_gridZ - 1);
+	Chunk* pChunkZPlus = m_pChunkManager->GetChunk(m_gridX, m_gridY, m_gridZ + 1);
+
+	if (pChunkXMinus != NULL && pChunkXMinus->IsSetup() == true)
+		pChunkXMinus->UpdateSurroundedFlag();
+	if (pChunkXPlus != NULL && pChunkXPlus->IsSetup() == true)
+		pChunkXPlus->UpdateSurroundedFlag();
+	if (pChunkYMinus != NULL && pChunkYMinus->IsSetup() == true)
+		pChunkYMinus->UpdateSurroundedFlag();
+	if (pChunkYPlus != NULL && pChunkYPlus->IsSetup() == true)
+		pChunkYPlus->UpdateSurroundedFlag();
+	if (pChunkZMinus != NULL && pChunkZMinus->IsSetup() == true)
+		pChunkZMinus->UpdateSurroundedFlag();
+	if (pChunkZPlus != NULL && pChunkZPlus->IsSetup() == true)
+		pChunkZPlus->UpdateSurroundedFlag();
 }
 
 void Chunk::Setup()
 {
-	ChunkStorageLoader* pChunkStorage = m_pChunkManager->GetChunkStorage(m_gridX, m_gridY, m_gridZ, false);
+	// Take ownership of any blocks that were stored for us while we were not loaded
+	ChunkStorageLoader* pChunkStorage = m_pChunkManager->TakeChunkStorage(m_gridX, m_gridY, m_gridZ);
+
+	// If we have been saved before, load our blocks instead of generating them
+	m_loadedFromFile = LoadChunk();
+	if (m_loadedFromFile)
+	{
+		// Blocks that were stored for us while we were unloaded go on top of the saved blocks
+		if (pChunkStorage != NULL)
+		{
+			for (unsigned int i = 0; i < pChunkStorage->m_vBlocks.size(); i++)
+			{
+				int index = pChunkStorage->m_vBlocks[i].m_index;
+				SetColour(index % CHUNK_SIZE_X, (index / CHUNK_SIZE_X) % CHUNK_SIZE_Y, index / CHUNK_SIZE_XY, pChunkStorage->m_vBlocks[i].m_colour);
+			}
+
+			delete pChunkStorage;
+		}
+
+		// Become setup, with anything that was stored for us while we were loading
+		m_pChunkManager->ApplyLateChunkStorage(this);
+
+		SetNeedsRebuild(true, true);
+
+		return;
+	}
+
+	// Generate into a flat buffer and add it to the block storage in one go, so the palette is only built once
+	unsigned int* pGeneratedColours = new unsigned int[CHUNK_NUM_BLOCKS];
+	memset(pGeneratedColours, 0, sizeof(unsigned int) * CHUNK_NUM_BLOCKS);
+
+	// The landscape and mountain noise is the same for every chunk in this column
+	shared_ptr<HeightmapTile> pHeightmapTile = m_pChunkManager->GetHeightmapTile(m_gridX, m_gridZ);
+
+	// The colour noise is only sampled if we have any solid blocks to colour
+	float colourNoiseLattice[NOISE_LATTICE_SIZE_X * NOISE_LATTICE_SIZE_Y * NOISE_LATTICE_SIZE_Z];
+	bool colourNoiseSampled = false;
+
+	// Trees are stamped once the terrain is generated, so the terrain doesn't overwrite them
+	vector<vec3> vTreePositions;
 
-	for (int x = 0; x < CHUNK_SIZE; x++)
+	for (int x = 0; x < CHUNK_SIZE_X; x++)
 	{
-		for (int z = 0; z < CHUNK_SIZE; z++)
+		for (int z = 0; z < CHUNK_SIZE_Z; z++)
 		{
 			float xPosition = m_position.x + x;
 			float zPosition = m_position.z + z;
 
-			float noise = octave_noise_2d(m_pVoxSettings->m_landscapeOctaves, m_pVoxSettings->m_landscapePersistence, m_pVoxSettings->m_landscapeScale, xPosition, zPosition);
+			float noise = pHeightmapTile->m_pLandscapeNoise[x + z * CHUNK_SIZE_X];
 			float noiseNormalized = ((noise + 1.0f) * 0.5f);
 
-			float mountainNoise = octave_noise_2d(m_pVoxSettings->m_mountainOctaves, m_pVoxSettings->m_mountainPersistence, m_pVoxSettings->m_mountainScale, xPosition, zPosition);
-			float mountainNoiseNormalise = (mountainNoise + 1.0f) * 0.5f;
-			float mountainMultiplier = m_pVoxSettings->m_mountainMultiplier * mountainNoiseNormalise;
-
-			float noiseHeight = noiseNormalized * CHUNK_SIZE;
-			noiseHeight *= mountainMultiplier;
+			float noiseHeight = pHeightmapTile->m_pHeight[x + z * CHUNK_SIZE_X];
 
 			if (m_gridY < 0)
 			{
-				noiseHeight = CHUNK_SIZE;
+				noiseHeight = CHUNK_SIZE_Y;
 			}
 
-			for (int y = 0; y < CHUNK_SIZE; y++)
+			for (int y = 0; y < CHUNK_SIZE_Y; y++)
 			{
-				float yPosition = m_position.y + y;
-
-				if (pChunkStorage != NULL && pChunkStorage->m_blockSet[x][y][z] == true)
-				{
-					SetColour(x, y, z, pChunkStorage->m_colour[x][y][z]);
-				}
-				else
+				if (y + (m_gridY*CHUNK_SIZE_Y) < noiseHeight)
 				{
-					if (y + (m_gridY*CHUNK_SIZE) < noiseHeight)
+					if (colourNoiseSampled == false)
 					{
-						float colorNoise = octave_noise_3d(4.0f, 0.3f, 0.005f, xPosition, yPosition, zPosition);
-						float colorNoiseNormalized = ((colorNoise + 1.0f) * 0.5f);
+						SampleNoiseLattice(m_position, colourNoiseLattice);
+						colourNoiseSampled = true;
+					}
 
-						float red1 = 0.65f;
-						float green1 = 0.80f;
-						float blue1 = 0.00f;
-						float red2 = 0.00f;
-						float green2 = 0.46f;
-						float blue2 = 0.16f;
+					float colorNoise = InterpolateNoiseLattice(colourNoiseLattice, x, y, z);
+					float colorNoiseNormalized = ((colorNoise + 1.0f) * 0.5f);
 
-						if (noise < -0.5f)
-						{
-							red1 = 0.10f;
-							green1 = 0.25f;
-							blue1 = 1.00f;
-							red2 = 0.10f;
-							green2 = 0.25f;
-							blue2 = 1.00f;
-						}
-						else if (noise < -0.25f)
-						{
-							red1 = 0.94f;
-							green1 = 0.74f;
-							blue1 = 0.34f;
-							red2 = 0.50f;
-							green2 = 0.29f;
-							blue2 = 0.20f;
-						}
-						else if (noise < 0.5f)
-						{
-							red1 = 0.65f;
-							green1 = 0.80f;
-							blue1 = 0.00f;
-							red2 = 0.00f;
-							green2 = 0.46f;
-							blue2 = 0.16f;
-						}
-						else if (noise < 1.0f)
-						{
-							red1 = 0.85f;
-							green1 = 0.85f;
-							blue1 = 0.85f;
-							red2 = 0.77f;
-							green2 = 0.65f;
-							blue2 = 0.80f;
-						}
+					float red1 = 0.65f;
+					float green1 = 0.80f;
+					float blue1 = 0.00f;
+					float red2 = 0.00f;
+					float green2 = 0.46f;
+					float blue2 = 0.16f;
+
+					if (noise < -0.5f)
+					{
+						red1 = 0.10f;
+						green1 = 0.25f;
+						blue1 = 1.00f;
+						red2 = 0.10f;
+						green2 = 0.25f;
+						blue2 = 1.00f;
+					}
+					else if (noise < -0.25f)
+					{
+						red1 = 0.94f;
+						green1 = 0.74f;
+						blue1 = 0.34f;
+						red2 = 0.50f;
+						green2 = 0.29f;
+						blue2 = 0.20f;
+					}
+					else if (noise < 0.5f)
+					{
+						red1 = 0.65f;
+						green1 = 0.80f;
+						blue1 = 0.00f;
+						red2 = 0.00f;
+						green2 = 0.46f;
+						blue2 = 0.16f;
+					}
+					else if (noise < 1.0f)
+					{
+						red1 = 0.85f;
+						green1 = 0.85f;
+						blue1 = 0.85f;
+						red2 = 0.77f;
+						green2 = 0.65f;
+						blue2 = 0.80f;
+					}
 
-						float alpha = 1.0f;
+					float alpha = 1.0f;
 
-						float r = red1 + ((red2 - red1) * colorNoiseNormalized);
-						float g = green1 + ((green2 - green1) * colorNoiseNormalized);
-						float b = blue1 + ((blue2 - blue1) * colorNoiseNormalized);
+					float r = red1 + ((red2 - red1) * colorNoiseNormalized);
+					float g = green1 + ((green2 - green1) * colorNoiseNormalized);
+					float b = blue1 + ((blue2 - blue1) * colorNoiseNormalized);
 
-						SetColour(x, y, z, r, g, b, alpha);
-					}
+					pGeneratedColours[x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY] = PackColour(r, g, b, alpha);
 				}
 			}
 
@@ -254,8 +381,7 @@ void Chunk::Setup()
 				{
 					if (noiseNormalized >= 0.5f)
 					{
-						vec3 treePos = vec3(xPosition, noiseHeight, zPosition);
-						m_pChunkManager->ImportQubicleBinary("media/gamedata/terrain/plains/smalltree.qb", treePos, QubicleImportDirection_Normal);
+						vTreePositions.push_back(vec3(xPosition, noiseHeight, zPosition));
 					}
 				}
 
@@ -272,36 +398,95 @@ void Chunk::Setup()
 		}
 	}
 
-	// Remove the chunk storage loader since we no longer need it
+	// Blocks that were stored for us go on top of the terrain
+	if (pChunkStorage != NULL)
+	{
+		pChunkStorage->ApplyBlocks(pGeneratedColours);
+	}
+
+	if (vTreePositions.size() > 0)
+	{
+		Prefab* pTreePrefab = m_pChunkManager->GetPrefab("media/gamedata/terrain/plains/smalltree.qb", QubicleImportDirection_Normal);
+		if (pTreePrefab != NULL)
+		{
+			for (unsigned int i = 0; i < vTreePositions.size(); i++)
+			{
+				m_pChunkManager->StampPrefab(pTreePrefab, vTreePositions[i], this, pGeneratedColours);
+			}
+		}
+	}
+
+	m_pBlockStorage->SetColours(pGeneratedColours);
+	delete[] pGeneratedColours;
+
+	// Delete the chunk storage loader since we no longer need it
 	if (pChunkStorage != NULL)
 	{
-		m_pChunkManager->RemoveChunkStorageLoader(pChunkStorage);
+		delete pChunkStorage;
 	}
 
-	m_setup = true;
+	// Become setup, with anything that was stored for us while we were generating
+	m_pChunkManager->ApplyLateChunkStorage(this);
 
 	SetNeedsRebuild(true, true);
 }
 
 bool Chunk::IsSetup()
 {
-	return m_setup;
+	return IsSetupState(m_state.load());
 }
 
 bool Chunk::IsUnloading()
 {
-	return m_isUnloading;
+	return m_state.load() == ChunkState_Unloading;
 }
 
 // Saving and loading
 void Chunk::SaveChunk()
 {
+	unsigned int* pColours = new unsigned int[CHUNK_NUM_BLOCKS];
+	m_pBlockStorage->GetColours(pColours);
+
+	// Keep a compressed copy in memory, in case we are loaded again soon
+	m_pChunkManager->CacheChunk(m_gridX, m_gridY, m_gridZ, pColours);
+
+	int localX, localY, localZ;
+	shared_ptr<RegionFile> pRegionFile = m_pChunkManager->GetRegionFile(m_gridX, m_gridY, m_gridZ, &localX, &localY, &localZ);
+	if (pRegionFile != NULL)
+	{
+		pRegionFile->WriteChunk(localX, localY, localZ, pColours);
+	}
 
+	delete[] pColours;
 }
 
-void Chunk::LoadChunk()
+bool Chunk::LoadChunk()
 {
+	unsigned int* pColours = new unsigned int[CHUNK_NUM_BLOCKS];
+
+	// Recently unloaded chunks are still in memory, otherwise try the region file
+	bool loaded = m_pChunkManager->RestoreCachedChunk(m_gridX, m_gridY, m_gridZ, pColours);
+	if (loaded == false)
+	{
+		int localX, localY, localZ;
+		shared_ptr<RegionFile> pRegionFile = m_pChunkManager->GetRegionFile(m_gridX, m_gridY, m_gridZ, &localX, &localY, &localZ);
+		if (pRegionFile != NULL)
+		{
+			loaded = pRegionFile->ReadChunk(localX, localY, localZ, pColours);
+		}
+	}
+	if (loaded)
+	{
+		m_pBlockStorage->SetColours(pColours);
+	}
+	delete[] pColours;
+
+	return loaded;
+}
 
+bool Chunk::IsLoadedFromFile()
+{
+	return m_loadedFromFile;
 }
 
 // Position
@@ -315,6 +500,12 @@ vec3 Chunk::GetPosition()
 	return m_position;
 }
 
+vec3 Chunk::GetCenter()
+{
+	// Blocks are centred on their position, so the chunk starts half a block before m_position
+	return m_position + vec3(CHUNK_SIZE_X*BLOCK_RENDER_SIZE, CHUNK_SIZE_Y*BLOCK_RENDER_SIZE, CHUNK_SIZE_Z*BLOCK_RENDER_SIZE) - vec3(BLOCK_RENDER_SIZE, BLOCK_RENDER_SIZE, BLOCK_RENDER_SIZE);
+}
+
 // Neighbours
 int Chunk::GetNumNeighbours()
 {
@@ -413,58 +604,72 @@ int Chunk::GetGridZ() const
 void Chunk::StartBatchUpdate()
 {
 	m_chunkChangedDuringBatchUpdate = false;
+	m_dirtyMinX = CHUNK_SIZE_X;
+	m_dirtyMinY = CHUNK_SIZE_Y;
+	m_dirtyMinZ = CHUNK_SIZE_Z;
+	m_dirtyMaxX = m_dirtyMaxY = m_dirtyMaxZ = -1;
 }
 
 void Chunk::StopBatchUpdate()
 {
 	if (m_chunkChangedDuringBatchUpdate)
 	{
-		SetNeedsRebuild(true, true);
+		// A neighbour's mesh only depends on our border blocks next to it. With baked ambient occlusion
+		// the edge and corner neighbours sample our border edges and corners too.
+		bool bakedAO = m_pChunkManager->GetBakedAO();
+		int dirtyMin[3] = { m_dirtyMinX, m_dirtyMinY, m_dirtyMinZ };
+		int dirtyMax[3] = { m_dirtyMaxX, m_dirtyMaxY, m_dirtyMaxZ };
+		int chunkSize[3] = { CHUNK_SIZE_X, CHUNK_SIZE_Y, CHUNK_SIZE_Z };
+		bool touches[3][3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			touches[axis][0] = (dirtyMin[axis] == 0);
+			touches[axis][1] = true;
+			touches[axis][2] = (dirtyMax[axis] == chunkSize[axis] - 1);
+		}
+
+		unsigned int neighbours = 0;
+		for (int z = -1; z <= 1; z++)
+		{
+			for (int y = -1; y <= 1; y++)
+			{
+				for (int x = -1; x <= 1; x++)
+				{
+					int numOffsetAxes = (x != 0) + (y != 0) + (z != 0);
+					if (numOffsetAxes == 0 || (numOffsetAxes > 1 && bakedAO == false))
+						continue;
+
+					if (touches[0][x + 1] && touches[1][y + 1] && touches[2][z + 1])
+					{
+						neighbours |= GetNeighbourBit(x, y, z);
+					}
+				}
+			}
+		}
+
+		AddRebuildNeighbours(neighbours);
+		SetNeedsRebuild(true, false);
 	}
 }
 
 // Active
 bool Chunk::GetActive(int x, int y, int z)
 {
-	unsigned colour = m_colour[x + y * CHUNK_SIZE + z * CHUNK_SIZE_SQUARED];
-	unsigned int alpha = (colour & 0xFF000000) >> 24;
-	unsigned int blue = (colour & 0x00FF0000) >> 16;
-	unsigned int green = (colour & 0x0000FF00) >> 8;
-	unsigned int red = (colour & 0x000000FF);
-
-	if (alpha == 0)
-	{
-		return false;
-	}
-
-	return true;
+	return m_pBlockStorage->GetActive(x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY);
 }
 
 // Block colour
 void Chunk::SetColour(int x, int y, int z, float r, float g, float b, float a)
 {
-	if (r > 1.0f) r = 1.0f;
-	if (g > 1.0f) g = 1.0f;
-	if (b > 1.0f) b = 1.0f;
-	if (r < 0.0f) r = 0.0f;
-	if (g < 0.0f) g = 0.0f;
-	if (b < 0.0f) b = 0.0f;
-
-	unsigned int alpha = (int)(a * 255) << 24;
-	unsigned int blue = (int)(b * 255) << 16;
-	unsigned int green = (int)(g * 255) << 8;
-	unsigned int red = (int)(r * 255);
-
-	unsigned int colour = red + green + blue + alpha;
-	SetColour(x, y, z, colour);
+	SetColour(x, y, z, PackColour(r, g, b, a));
 }
 
 void Chunk::GetColour(int x, int y, int z, float* r, float* g, float* b, float* a)
 {
-	if (x < 0 || x >= CHUNK_SIZE || y < 0 || y >= CHUNK_SIZE || z < 0 || z >= CHUNK_SIZE)
+	if (x < 0 || x >= CHUNK_SIZE_X || y < 0 || y >= CHUNK_SIZE_Y || z < 0 || z >= CHUNK_SIZE_Z)
 		return;
 
-	unsigned int colour = m_colour[x + y * CHUNK_SIZE + z * CHUNK_SIZE_SQUARED];
+	unsigned int colour = m_pBlockStorage->GetColour(x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY);
 	unsigned int alpha = (colour & 0xFF000000) >> 24;
 	unsigned int blue = (colour & 0x00FF0000) >> 16;
 	unsigned int green = (colour & 0x0000FF00) >> 8;
@@ -478,22 +683,49 @@ void Chunk::GetColour(int x, int y, int z, float* r, float* g, float* b, float*
 
 void Chunk::SetColour(int x, int y, int z, unsigned int colour)
 {
-	if (x < 0 || x >= CHUNK_SIZE || y < 0 || y >= CHUNK_SIZE || z < 0 || z >= CHUNK_SIZE)
+	if (x < 0 || x >= CHUNK_SIZE_X || y < 0 || y >= CHUNK_SIZE_Y || z < 0 || z >= CHUNK_SIZE_Z)
 		return;
 
-	bool changed = ((m_colour[x + y * CHUNK_SIZE + z * CHUNK_SIZE_SQUARED] == colour) == false);
+	bool changed = m_pBlockStorage->SetColour(x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY, colour);
 
 	if (changed)
 	{
 		m_chunkChangedDuringBatchUpdate = true;
-	}
 
-	m_colour[x + y * CHUNK_SIZE + z * CHUNK_SIZE_SQUARED] = colour;
+		if (x < m_dirtyMinX) m_dirtyMinX = x;
+		if (y < m_dirtyMinY) m_dirtyMinY = y;
+		if (z < m_dirtyMinZ) m_dirtyMinZ = z;
+		if (x > m_dirtyMaxX) m_dirtyMaxX = x;
+		if (y > m_dirtyMaxY) m_dirtyMaxY = y;
+		if (z > m_dirtyMaxZ) m_dirtyMaxZ = z;
+	}
 }
 
 unsigned int Chunk::GetColour(int x, int y, int z)
 {
-	return m_colour[x + y * CHUNK_SIZE + z * CHUNK_SIZE_SQUARED];
+	return m_pBlockStorage->GetColour(x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY);
+}
+
+unsigned int Chunk::PackColour(float r, float g, float b, float a)
+{
+	if (r > 1.0f) r = 1.0f;
+	if (g > 1.0f) g = 1.0f;
+	if (b > 1.0f) b = 1.0f;
+	if (r < 0.0f) r = 0.0f;
+	if (g < 0.0f) g = 0.0f;
+	if (b < 0.0f) b = 0.0f;
+
+	unsigned int alpha = (int)(a * 255) << 24;
+	unsigned int blue = (int)(b * 255) << 16;
+	unsigned int green = (int)(g * 255) << 8;
+	unsigned int red = (int)(r * 255);
+
+	return red + green + blue + alpha;
+}
+
+unsigned int Chunk::GetBlockMemoryUsage()
+{
+	return m_pBlockStorage->GetMemoryUsage();
 }
 
 // Flags
@@ -509,89 +741,16 @@ bool Chunk::IsSurrounded()
 
 void Chunk::UpdateWallFlags()
 {
-	// Figure out if we have any full walls(sides) and are a completely surrounded chunk
-	int x_minus = 0;
-	int x_plus = 0;
-	int y_minus = 0;
-	int y_plus = 0;
-	int z_minus = 0;
-	int z_plus = 0;
-
-	for (int y = 0; y < CHUNK_SIZE; y++)
-	{
-		for (int z = 0; z < CHUNK_SIZE; z++)
-		{
-			if (GetActive(0, y, z) == true)
-			{
-				x_minus++;
-			}
-
-			if (GetActive(CHUNK_SIZE - 1, y, z) == true)
-			{
-				x_plus++;
-			}
-		}
-	}
-
-	for (int x = 0; x < CHUNK_SIZE; x++)
-	{
-		for (int z = 0; z < CHUNK_SIZE; z++)
-		{
-			if (GetActive(x, 0, z) == true)
-			{
-				y_minus++;
-			}
-
-			if (GetActive(x, CHUNK_SIZE - 1, z) == true)
-			{
-				y_plus++;
-			}
-		}
-	}
-
-	for (int x = 0; x < CHUNK_SIZE; x++)
-	{
-		for (int y = 0; y < CHUNK_SIZE; y++)
-		{
-			if (GetActive(x, y, 0) == true)
-			{
-				z_minus++;
-			}
-
-			if (GetActive(x, y, CHUNK_SIZE - 1) == true)
-			{
-				z_plus++;
-			}
-		}
-	}
-
-	// Reset the wall flags first
-	m_x_minus_full = false;
-	m_x_plus_full = false;
-	m_y_minus_full = false;
-	m_y_plus_full = false;
-	m_z_minus_full = false;
-	m_z_plus_full = false;
-
-	// Set the flags to show if we have any sides completely full
-	int wallsize = CHUNK_SIZE*CHUNK_SIZE;
-	if (x_minus == wallsize)
-		m_x_minus_full = true;
-
-	if (x_plus == wallsize)
-		m_x_plus_full = true;
-
-	if (y_minus == wallsize)
-		m_y_minus_full = true;
-
-	if (y_plus == wallsize)
-		m_y_plus_full = true;
-
-	if (z_minus == wallsize)
-		m_z_minus_full = true;
-
-	if (z_plus == wallsize)
-		m_z_plus_full = true;
+	// Figure out if we have any full walls(sides), a whole plane of the occupancy is checked at a time
+	unsigned long long occupancy[OCCUPANCY_WORDS];
+	m_pBlockStorage->GetOccupancy(occupancy);
+
+	m_x_minus_full = IsWallFull(occupancy, ChunkFace_Left);
+	m_x_plus_full = IsWallFull(occupancy, ChunkFace_Right);
+	m_y_minus_full = IsWallFull(occupancy, ChunkFace_Bottom);
+	m_y_plus_full = IsWallFull(occupancy, ChunkFace_Top);
+	m_z_minus_full = IsWallFull(occupancy, ChunkFace_Back);
+	m_z_plus_full = IsWallFull(occupancy, ChunkFace_Front);
 }
 
 bool Chunk::UpdateSurroundedFlag()
@@ -628,729 +787,923 @@ bool Chunk::UpdateSurroundedFlag()
 
 void Chunk::UpdateEmptyFlag()
 {
-	// Figure out if we are a completely empty chunk
-	int numVerts;
-	int numTriangles;
-	m_pRenderer->GetMeshInformation(&numVerts, &numTriangles, m_pMesh);
-
-	if (numVerts == 0 && numTriangles == 0)
-	{
-		m_emptyChunk = true;
-	}
-	else
-	{
-		m_emptyChunk = false;
-	}
+	// Figure out if we are a completely empty chunk, empty meshes are never created
+	m_emptyChunk = (m_pMesh.load() == NULL);
 }
 
 // Create mesh
-void Chunk::CreateMesh()
+void Chunk::CreateMesh(ChunkMeshBuffer* pMeshBuffer)
 {
-	if (m_pMesh == NULL)
+	bool faceMerging = m_pChunkManager->GetFaceMerging();
+
+	// Take a copy of the block occupancy, an empty chunk has no faces and all of its faces can see each other
+	unsigned long long occupancy[OCCUPANCY_WORDS];
+	m_pBlockStorage->GetOccupancy(occupancy);
+
+	bool anyActive = false;
+	for (int i = 0; i < OCCUPANCY_WORDS && anyActive == false; i++)
 	{
-		m_pMesh = m_pRenderer->CreateMesh(OGLMeshType_Textured);
+		if (occupancy[i] != 0)
+		{
+			anyActive = true;
+		}
+	}
+
+	if (anyActive == false)
+	{
+		pMeshBuffer->m_faceConnections = ALL_FACES_CONNECTED;
+		return;
 	}
 
-	int *l_merged;
-	l_merged = new int[CHUNK_SIZE_CUBED];
+	pMeshBuffer->m_faceConnections = CalculateFaceConnections(occupancy);
+
+	Chunk* pNeighbours[ChunkFace_NUM];
+	GetMeshNeighbours(pNeighbours);
+
+	ChunkMeshQuadList quadList;
 
-	for (unsigned int j = 0; j < CHUNK_SIZE_CUBED; j++)
+	int lodLevel = m_lodLevel;
+	if (lodLevel > 0)
 	{
-		l_merged[j] = MergedSide_None;
+		CreateLODQuads(lodLevel, occupancy, pNeighbours, &quadList);
+		AddMeshQuads(&quadList, pMeshBuffer);
+		return;
 	}
 
-	float r = 1.0f;
-	float g = 1.0f;
-	float b = 1.0f;
-	float a = 1.0f;
+	// Build the occupancy masks for each axis, one bit per block
+	unsigned int occupancyY[CHUNK_SIZE_X][CHUNK_SIZE_Z]; // [x][z], bit per y
+	unsigned int occupancyZ[CHUNK_SIZE_X][CHUNK_SIZE_Y]; // [x][y], bit per z
+	memset(occupancyY, 0, sizeof(occupancyY));
+	memset(occupancyZ, 0, sizeof(occupancyZ));
 
-	for (int x = 0; x < CHUNK_SIZE; x++)
+	for (int z = 0; z < CHUNK_SIZE_Z; z++)
 	{
-		for (int y = 0; y < CHUNK_SIZE; y++)
+		for (int y = 0; y < CHUNK_SIZE_Y; y++)
 		{
-			for (int z = 0; z < CHUNK_SIZE; z++)
+			for (int x = 0; x < CHUNK_SIZE_X; x++)
 			{
-				if (GetActive(x, y, z) == false)
+				if (IsOccupied(occupancy, x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY))
 				{
-					continue;
+					occupancyY[x][z] |= (1u << y);
+					occupancyZ[x][y] |= (1u << z);
 				}
-				else
-				{
-					GetColour(x, y, z, &r, &g, &b, &a);
-
-					a = 1.0f;
-
-					vec3 p1(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					vec3 p2(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					vec3 p3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					vec3 p4(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					vec3 p5(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					vec3 p6(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					vec3 p7(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					vec3 p8(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-
-					vec3 n1;
-					unsigned int v1, v2, v3, v4;
-					unsigned int t1, t2, t3, t4;
-
-					bool doXPositive = (IsMergedXPositive(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE) == false);
-					bool doXNegative = (IsMergedXNegative(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE) == false);
-					bool doYPositive = (IsMergedYPositive(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE) == false);
-					bool doYNegative = (IsMergedYNegative(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE) == false);
-					bool doZPositive = (IsMergedZPositive(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE) == false);
-					bool doZNegative = (IsMergedZNegative(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE) == false);
-
-					// Front
-					if (doZPositive && ((z == CHUNK_SIZE - 1) || z < CHUNK_SIZE - 1 && GetActive(x, y, z + 1) == false))
-					{
-						bool addSide = true;
+			}
+		}
+	}
 
-						if ((z == CHUNK_SIZE - 1))
-						{
-							Chunk* pChunk = m_pChunkManager->GetChunk(m_gridX, m_gridY, m_gridZ + 1);
-							if (pChunk == NULL || pChunk->IsSetup())
-							{
-								addSide = pChunk != NULL && (pChunk->GetActive(x, y, 0) == false);
-							}
-						}
+	// The colours are only needed for the faces that are visible
+	unsigned int* pColours = new unsigned int[CHUNK_NUM_BLOCKS];
+	m_pBlockStorage->GetColours(pColours);
 
-						if (addSide)
-						{
-							int endX = (x / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
-							int endY = (y / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
+	// Ambient occlusion looks at the blocks around each face, including a one block border from the chunks around us
+	unsigned char* pPaddedOccupancy = NULL;
+	if (m_pChunkManager->GetBakedAO())
+	{
+		pPaddedOccupancy = new unsigned char[PADDED_CHUNK_SIZE_X * PADDED_CHUNK_SIZE_Y * PADDED_CHUNK_SIZE_Z];
+		GetPaddedOccupancy(occupancy, pPaddedOccupancy);
+	}
 
-							if (m_pChunkManager->GetFaceMerging())
-							{
-								UpdateMergedSide(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE, &p1, &p2, &p3, &p4, x, y, endX, endY, true, true, false, false);
-							}
+	// Work out which of our boundary faces are visible, based on the neighbour chunks
+	unsigned int boundaryVisible[ChunkFace_NUM][CHUNK_SIZE_MAX];
+	for (int face = 0; face < ChunkFace_NUM; face++)
+	{
+		Chunk* pChunk = pNeighbours[face];
+		int neighbourLayer = IsPositiveFace(face) ? 0 : s_faceSizes[face][0] - 1;
 
-							n1 = vec3(0.0f, 0.0f, 1.0f);
-							v1 = m_pRenderer->AddVertexToMesh(p1, n1, r, g, b, a, m_pMesh);
-							t1 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 0.0f, m_pMesh);
-							v2 = m_pRenderer->AddVertexToMesh(p2, n1, r, g, b, a, m_pMesh);
-							t2 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 0.0f, m_pMesh);
-							v3 = m_pRenderer->AddVertexToMesh(p3, n1, r, g, b, a, m_pMesh);
-							t3 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 1.0f, m_pMesh);
-							v4 = m_pRenderer->AddVertexToMesh(p4, n1, r, g, b, a, m_pMesh);
-							t4 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 1.0f, m_pMesh);
-
-							m_pRenderer->AddTriangleToMesh(v1, v2, v3, m_pMesh);
-							m_pRenderer->AddTriangleToMesh(v1, v3, v4, m_pMesh);
-						}
-					}
+		for (int u = 0; u < s_faceSizes[face][1]; u++)
+		{
+			boundaryVisible[face][u] = 0;
 
-					p1 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p2 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p3 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p4 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p5 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p6 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p7 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p8 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-
-					// Back
-					if (doZNegative && ((z == 0) || (z > 0 && GetActive(x, y, z - 1) == false)))
+			if (pChunk == NULL)
+			{
+				// No neighbour, don't add the side
+			}
+			else if (pChunk->IsSetup() == false)
+			{
+				boundaryVisible[face][u] = 0xFFFFFFFF;
+			}
+			else
+			{
+				for (int v = 0; v < s_faceSizes[face][2]; v++)
+				{
+					int x, y, z;
+					GetFaceBlock(face, neighbourLayer, u, v, &x, &y, &z);
+					if (pChunk->GetActive(x, y, z) == false)
 					{
-						bool addSide = true;
-
-						if ((z == 0))
-						{
-							Chunk* pChunk = m_pChunkManager->GetChunk(m_gridX, m_gridY, m_gridZ - 1);
-							if (pChunk == NULL || pChunk->IsSetup())
-							{
-								addSide = pChunk != NULL && (pChunk->GetActive(x, y, CHUNK_SIZE - 1) == false);
-							}
-						}
-
-						if (addSide)
-						{
-							int endX = (x / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
-							int endY = (y / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
-
-							if (m_pChunkManager->GetFaceMerging())
-							{
-								UpdateMergedSide(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE, &p6, &p5, &p8, &p7, x, y, endX, endY, false, true, false, false);
-							}
-
-							n1 = vec3(0.0f, 0.0f, -1.0f);
-							v1 = m_pRenderer->AddVertexToMesh(p5, n1, r, g, b, a, m_pMesh);
-							t1 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 0.0f, m_pMesh);
-							v2 = m_pRenderer->AddVertexToMesh(p6, n1, r, g, b, a, m_pMesh);
-							t2 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 0.0f, m_pMesh);
-							v3 = m_pRenderer->AddVertexToMesh(p7, n1, r, g, b, a, m_pMesh);
-							t3 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 1.0f, m_pMesh);
-							v4 = m_pRenderer->AddVertexToMesh(p8, n1, r, g, b, a, m_pMesh);
-							t4 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 1.0f, m_pMesh);
-
-							m_pRenderer->AddTriangleToMesh(v1, v2, v3, m_pMesh);
-							m_pRenderer->AddTriangleToMesh(v1, v3, v4, m_pMesh);
-						}
+						boundaryVisible[face][u] |= (1u << v);
 					}
+				}
+			}
+		}
+	}
 
-					p1 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p2 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p3 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p4 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p5 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p6 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p7 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p8 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-
-					// Right
-					if (doXPositive && ((x == CHUNK_SIZE - 1) || (x < CHUNK_SIZE - 1 && GetActive(x + 1, y, z) == false)))
-					{
-						bool addSide = true;
-
-						if ((x == CHUNK_SIZE - 1))
-						{
-							Chunk* pChunk = m_pChunkManager->GetChunk(m_gridX + 1, m_gridY, m_gridZ);
-							if (pChunk == NULL || pChunk->IsSetup())
-							{
-								addSide = pChunk != NULL && (pChunk->GetActive(0, y, z) == false);
-							}
-						}
-
-						if (addSide)
-						{
-							int endX = (z / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
-							int endY = (y / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
-
-							if (m_pChunkManager->GetFaceMerging())
-							{
-								UpdateMergedSide(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE, &p5, &p2, &p3, &p8, z, y, endX, endY, true, false, true, false);
-							}
-
-							n1 = vec3(1.0f, 0.0f, 0.0f);
-							v1 = m_pRenderer->AddVertexToMesh(p2, n1, r, g, b, a, m_pMesh);
-							t1 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 0.0f, m_pMesh);
-							v2 = m_pRenderer->AddVertexToMesh(p5, n1, r, g, b, a, m_pMesh);
-							t2 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 0.0f, m_pMesh);
-							v3 = m_pRenderer->AddVertexToMesh(p8, n1, r, g, b, a, m_pMesh);
-							t3 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 1.0f, m_pMesh);
-							v4 = m_pRenderer->AddVertexToMesh(p3, n1, r, g, b, a, m_pMesh);
-							t4 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 1.0f, m_pMesh);
-
-							m_pRenderer->AddTriangleToMesh(v1, v2, v3, m_pMesh);
-							m_pRenderer->AddTriangleToMesh(v1, v3, v4, m_pMesh);
-						}
-					}
+	// Find the visible faces for each layer and merge them
+	unsigned int visible[CHUNK_SIZE_MAX];
+	unsigned int mergePhase1[CHUNK_SIZE_MAX];
+	unsigned int mergePhase2[CHUNK_SIZE_MAX];
 
-					p1 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p2 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p3 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p4 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p5 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p6 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p7 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p8 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-
-					// Left
-					if (doXNegative && ((x == 0) || (x > 0 && GetActive(x - 1, y, z) == false)))
-					{
-						bool addSide = true;
+	for (int face = 0; face < ChunkFace_NUM; face++)
+	{
+		bool positive = IsPositiveFace(face);
+		int numLayers = s_faceSizes[face][0];
 
-						if ((x == 0))
-						{
-							Chunk* pChunk = m_pChunkManager->GetChunk(m_gridX - 1, m_gridY, m_gridZ);
-							if (pChunk == NULL || pChunk->IsSetup())
-							{
-								addSide = pChunk != NULL && (pChunk->GetActive(CHUNK_SIZE - 1, y, z) == false);
-							}
-						}
+		for (int layer = 0; layer < numLayers; layer++)
+		{
+			bool boundary = positive ? (layer == numLayers - 1) : (layer == 0);
+			int neighbourLayer = positive ? layer + 1 : layer - 1;
 
-						if (addSide)
-						{
-							int endX = (z / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
-							int endY = (y / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
+			unsigned int anyVisible = 0;
+			for (int u = 0; u < s_faceSizes[face][1]; u++)
+			{
+				unsigned int active;
+				unsigned int neighbourActive = 0;
+				if (face == ChunkFace_Front || face == ChunkFace_Back)
+				{
+					active = occupancyY[u][layer];
+					if (boundary == false)
+						neighbourActive = occupancyY[u][neighbourLayer];
+				}
+				else if (face == ChunkFace_Right || face == ChunkFace_Left)
+				{
+					active = occupancyZ[layer][u];
+					if (boundary == false)
+						neighbourActive = occupancyZ[neighbourLayer][u];
+				}
+				else
+				{
+					active = occupancyZ[u][layer];
+					if (boundary == false)
+						neighbourActive = occupancyZ[u][neighbourLayer];
+				}
 
-							if (m_pChunkManager->GetFaceMerging())
-							{
-								UpdateMergedSide(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE, &p6, &p1, &p4, &p7, z, y, endX, endY, false, false, true, false);
-							}
+				if (boundary)
+				{
+					// The boundary layer doesn't merge along its width, and only checks our own blocks when merging rows
+					visible[u] = active & boundaryVisible[face][u];
+					mergePhase1[u] = 0;
+					mergePhase2[u] = active;
+				}
+				else
+				{
+					visible[u] = active & ~neighbourActive;
+					mergePhase1[u] = visible[u];
+					mergePhase2[u] = visible[u];
+				}
 
-							n1 = vec3(-1.0f, 0.0f, 0.0f);
-							v1 = m_pRenderer->AddVertexToMesh(p6, n1, r, g, b, a, m_pMesh);
-							t1 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 0.0f, m_pMesh);
-							v2 = m_pRenderer->AddVertexToMesh(p1, n1, r, g, b, a, m_pMesh);
-							t2 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 0.0f, m_pMesh);
-							v3 = m_pRenderer->AddVertexToMesh(p4, n1, r, g, b, a, m_pMesh);
-							t3 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 1.0f, m_pMesh);
-							v4 = m_pRenderer->AddVertexToMesh(p7, n1, r, g, b, a, m_pMesh);
-							t4 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 1.0f, m_pMesh);
-
-							m_pRenderer->AddTriangleToMesh(v1, v2, v3, m_pMesh);
-							m_pRenderer->AddTriangleToMesh(v1, v3, v4, m_pMesh);
-						}
-					}
+				anyVisible |= visible[u];
+			}
 
-					p1 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p2 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p3 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p4 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p5 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p6 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p7 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p8 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-
-					// Top
-					if (doYPositive && ((y == CHUNK_SIZE - 1) || (y < CHUNK_SIZE - 1 && GetActive(x, y + 1, z) == false)))
-					{
-						bool addSide = true;
+			if (anyVisible == 0)
+			{
+				continue;
+			}
 
-						if ((y == CHUNK_SIZE - 1))
-						{
-							Chunk* pChunk = m_pChunkManager->GetChunk(m_gridX, m_gridY + 1, m_gridZ);
-							if (pChunk == NULL || pChunk->IsSetup())
-							{
-								addSide = pChunk != NULL && (pChunk->GetActive(x, 0, z) == false);
-							}
-						}
+			MergeLayerFaces(face, layer, visible, mergePhase1, mergePhase2, pColours, pPaddedOccupancy, faceMerging, &quadList);
+		}
+	}
 
-						if (addSide)
-						{
-							int endX = (x / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
-							int endY = (z / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
+	delete[] pColours;
+	delete[] pPaddedOccupancy;
 
-							if (m_pChunkManager->GetFaceMerging())
-							{
-								UpdateMergedSide(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE, &p7, &p8, &p3, &p4, x, z, endX, endY, true, false, false, true);
-							}
+	AddMeshQuads(&quadList, pMeshBuffer);
+}
 
-							n1 = vec3(0.0f, 1.0f, 0.0f);
-							v1 = m_pRenderer->AddVertexToMesh(p4, n1, r, g, b, a, m_pMesh);
-							t1 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 0.0f, m_pMesh);
-							v2 = m_pRenderer->AddVertexToMesh(p3, n1, r, g, b, a, m_pMesh);
-							t2 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 0.0f, m_pMesh);
-							v3 = m_pRenderer->AddVertexToMesh(p8, n1, r, g, b, a, m_pMesh);
-							t3 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 1.0f, m_pMesh);
-							v4 = m_pRenderer->AddVertexToMesh(p7, n1, r, g, b, a, m_pMesh);
-							t4 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 1.0f, m_pMesh);
-
-							m_pRenderer->AddTriangleToMesh(v1, v2, v3, m_pMesh);
-							m_pRenderer->AddTriangleToMesh(v1, v3, v4, m_pMesh);
-						}
-					}
+void Chunk::GetMeshNeighbours(Chunk** pNeighbours)
+{
+	pNeighbours[ChunkFace_Front] = m_pChunkManager->GetChunk(m_gridX, m_gridY, m_gridZ + 1);
+	pNeighbours[ChunkFace_Back] = m_pChunkManager->GetChunk(m_gridX, m_gridY, m_gridZ - 1);
+	pNeighbours[ChunkFace_Right] = m_pChunkManager->GetChunk(m_gridX + 1, m_gridY, m_gridZ);
+	pNeighbours[ChunkFace_Left] = m_pChunkManager->GetChunk(m_gridX - 1, m_gridY, m_gridZ);
+	pNeighbours[ChunkFace_Top] = m_pChunkManager->GetChunk(m_gridX, m_gridY + 1, m_gridZ);
+	pNeighbours[ChunkFace_Bottom] = m_pChunkManager->GetChunk(m_gridX, m_gridY - 1, m_gridZ);
+}
 
-					p1 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p2 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p3 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p4 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z + BLOCK_RENDER_SIZE);
-					p5 = vec3(x + BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p6 = vec3(x - BLOCK_RENDER_SIZE, y - BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p7 = vec3(x - BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-					p8 = vec3(x + BLOCK_RENDER_SIZE, y + BLOCK_RENDER_SIZE, z - BLOCK_RENDER_SIZE);
-
-					// Bottom
-					if (doYNegative && ((y == 0) || (y > 0 && GetActive(x, y - 1, z) == false)))
-					{
-						bool addSide = true;
+void Chunk::GetPaddedOccupancy(const unsigned long long* pOccupancy, unsigned char* pPaddedOccupancy)
+{
+	memset(pPaddedOccupancy, 0, PADDED_CHUNK_SIZE_X * PADDED_CHUNK_SIZE_Y * PADDED_CHUNK_SIZE_Z);
 
-						if ((y == 0))
-						{
-							Chunk* pChunk = m_pChunkManager->GetChunk(m_gridX, m_gridY - 1, m_gridZ);
-							if (pChunk == NULL || pChunk->IsSetup())
-							{
-								addSide = pChunk != NULL && (pChunk->GetActive(x, CHUNK_SIZE - 1, z) == false);
-							}
-						}
+	// Our own blocks
+	for (int z = 0; z < CHUNK_SIZE_Z; z++)
+	{
+		for (int y = 0; y < CHUNK_SIZE_Y; y++)
+		{
+			for (int x = 0; x < CHUNK_SIZE_X; x++)
+			{
+				if (IsOccupied(pOccupancy, x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY))
+				{
+					pPaddedOccupancy[GetPaddedIndex(x, y, z)] = 1;
+				}
+			}
+		}
+	}
 
-						if (addSide)
-						{
-							int endX = (x / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
-							int endY = (z / CHUNK_SIZE) * CHUNK_SIZE + CHUNK_SIZE;
+	// The border comes from all 26 chunks around us, the ones that aren't set up yet don't occlude anything
+	Chunk* pChunks[3][3][3];
+	for (int dz = -1; dz <= 1; dz++)
+	{
+		for (int dy = -1; dy <= 1; dy++)
+		{
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				Chunk* pChunk = m_pChunkManager->GetChunk(m_gridX + dx, m_gridY + dy, m_gridZ + dz);
+				pChunks[dx + 1][dy + 1][dz + 1] = (pChunk != NULL && pChunk->IsSetup()) ? pChunk : NULL;
+			}
+		}
+	}
 
-							if (m_pChunkManager->GetFaceMerging())
-							{
-								UpdateMergedSide(l_merged, x, y, z, CHUNK_SIZE, CHUNK_SIZE, &p6, &p5, &p2, &p1, x, z, endX, endY, false, false, false, true);
-							}
+	for (int z = -1; z <= CHUNK_SIZE_Z; z++)
+	{
+		int dz = (z < 0) ? -1 : ((z >= CHUNK_SIZE_Z) ? 1 : 0);
+		for (int y = -1; y <= CHUNK_SIZE_Y; y++)
+		{
+			int dy = (y < 0) ? -1 : ((y >= CHUNK_SIZE_Y) ? 1 : 0);
+			for (int x = -1; x <= CHUNK_SIZE_X; x++)
+			{
+				int dx = (x < 0) ? -1 : ((x >= CHUNK_SIZE_X) ? 1 : 0);
+				if (dx == 0 && dy == 0 && dz == 0)
+				{
+					// Skip over our own blocks
+					x = CHUNK_SIZE_X - 1;
+					continue;
+				}
 
-							n1 = vec3(0.0f, -1.0f, 0.0f);
-							v1 = m_pRenderer->AddVertexToMesh(p6, n1, r, g, b, a, m_pMesh);
-							t1 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 0.0f, m_pMesh);
-							v2 = m_pRenderer->AddVertexToMesh(p5, n1, r, g, b, a, m_pMesh);
-							t2 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 0.0f, m_pMesh);
-							v3 = m_pRenderer->AddVertexToMesh(p2, n1, r, g, b, a, m_pMesh);
-							t3 = m_pRenderer->AddTextureCoordinatesToMesh(1.0f, 1.0f, m_pMesh);
-							v4 = m_pRenderer->AddVertexToMesh(p1, n1, r, g, b, a, m_pMesh);
-							t4 = m_pRenderer->AddTextureCoordinatesToMesh(0.0f, 1.0f, m_pMesh);
-
-							m_pRenderer->AddTriangleToMesh(v1, v2, v3, m_pMesh);
-							m_pRenderer->AddTriangleToMesh(v1, v3, v4, m_pMesh);
-						}
-					}
+				Chunk* pChunk = pChunks[dx + 1][dy + 1][dz + 1];
+				if (pChunk != NULL && pChunk->GetActive(x - dx * CHUNK_SIZE_X, y - dy * CHUNK_SIZE_Y, z - dz * CHUNK_SIZE_Z))
+				{
+					pPaddedOccupancy[GetPaddedIndex(x, y, z)] = 1;
 				}
 			}
 		}
 	}
-
-	// Delete the merged array
-	delete l_merged;
 }
 
-void Chunk::CompleteMesh()
+// Classic 3 neighbour vertex ambient occlusion, 0 is fully occluded and 3 is open. Checks the two blocks
+// along the edges and the block on the corner, in the layer of air in front of the face.
+unsigned char Chunk::GetFaceAO(int face, int layer, int u, int v, const unsigned char* pPaddedOccupancy)
 {
-	m_pRenderer->FinishMesh(-1, m_pChunkManager->GetChunkMaterialID(), m_pMesh);
+	int x, y, z;
+	GetFaceBlock(face, layer, u, v, &x, &y, &z);
+	x += s_faceNormals[face][0];
+	y += s_faceNormals[face][1];
+	z += s_faceNormals[face][2];
+
+	unsigned char ao = 0;
+	for (int corner = 0; corner < 4; corner++)
+	{
+		int signU = (corner == 1 || corner == 2) ? 1 : -1;
+		int signV = (corner == 2 || corner == 3) ? 1 : -1;
+		int du[3] = { s_faceAxisU[face][0] * signU, s_faceAxisU[face][1] * signU, s_faceAxisU[face][2] * signU };
+		int dv[3] = { s_faceAxisV[face][0] * signV, s_faceAxisV[face][1] * signV, s_faceAxisV[face][2] * signV };
 
-	UpdateEmptyFlag();
+		int side1 = pPaddedOccupancy[GetPaddedIndex(x + du[0], y + du[1], z + du[2])];
+		int side2 = pPaddedOccupancy[GetPaddedIndex(x + dv[0], y + dv[1], z + dv[2])];
+		int cornerBlock = pPaddedOccupancy[GetPaddedIndex(x + du[0] + dv[0], y + du[1] + dv[1], z + du[2] + dv[2])];
 
-	m_isRebuildingMesh = false;
+		int cornerAO = (side1 && side2) ? 0 : 3 - (side1 + side2 + cornerBlock);
+		ao |= (unsigned char)(cornerAO << (corner * 2));
+	}
+
+	return ao;
 }
 
-void Chunk::UpdateMergedSide(int *merged, int blockx, int blocky, int blockz, int width, int height, vec3 *p1, vec3 *p2, vec3 *p3, vec3 *p4, int startX, int startY, int maxX, int maxY, bool positive, bool zFace, bool xFace, bool yFace)
+void Chunk::AddMeshQuads(ChunkMeshQuadList* pQuadList, ChunkMeshBuffer* pMeshBuffer)
 {
-	bool doMore = true;
-	unsigned int incrementX = 0;
-	unsigned int incrementZ = 0;
-	unsigned int incrementY = 0;
+	ChunkMeshQuadList& quadList = *pQuadList;
 
-	int change = 1;
-	if (positive == false)
+	// Add the quads in block order, the same order as a block by block traversal (radix sort on the sort key)
+	ChunkMeshQuadList sortedQuadList(quadList.size());
+	for (int shift = 0; ((CHUNK_NUM_BLOCKS * ChunkFace_NUM) >> shift) > 0; shift += 8)
 	{
-		//change = -1;
+		unsigned int counts[257];
+		memset(counts, 0, sizeof(counts));
+		for (unsigned int i = 0; i < quadList.size(); i++)
+		{
+			counts[((quadList[i].m_sortKey >> shift) & 0xFF) + 1]++;
+		}
+		for (int i = 1; i < 257; i++)
+		{
+			counts[i] += counts[i - 1];
+		}
+		for (unsigned int i = 0; i < quadList.size(); i++)
+		{
+			sortedQuadList[counts[(quadList[i].m_sortKey >> shift) & 0xFF]++] = quadList[i];
+		}
+		quadList.swap(sortedQuadList);
 	}
 
-	if (zFace || yFace)
+	// Add the quads as packed vertices, 4 per quad. Positions are whole block corners, so the mesh is
+	// offset by half a block when rendering, and the triangles come from the renderer's shared quad indices.
+	pMeshBuffer->m_vVertices.reserve(quadList.size() * 4);
+	for (unsigned int i = 0; i < quadList.size(); i++)
 	{
-		incrementX = 1;
-		incrementY = 1;
+		ChunkMeshQuad* pQuad = &quadList[i];
+
+		unsigned char r = (unsigned char)(pQuad->m_colour & 0x000000FF);
+		unsigned char g = (unsigned char)((pQuad->m_colour & 0x0000FF00) >> 8);
+		unsigned char b = (unsigned char)((pQuad->m_colour & 0x00FF0000) >> 16);
+
+		int x = pQuad->m_x;
+		int y = pQuad->m_y;
+		int z = pQuad->m_z;
+		int width = pQuad->m_width - 1;
+		int height = pQuad->m_height - 1;
+
+		int p1[3] = { x, y, z + 1 };
+		int p2[3] = { x + 1, y, z + 1 };
+		int p3[3] = { x + 1, y + 1, z + 1 };
+		int p4[3] = { x, y + 1, z + 1 };
+		int p5[3] = { x + 1, y, z };
+		int p6[3] = { x, y, z };
+		int p7[3] = { x, y + 1, z };
+		int p8[3] = { x + 1, y + 1, z };
+
+		signed char n1[3] = { 0, 0, 0 };
+		int* corners[4];
+
+		switch (pQuad->m_face)
+		{
+		case ChunkFace_Front:
+		{
+			p2[0] += width; p3[0] += width; p3[1] += height; p4[1] += height;
+			n1[2] = 127;
+			corners[0] = p1; corners[1] = p2; corners[2] = p3; corners[3] = p4;
+		}
+		break;
+		case ChunkFace_Back:
+		{
+			p5[0] += width; p8[0] += width; p8[1] += height; p7[1] += height;
+			n1[2] = -127;
+			corners[0] = p5; corners[1] = p6; corners[2] = p7; corners[3] = p8;
+		}
+		break;
+		case ChunkFace_Right:
+		{
+			p2[2] += width; p3[2] += width; p3[1] += height; p8[1] += height;
+			n1[0] = 127;
+			corners[0] = p2; corners[1] = p5; corners[2] = p8; corners[3] = p3;
+		}
+		break;
+		case ChunkFace_Left:
+		{
+			p1[2] += width; p4[2] += width; p4[1] += height; p7[1] += height;
+			n1[0] = -127;
+			corners[0] = p6; corners[1] = p1; corners[2] = p4; corners[3] = p7;
+		}
+		break;
+		case ChunkFace_Top:
+		{
+			p8[0] += width; p3[0] += width; p3[2] += height; p4[2] += height;
+			n1[1] = 127;
+			corners[0] = p4; corners[1] = p3; corners[2] = p8; corners[3] = p7;
+		}
+		break;
+		case ChunkFace_Bottom:
+		{
+			p5[0] += width; p2[0] += width; p2[2] += height; p1[2] += height;
+			n1[1] = -127;
+			corners[0] = p6; corners[1] = p5; corners[2] = p2; corners[3] = p1;
+		}
+		break;
+		}
+
+		int ao[4];
+		for (int j = 0; j < 4; j++)
+		{
+			ao[j] = (pQuad->m_ao >> (s_faceVertexCorners[pQuad->m_face][j] * 2)) & 3;
+		}
+
+		// The quad indices split along the first vertex's diagonal, start from the next vertex instead when
+		// that diagonal is the lighter one, so the occlusion is interpolated the same way in every direction
+		int firstVertex = (ao[0] + ao[2] > ao[1] + ao[3]) ? 1 : 0;
+
+		for (int j = 0; j < 4; j++)
+		{
+			int corner = (j + firstVertex) & 3;
+			unsigned int brightness = s_aoBrightness[ao[corner]];
+
+			OpenGLMesh_PackedVertex vertex;
+			vertex.vertexPosition[0] = (short)corners[corner][0];
+			vertex.vertexPosition[1] = (short)corners[corner][1];
+			vertex.vertexPosition[2] = (short)corners[corner][2];
+			vertex.vertexNormals[0] = n1[0];
+			vertex.vertexNormals[1] = n1[1];
+			vertex.vertexNormals[2] = n1[2];
+			vertex.vertexColour[0] = (unsigned char)((r * brightness) / 255);
+			vertex.vertexColour[1] = (unsigned char)((g * brightness) / 255);
+			vertex.vertexColour[2] = (unsigned char)((b * brightness) / 255);
+			pMeshBuffer->m_vVertices.push_back(vertex);
+		}
 	}
-	if (xFace)
+}
+
+void Chunk::MergeLayerFaces(int face, int layer, unsigned int* pVisible, unsigned int* pMergePhase1, unsigned int* pMergePhase2, unsigned int* pColours, const unsigned char* pPaddedOccupancy, bool faceMerging, ChunkMeshQuadList* pQuadList)
+{
+	// Faces are merged in the order the blocks are visited, first along the width and then
+	// extended in rows. X faces merge along the inner axis (v) first, Y and Z faces along the outer axis (u).
+	bool widthAlongV = (face == ChunkFace_Right || face == ChunkFace_Left);
+
+	// Strides into the colour array for the u and v axis of this face
+	int layerX, layerY, layerZ;
+	int strideU = 0;
+	int strideV = 0;
+	GetFaceBlock(face, layer, 0, 0, &layerX, &layerY, &layerZ);
+	unsigned int* pLayerColours = &pColours[layerX + layerY * CHUNK_SIZE_X + layerZ * CHUNK_SIZE_XY];
+	if (face == ChunkFace_Front || face == ChunkFace_Back)
 	{
-		incrementZ = 1;
-		incrementY = 1;
+		strideU = 1;
+		strideV = CHUNK_SIZE_X;
 	}
+	else if (face == ChunkFace_Right || face == ChunkFace_Left)
+	{
+		strideU = CHUNK_SIZE_X;
+		strideV = CHUNK_SIZE_XY;
+	}
+	else
+	{
+		strideU = 1;
+		strideV = CHUNK_SIZE_XY;
+	}
+
+	int numU = s_faceSizes[face][1];
+	int numV = s_faceSizes[face][2];
 
-	// 1st phase
-	int incrementer = 1;
-	while (doMore)
+	// Ambient occlusion of every face that can be merged
+	unsigned char faceAO[CHUNK_SIZE_MAX][CHUNK_SIZE_MAX];
+	memset(faceAO, AO_UNOCCLUDED, sizeof(faceAO));
+	if (pPaddedOccupancy != NULL)
 	{
-		if (startX + incrementer >= maxX)
+		for (int u = 0; u < numU; u++)
 		{
-			doMore = false;
-		}
-		else
-		{
-			bool doPhase1Merge = true;
-			float r1, r2, g1, g2, b1, b2, a1, a2;
-			GetColour(blockx, blocky, blockz, &r1, &g1, &b1, &a1);
-			GetColour(blockx + incrementX, blocky, blockz + incrementZ, &r2, &g2, &b2, &a2);
-			//if(m_pBlocks[blockx][blocky][blockz].GetBlockType() != m_pBlocks[blockx + incrementX][blocky][blockz + incrementZ].GetBlockType())
-			//{
-			// Don't do any phase 1 merging if we don't have the same block type.
-			//	doPhase1Merge = false;
-			//	doMore = false;
-			//}
-			/*//else*/ if ((r1 != r2 || g1 != g2 || b1 != b2 || a1 != a2) /*&& allMerge == false*/)
+			unsigned int faces = pVisible[u] | pMergePhase2[u];
+			while (faces != 0)
 			{
-				// Don't do any phase 1 merging if we don't have the same colour variation
-				doPhase1Merge = false;
-				doMore = false;
+				int v = CountTrailingZeros(faces);
+				faceAO[u][v] = GetFaceAO(face, layer, u, v, pPaddedOccupancy);
+				faces &= faces - 1;
 			}
-			else
-			{
-				if ((xFace && positive && blockx + incrementX + 1 == CHUNK_SIZE) ||
-					(xFace && !positive && blockx + incrementX == 0) ||
-					(yFace && positive && blocky + 1 == CHUNK_SIZE) ||
-					(yFace && !positive && blocky == 0) ||
-					(zFace && positive && blockz + incrementZ + 1 == CHUNK_SIZE) ||
-					(zFace && !positive && blockz + incrementZ == 0))
-				{
-					doPhase1Merge = false;
-					doMore = false;
-				}
-				// Don't do any phase 1 merging if we find an inactive block or already merged block in our path
-				else if (xFace && positive && (blockx + incrementX + 1) < CHUNK_SIZE && GetActive(blockx + incrementX + 1, blocky, blockz + incrementZ) == true)
-				{
-					doPhase1Merge = false;
-					doMore = false;
-				}
-				else if (xFace && !positive && (blockx + incrementX) > 0 && GetActive(blockx + incrementX - 1, blocky, blockz + incrementZ) == true)
-				{
-					doPhase1Merge = false;
-					doMore = false;
-				}
-				else if (yFace && positive && (blocky + 1) < CHUNK_SIZE && GetActive(blockx + incrementX, blocky + 1, blockz + incrementZ) == true)
-				{
-					doPhase1Merge = false;
-					doMore = false;
-				}
-				else if (yFace && !positive && blocky > 0 && GetActive(blockx + incrementX, blocky - 1, blockz + incrementZ) == true)
-				{
-					doPhase1Merge = false;
-					doMore = false;
-				}
-				else if (zFace && positive && (blockz + incrementZ + 1) < CHUNK_SIZE && GetActive(blockx + incrementX, blocky, blockz + incrementZ + 1) == true)
-				{
-					doPhase1Merge = false;
-					doMore = false;
-				}
-				else if (zFace && !positive && (blockz + incrementZ) > 0 && GetActive(blockx + incrementX, blocky, blockz + incrementZ - 1) == true)
-				{
-					doPhase1Merge = false;
-					doMore = false;
-				}
-				else if (GetActive(blockx + incrementX, blocky, blockz + incrementZ) == false)
-				{
-					doPhase1Merge = false;
-					doMore = false;
-				}
-				else
-				{
-					if (xFace)
-					{
-						doPhase1Merge = positive ? (IsMergedXPositive(merged, blockx + incrementX, blocky, blockz + incrementZ, width, height) == false) : (IsMergedXNegative(merged, blockx + incrementX, blocky, blockz + incrementZ, width, height) == false);
-					}
-					if (zFace)
-					{
-						doPhase1Merge = positive ? (IsMergedZPositive(merged, blockx + incrementX, blocky, blockz + incrementZ, width, height) == false) : (IsMergedZNegative(merged, blockx + incrementX, blocky, blockz + incrementZ, width, height) == false);
-					}
-					if (yFace)
-					{
-						doPhase1Merge = positive ? (IsMergedYPositive(merged, blockx + incrementX, blocky, blockz + incrementZ, width, height) == false) : (IsMergedYNegative(merged, blockx + incrementX, blocky, blockz + incrementZ, width, height) == false);
-					}
-				}
+		}
+	}
+
+	unsigned int merged[CHUNK_SIZE_MAX];
+	memset(merged, 0, sizeof(merged));
+
+	for (int u = 0; u < numU; u++)
+	{
+		unsigned int remaining = pVisible[u] & ~merged[u];
+		while (remaining != 0)
+		{
+			int v = CountTrailingZeros(remaining);
+			unsigned int colour = pLayerColours[u * strideU + v * strideV];
+			unsigned int rgb = colour & 0x00FFFFFF;
+
+			// Faces only merge with faces that have the same occlusion, and only along an axis that the occlusion
+			// doesn't change along, so the merged quad is lit exactly the same as the faces it replaces
+			unsigned char ao = faceAO[u][v];
+			bool aoSameAlongU = ((ao & 0x03) == ((ao >> 2) & 0x03)) && (((ao >> 6) & 0x03) == ((ao >> 4) & 0x03));
+			bool aoSameAlongV = ((ao & 0x03) == ((ao >> 6) & 0x03)) && (((ao >> 2) & 0x03) == ((ao >> 4) & 0x03));
+
+			int width = 1;
+			int height = 1;
 
-				if (doPhase1Merge)
+			if (faceMerging)
+			{
+				if (widthAlongV)
 				{
-					if (zFace || yFace)
-					{
-						(*p2).x += change * (BLOCK_RENDER_SIZE * 2.0f);
-						(*p3).x += change * (BLOCK_RENDER_SIZE * 2.0f);
-					}
-					if (xFace)
+					while (aoSameAlongV && v + width < numV && (pMergePhase1[u] & ~merged[u] & (1u << (v + width))) != 0 && (pLayerColours[u * strideU + (v + width) * strideV] & 0x00FFFFFF) == rgb && faceAO[u][v + width] == ao)
 					{
-						(*p2).z += change * (BLOCK_RENDER_SIZE * 2.0f);
-						(*p3).z += change * (BLOCK_RENDER_SIZE * 2.0f);
+						merged[u] |= (1u << (v + width));
+						width++;
 					}
 
-					if (positive)
+					unsigned int span = (width == 32) ? 0xFFFFFFFF : (((1u << width) - 1) << v);
+					while (aoSameAlongU && u + height < numU && (pMergePhase2[u + height] & ~merged[u + height] & span) == span)
 					{
-						if (zFace)
+						bool sameColour = true;
+						for (int i = 0; i < width && sameColour; i++)
 						{
-							merged[(blockx + incrementX) + blocky*width + (blockz + incrementZ)*width*height] |= MergedSide_Z_Positive;
+							sameColour = ((pLayerColours[(u + height) * strideU + (v + i) * strideV] & 0x00FFFFFF) == rgb) && faceAO[u + height][v + i] == ao;
 						}
-						if (xFace)
+						if (sameColour == false)
 						{
-							merged[(blockx + incrementX) + blocky*width + (blockz + incrementZ)*width*height] |= MergedSide_X_Positive;
-						}
-						if (yFace)
-						{
-							merged[(blockx + incrementX) + blocky*width + (blockz + incrementZ)*width*height] |= MergedSide_Y_Positive;
+							break;
 						}
+
+						merged[u + height] |= span;
+						height++;
 					}
-					else
+				}
+				else
+				{
+					unsigned int bit = (1u << v);
+					while (aoSameAlongU && u + width < numU && (pMergePhase1[u + width] & ~merged[u + width] & bit) != 0 && (pLayerColours[(u + width) * strideU + v * strideV] & 0x00FFFFFF) == rgb && faceAO[u + width][v] == ao)
+					{
+						merged[u + width] |= bit;
+						width++;
+					}
+
+					while (aoSameAlongV && v + height < numV)
 					{
-						if (zFace)
+						unsigned int rowBit = (1u << (v + height));
+						bool canMerge = true;
+						for (int i = 0; i < width && canMerge; i++)
 						{
-							merged[(blockx + incrementX) + blocky*width + (blockz + incrementZ)*width*height] |= MergedSide_Z_Negative;
+							canMerge = (pMergePhase2[u + i] & ~merged[u + i] & rowBit) != 0 && (pLayerColours[(u + i) * strideU + (v + height) * strideV] & 0x00FFFFFF) == rgb && faceAO[u + i][v + height] == ao;
 						}
-						if (xFace)
+						if (canMerge == false)
 						{
-							merged[(blockx + incrementX) + blocky*width + (blockz + incrementZ)*width*height] |= MergedSide_X_Negative;
+							break;
 						}
-						if (yFace)
+
+						for (int i = 0; i < width; i++)
 						{
-							merged[(blockx + incrementX) + blocky*width + (blockz + incrementZ)*width*height] |= MergedSide_Y_Negative;
+							merged[u + i] |= rowBit;
 						}
+						height++;
 					}
 				}
-				else
-				{
-					doMore = false;
-				}
 			}
-		}
 
-		if (zFace || yFace)
-		{
-			incrementX += change;
+			merged[u] |= (1u << v);
+			remaining = pVisible[u] & ~merged[u];
+
+			ChunkMeshQuad quad;
+			GetFaceBlock(face, layer, u, v, &quad.m_x, &quad.m_y, &quad.m_z);
+			quad.m_face = face;
+			quad.m_width = width;
+			quad.m_height = height;
+			quad.m_colour = colour;
+			quad.m_ao = ao;
+			quad.m_sortKey = ((quad.m_x * CHUNK_SIZE_Y + quad.m_y) * CHUNK_SIZE_Z + quad.m_z) * ChunkFace_NUM + face;
+			pQuadList->push_back(quad);
 		}
-		if (xFace)
+	}
+}
+
+void Chunk::CreateLODQuads(int lodLevel, const unsigned long long* pOccupancy, Chunk** pNeighbours, ChunkMeshQuadList* pQuadList)
+{
+	// A cell is solid if any of its blocks are, so the low detail mesh always covers the full detail blocks and
+	// there are no cracks next to neighbours at a different level. Cells take the colour of their highest block.
+	int cellSize = 1 << lodLevel;
+	int numCellsX = CHUNK_SIZE_X >> lodLevel;
+	int numCellsY = CHUNK_SIZE_Y >> lodLevel;
+	int numCellsZ = CHUNK_SIZE_Z >> lodLevel;
+	int numCellsXY = numCellsX * numCellsY;
+
+	bool cellActive[CHUNK_NUM_BLOCKS / 8];
+	unsigned int cellColours[CHUNK_NUM_BLOCKS / 8];
+	memset(cellActive, 0, sizeof(cellActive));
+
+	unsigned int* pColours = new unsigned int[CHUNK_NUM_BLOCKS];
+	m_pBlockStorage->GetColours(pColours);
+
+	for (int y = 0; y < CHUNK_SIZE_Y; y++)
+	{
+		for (int z = 0; z < CHUNK_SIZE_Z; z++)
 		{
-			incrementZ += change;
+			for (int x = 0; x < CHUNK_SIZE_X; x++)
+			{
+				int index = x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY;
+				if (IsOccupied(pOccupancy, index))
+				{
+					int cellIndex = (x >> lodLevel) + (y >> lodLevel) * numCellsX + (z >> lodLevel) * numCellsXY;
+					cellActive[cellIndex] = true;
+					cellColours[cellIndex] = pColours[index];
+				}
+			}
 		}
-
-		incrementer += change;
 	}
 
+	delete[] pColours;
 
-	// 2nd phase
-	int loop = incrementer;
-	incrementer = 0;
-	incrementer = incrementY;
-
-	doMore = true;
-	while (doMore)
+	for (int cellZ = 0; cellZ < numCellsZ; cellZ++)
 	{
-		if (startY + incrementer >= maxY)
+		for (int cellY = 0; cellY < numCellsY; cellY++)
 		{
-			doMore = false;
-		}
-		else
-		{
-			for (int i = 0; i < loop - 1; i++)
+			for (int cellX = 0; cellX < numCellsX; cellX++)
 			{
-				// Don't do any phase 2 merging is we have any inactive blocks or already merged blocks on the row
-				if (zFace)
+				int cellIndex = cellX + cellY * numCellsX + cellZ * numCellsXY;
+				if (cellActive[cellIndex] == false)
 				{
-					float r1, r2, g1, g2, b1, b2, a1, a2;
-					GetColour(blockx, blocky, blockz, &r1, &g1, &b1, &a1);
-					GetColour(blockx + i, blocky + incrementY, blockz, &r2, &g2, &b2, &a2);
-
-					if (positive && (blockz + 1) < CHUNK_SIZE && GetActive(blockx + i, blocky + incrementY, blockz + 1) == true)
-					{
-						doMore = false;
-					}
-					else if (!positive && blockz > 0 && GetActive(blockx + i, blocky + incrementY, blockz - 1) == true)
-					{
-						doMore = false;
-					}
-					else if (GetActive(blockx + i, blocky + incrementY, blockz) == false || (positive ? (IsMergedZPositive(merged, blockx + i, blocky + incrementY, blockz, width, height) == true) : (IsMergedZNegative(merged, blockx + i, blocky + incrementY, blockz, width, height) == true)))
-					{
-						// Failed active or already merged check
-						doMore = false;
-					}
-					/*else if(m_pBlocks[blockx][blocky][blockz].GetBlockType() != m_pBlocks[blockx + i][blocky + incrementY][blockz].GetBlockType())
-					{
-					// Failed block type check
-					doMore = false;
-					}
-					*/
-					else if ((r1 != r2 || g1 != g2 || b1 != b2 || a1 != a2) /*&& allMerge == false*/)
-					{
-						// Failed colour check
-						doMore = false;
-					}
+					continue;
 				}
-				if (xFace)
-				{
-					float r1, r2, g1, g2, b1, b2, a1, a2;
-					GetColour(blockx, blocky, blockz, &r1, &g1, &b1, &a1);
-					GetColour(blockx, blocky + incrementY, blockz + i, &r2, &g2, &b2, &a2);
 
-					if (positive && (blockx + 1) < CHUNK_SIZE && GetActive(blockx + 1, blocky + incrementY, blockz + i) == true)
-					{
-						doMore = false;
-					}
-					else if (!positive && (blockx) > 0 && GetActive(blockx - 1, blocky + incrementY, blockz + i) == true)
-					{
-						doMore = false;
-					}
-					else if (GetActive(blockx, blocky + incrementY, blockz + i) == false || (positive ? (IsMergedXPositive(merged, blockx, blocky + incrementY, blockz + i, width, height) == true) : (IsMergedXNegative(merged, blockx, blocky + incrementY, blockz + i, width, height) == true)))
-					{
-						// Failed active or already merged check
-						doMore = false;
-					}
-					/*else if(m_pBlocks[blockx][blocky][blockz].GetBlockType() != m_pBlocks[blockx][blocky + incrementY][blockz + i].GetBlockType())
-					{
-					// Failed block type check
-					doMore = false;
-					}
-					*/
-					else if ((r1 != r2 || g1 != g2 || b1 != b2 || a1 != a2) /*&& allMerge == false*/)
+				int blockX = cellX * cellSize;
+				int blockY = cellY * cellSize;
+				int blockZ = cellZ * cellSize;
+
+				for (int face = 0; face < ChunkFace_NUM; face++)
+				{
+					int neighbourX = cellX;
+					int neighbourY = cellY;
+					int neighbourZ = cellZ;
+					switch (face)
 					{
-						// Failed colour check
-						doMore = false;
+					case ChunkFace_Front: { neighbourZ++; } break;
+					case ChunkFace_Back: { neighbourZ--; } break;
+					case ChunkFace_Right: { neighbourX++; } break;
+					case ChunkFace_Left: { neighbourX--; } break;
+					case ChunkFace_Top: { neighbourY++; } break;
+					case ChunkFace_Bottom: { neighbourY--; } break;
 					}
-				}
-				if (yFace)
-				{
-					float r1, r2, g1, g2, b1, b2, a1, a2;
-					GetColour(blockx, blocky, blockz, &r1, &g1, &b1, &a1);
-					GetColour(blockx + i, blocky, blockz + incrementY, &r2, &g2, &b2, &a2);
 
-					if (positive && (blocky + 1) < CHUNK_SIZE && GetActive(blockx + i, blocky + 1, blockz + incrementY) == true)
+					bool visible = false;
+					if (neighbourX >= 0 && neighbourX < numCellsX && neighbourY >= 0 && neighbourY < numCellsY && neighbourZ >= 0 && neighbourZ < numCellsZ)
 					{
-						doMore = false;
+						visible = (cellActive[neighbourX + neighbourY * numCellsX + neighbourZ * numCellsXY] == false);
 					}
-					else if (!positive && blocky > 0 && GetActive(blockx + i, blocky - 1, blockz + incrementY) == true)
+					else if (pNeighbours[face] == NULL)
 					{
-						doMore = false;
+						// No neighbour, don't add the side
 					}
-					else if (GetActive(blockx + i, blocky, blockz + incrementY) == false || (positive ? (IsMergedYPositive(merged, blockx + i, blocky, blockz + incrementY, width, height) == true) : (IsMergedYNegative(merged, blockx + i, blocky, blockz + incrementY, width, height) == true)))
+					else if (pNeighbours[face]->IsSetup() == false)
 					{
-						// Failed active or already merged check
-						doMore = false;
+						visible = true;
 					}
-					/*else if(m_pBlocks[blockx][blocky][blockz].GetBlockType() != m_pBlocks[blockx + i][blocky][blockz + incrementY].GetBlockType())
+					else
 					{
-					// Failed block type check
-					doMore = false;
+						// Check the neighbour's full detail blocks, the face is hidden only if they are all solid
+						int neighbourLayer = IsPositiveFace(face) ? 0 : s_faceSizes[face][0] - 1;
+						int startU = (face == ChunkFace_Right || face == ChunkFace_Left) ? blockY : blockX;
+						int startV = (face == ChunkFace_Front || face == ChunkFace_Back) ? blockY : blockZ;
+						for (int u = startU; u < startU + cellSize && visible == false; u++)
+						{
+							for (int v = startV; v < startV + cellSize && visible == false; v++)
+							{
+								int x, y, z;
+								GetFaceBlock(face, neighbourLayer, u, v, &x, &y, &z);
+								if (pNeighbours[face]->GetActive(x, y, z) == false)
+								{
+									visible = true;
+								}
+							}
+						}
 					}
-					*/
-					else if ((r1 != r2 || g1 != g2 || b1 != b2 || a1 != a2) /*&& allMerge == false*/)
+
+					if (visible == false)
 					{
-						// Failed colour check
-						doMore = false;
+						continue;
 					}
+
+					// The quad covers the whole side of the cell, on the cell's last layer of blocks in the face direction
+					ChunkMeshQuad quad;
+					quad.m_face = face;
+					quad.m_x = blockX;
+					quad.m_y = blockY;
+					quad.m_z = blockZ;
+					if (face == ChunkFace_Front)
+						quad.m_z += cellSize - 1;
+					else if (face == ChunkFace_Right)
+						quad.m_x += cellSize - 1;
+					else if (face == ChunkFace_Top)
+						quad.m_y += cellSize - 1;
+					quad.m_width = cellSize;
+					quad.m_height = cellSize;
+					quad.m_colour = cellColours[cellIndex];
+					quad.m_ao = AO_UNOCCLUDED;
+					quad.m_sortKey = ((quad.m_x * CHUNK_SIZE_Y + quad.m_y) * CHUNK_SIZE_Z + quad.m_z) * ChunkFace_NUM + face;
+					pQuadList->push_back(quad);
 				}
 			}
+		}
+	}
+}
 
-			if (doMore == true)
+void Chunk::SampleNoiseLattice(vec3 position, float* pLattice)
+{
+	// The colour noise has a wavelength of hundreds of blocks, so the lattice is indistinguishable from sampling every block
+	const int numSamples = NOISE_LATTICE_SIZE_X * NOISE_LATTICE_SIZE_Y * NOISE_LATTICE_SIZE_Z;
+	float xPositions[numSamples];
+	float yPositions[numSamples];
+	float zPositions[numSamples];
+	for (int x = 0; x < NOISE_LATTICE_SIZE_X; x++)
+	{
+		for (int y = 0; y < NOISE_LATTICE_SIZE_Y; y++)
+		{
+			for (int z = 0; z < NOISE_LATTICE_SIZE_Z; z++)
 			{
-				if (zFace || xFace)
+				int index = x + y * NOISE_LATTICE_SIZE_X + z * NOISE_LATTICE_SIZE_X * NOISE_LATTICE_SIZE_Y;
+				xPositions[index] = position.x + x * NOISE_LATTICE_SPACING;
+				yPositions[index] = position.y + y * NOISE_LATTICE_SPACING;
+				zPositions[index] = position.z + z * NOISE_LATTICE_SPACING;
+			}
+		}
+	}
+
+	octave_noise_3d_batch(4.0f, 0.3f, 0.005f, numSamples, xPositions, yPositions, zPositions, pLattice);
+}
+
+float Chunk::InterpolateNoiseLattice(const float* pLattice, int x, int y, int z)
+{
+	int x0 = x / NOISE_LATTICE_SPACING;
+	int y0 = y / NOISE_LATTICE_SPACING;
+	int z0 = z / NOISE_LATTICE_SPACING;
+	float tx = (x - x0 * NOISE_LATTICE_SPACING) / (float)NOISE_LATTICE_SPACING;
+	float ty = (y - y0 * NOISE_LATTICE_SPACING) / (float)NOISE_LATTICE_SPACING;
+	float tz = (z - z0 * NOISE_LATTICE_SPACING) / (float)NOISE_LATTICE_SPACING;
+
+	const int strideY = NOISE_LATTICE_SIZE_X;
+	const int strideZ = NOISE_LATTICE_SIZE_X * NOISE_LATTICE_SIZE_Y;
+	const float* pCorner = &pLattice[x0 + y0 * strideY + z0 * strideZ];
+
+	// Trilinear, along x then y then z
+	float c00 = pCorner[0] + (pCorner[1] - pCorner[0]) * tx;
+	float c10 = pCorner[strideY] + (pCorner[strideY + 1] - pCorner[strideY]) * tx;
+	float c01 = pCorner[strideZ] + (pCorner[strideZ + 1] - pCorner[strideZ]) * tx;
+	float c11 = pCorner[strideY + strideZ] + (pCorner[strideY + strideZ + 1] - pCorner[strideY + strideZ]) * tx;
+
+	float c0 = c00 + (c10 - c00) * ty;
+	float c1 = c01 + (c11 - c01) * ty;
+
+	return c0 + (c1 - c0) * tz;
+}
+
+bool Chunk::IsPositiveFace(int face)
+{
+	return (face == ChunkFace_Front || face == ChunkFace_Right || face == ChunkFace_Top);
+}
+
+void Chunk::GetFaceBlock(int face, int layer, int u, int v, int* x, int* y, int* z)
+{
+	if (face == ChunkFace_Front || face == ChunkFace_Back)
+	{
+		*x = u; *y = v; *z = layer;
+	}
+	else if (face == ChunkFace_Right || face == ChunkFace_Left)
+	{
+		*x = layer; *y = u; *z = v;
+	}
+	else
+	{
+		*x = u; *y = layer; *z = v;
+	}
+}
+
+unsigned int Chunk::CalculateFaceConnections(const unsigned long long* pOccupancy)
+{
+	// Flood fill the empty blocks from each boundary block, every pair of faces that a filled region touches can see each other
+	unsigned int connections = 0;
+	bool* pVisited = new bool[CHUNK_NUM_BLOCKS];
+	int* pStack = new int[CHUNK_NUM_BLOCKS];
+	memset(pVisited, 0, sizeof(bool) * CHUNK_NUM_BLOCKS);
+
+	for (int start = 0; start < CHUNK_NUM_BLOCKS && connections != ALL_FACES_CONNECTED; start++)
+	{
+		if (pVisited[start] || IsOccupied(pOccupancy, start))
+		{
+			continue;
+		}
+
+		int startX = start % CHUNK_SIZE_X;
+		int startY = (start / CHUNK_SIZE_X) % CHUNK_SIZE_Y;
+		int startZ = start / CHUNK_SIZE_XY;
+		if (startX != 0 && startX != CHUNK_SIZE_X - 1 && startY != 0 && startY != CHUNK_SIZE_Y - 1 && startZ != 0 && startZ != CHUNK_SIZE_Z - 1)
+		{
+			// Regions that don't touch the boundary can't connect any faces
+			continue;
+		}
+
+		int faces = 0;
+		int stackSize = 0;
+		pStack[stackSize++] = start;
+		pVisited[start] = true;
+
+		while (stackSize > 0)
+		{
+			int index = pStack[--stackSize];
+			int x = index % CHUNK_SIZE_X;
+			int y = (index / CHUNK_SIZE_X) % CHUNK_SIZE_Y;
+			int z = index / CHUNK_SIZE_XY;
+
+			int neighbours[ChunkFace_NUM];
+			neighbours[ChunkFace_Front] = (z < CHUNK_SIZE_Z - 1) ? index + CHUNK_SIZE_XY : -1;
+			neighbours[ChunkFace_Back] = (z > 0) ? index - CHUNK_SIZE_XY : -1;
+			neighbours[ChunkFace_Right] = (x < CHUNK_SIZE_X - 1) ? index + 1 : -1;
+			neighbours[ChunkFace_Left] = (x > 0) ? index - 1 : -1;
+			neighbours[ChunkFace_Top] = (y < CHUNK_SIZE_Y - 1) ? index + CHUNK_SIZE_X : -1;
+			neighbours[ChunkFace_Bottom] = (y > 0) ? index - CHUNK_SIZE_X : -1;
+
+			for (int face = 0; face < ChunkFace_NUM; face++)
+			{
+				int neighbour = neighbours[face];
+				if (neighbour == -1)
 				{
-					(*p3).y += change * (BLOCK_RENDER_SIZE * 2.0f);
-					(*p4).y += change * (BLOCK_RENDER_SIZE * 2.0f);
+					faces |= (1 << face);
 				}
-				if (yFace)
+				else if (pVisited[neighbour] == false && IsOccupied(pOccupancy, neighbour) == false)
 				{
-					(*p3).z += change * (BLOCK_RENDER_SIZE * 2.0f);
-					(*p4).z += change * (BLOCK_RENDER_SIZE * 2.0f);
+					pVisited[neighbour] = true;
+					pStack[stackSize++] = neighbour;
 				}
+			}
+		}
 
-				for (int i = 0; i < loop - 1; i++)
+		for (int faceA = 0; faceA < ChunkFace_NUM; faceA++)
+		{
+			for (int faceB = faceA + 1; faceB < ChunkFace_NUM; faceB++)
+			{
+				if ((faces & (1 << faceA)) && (faces & (1 << faceB)))
 				{
-					if (positive)
-					{
-						if (zFace)
-						{
-							merged[(blockx + i) + (blocky + incrementY)*width + blockz*width*height] |= MergedSide_Z_Positive;
-						}
-						if (xFace)
-						{
-							merged[blockx + (blocky + incrementY)*width + (blockz + i)*width*height] |= MergedSide_X_Positive;
-						}
-						if (yFace)
-						{
-							merged[(blockx + i) + blocky*width + (blockz + incrementY)*width*height] |= MergedSide_Y_Positive;
-						}
-					}
-					else
-					{
-						if (zFace)
-						{
-							merged[(blockx + i) + (blocky + incrementY)*width + blockz*width*height] |= MergedSide_Z_Negative;
-						}
-						if (xFace)
-						{
-							merged[blockx + (blocky + incrementY)*width + (blockz + i)*width*height] |= MergedSide_X_Negative;
-						}
-						if (yFace)
-						{
-							merged[(blockx + i) + blocky*width + (blockz + incrementY)*width*height] |= MergedSide_Y_Negative;
-						}
-					}
+					connections |= (1u << GetFacePairBit(faceA, faceB));
 				}
 			}
 		}
+	}
+
+	delete[] pVisited;
+	delete[] pStack;
 
-		incrementY += change;
-		incrementer += change;
+	return connections;
+}
+
+bool Chunk::IsOccupied(const unsigned long long* pOccupancy, int index)
+{
+	return (pOccupancy[index >> 6] & (1ULL << (index & 63))) != 0;
+}
+
+bool Chunk::IsWallFull(const unsigned long long* pOccupancy, int face)
+{
+	const unsigned long long* pWallMask = s_wallMasks.m_masks[face];
+	for (int i = 0; i < OCCUPANCY_WORDS; i++)
+	{
+		if ((pOccupancy[i] & pWallMask[i]) != pWallMask[i])
+		{
+			return false;
+		}
 	}
+
+	return true;
 }
 
-// Rebuild
-void Chunk::RebuildMesh()
+int Chunk::GetFacePairBit(int faceA, int faceB)
 {
-	m_isRebuildingMesh = true;
-	if (m_pMesh != NULL)
+	// Index of the unordered pair, 15 pairs for the 6 faces
+	if (faceA > faceB)
 	{
-		m_pRenderer->ClearMesh(m_pMesh);
-		m_pMesh = NULL;
+		int temp = faceA;
+		faceA = faceB;
+		faceB = temp;
 	}
 
-	CreateMesh();
+	return faceA * ChunkFace_NUM - (faceA * (faceA + 1)) / 2 + (faceB - faceA - 1);
+}
+
+void Chunk::CompleteMesh(ChunkMeshBuffer* pMeshBuffer)
+{
+	m_numMeshVertices = (int)pMeshBuffer->m_vVertices.size();
+
+	// Upload the new mesh, the old mesh keeps being rendered until it is swapped out. Headless there is nothing to upload to.
+	OpenGLTriangleMesh* pNewMesh = NULL;
+	if (pMeshBuffer->m_vVertices.empty() == false && m_pRenderer != NULL)
+	{
+		pNewMesh = m_pRenderer->CreateMesh(OGLMeshType_PackedQuads);
+		pNewMesh->m_packedVertices.swap(pMeshBuffer->m_vVertices);
+		m_pRenderer->FinishMesh(-1, m_pChunkManager->GetChunkMaterialID(), pNewMesh);
+	}
+
+	OpenGLTriangleMesh* pOldMesh = m_pMesh.exchange(pNewMesh);
+	if (pOldMesh != NULL)
+	{
+		m_pRenderer->ClearMesh(pOldMesh);
+	}
+
+	m_faceConnections = pMeshBuffer->m_faceConnections;
+
+	UpdateEmptyFlag();
+}
+
+int Chunk::GetNumMeshVertices()
+{
+	return m_numMeshVertices;
+}
+
+// Level of detail
+void Chunk::SetLODLevel(int lodLevel)
+{
+	int oldLODLevel = m_lodLevel.exchange(lodLevel);
+
+	// Chunks that haven't been set up yet are meshed at the new level anyway
+	if (oldLODLevel != lodLevel && IsSetup())
+	{
+		SetNeedsRebuild(true, false);
+	}
+}
+
+int Chunk::GetLODLevel()
+{
+	return m_lodLevel;
+}
+
+// Rebuild
+ChunkMeshBuffer* Chunk::RebuildMesh()
+{
+	// Clear the rebuild flags first, so that any changes made while we are meshing will trigger another rebuild
+	m_rebuild = false;
+	unsigned int rebuildNeighbours = m_rebuildNeighbours.exchange(0);
+
+	ChunkMeshBuffer* pMeshBuffer = new ChunkMeshBuffer();
+	pMeshBuffer->m_pChunk = this;
+	pMeshBuffer->m_pNext = NULL;
+	CreateMesh(pMeshBuffer);
 
 	// Update our wall flags, so that our neighbors can check if they are surrounded
 	UpdateWallFlags();
@@ -1377,32 +1730,48 @@ void Chunk::RebuildMesh()
 		pChunkZPlus->UpdateSurroundedFlag();
 
 	// Rebuild neighbours
-	if (m_rebuildNeighours)
+	for (int z = -1; z <= 1; z++)
 	{
-		if (pChunkXMinus != NULL && pChunkXMinus->IsSetup() == true)
-			pChunkXMinus->SetNeedsRebuild(true, false);
-		if (pChunkXPlus != NULL && pChunkXPlus->IsSetup() == true)
-			pChunkXPlus->SetNeedsRebuild(true, false);
-		if (pChunkYMinus != NULL && pChunkYMinus->IsSetup() == true)
-			pChunkYMinus->SetNeedsRebuild(true, false);
-		if (pChunkYPlus != NULL && pChunkYPlus->IsSetup() == true)
-			pChunkYPlus->SetNeedsRebuild(true, false);
-		if (pChunkZMinus != NULL && pChunkZMinus->IsSetup() == true)
-			pChunkZMinus->SetNeedsRebuild(true, false);
-		if (pChunkZPlus != NULL && pChunkZPlus->IsSetup() == true)
-			pChunkZPlus->SetNeedsRebuild(true, false);
-
-		m_rebuildNeighours = false;
+		for (int y = -1; y <= 1; y++)
+		{
+			for (int x = -1; x <= 1; x++)
+			{
+				if ((rebuildNeighbours & GetNeighbourBit(x, y, z)) == 0)
+					continue;
+
+				Chunk* pNeighbour = m_pChunkManager->GetChunk(m_gridX + x, m_gridY + y, m_gridZ + z);
+				if (pNeighbour != NULL && pNeighbour->IsSetup() == true)
+				{
+					pNeighbour->SetNeedsRebuild(true, false);
+				}
+			}
+		}
 	}
 
 	m_numRebuilds++;
-	m_rebuild = false;
+
+	return pMeshBuffer;
 }
 
 void Chunk::SetNeedsRebuild(bool rebuild, bool rebuildNeighours)
 {
+	if (rebuildNeighours)
+	{
+		// The edge and corner neighbours only need us when their ambient occlusion samples our blocks
+		AddRebuildNeighbours(m_pChunkManager->GetBakedAO() ? ALL_NEIGHBOURS : FACE_NEIGHBOURS);
+	}
+
 	m_rebuild = rebuild;
-	m_rebuildNeighours = rebuildNeighours;
+
+	if (m_rebuild)
+	{
+		m_pChunkManager->AddRebuildChunk(m_gridX, m_gridY, m_gridZ);
+	}
+}
+
+void Chunk::AddRebuildNeighbours(unsigned int neighbours)
+{
+	m_rebuildNeighbours.fetch_or(neighbours);
 }
 
 bool Chunk::NeedsRebuild()
@@ -1410,20 +1779,31 @@ bool Chunk::NeedsRebuild()
 	return m_rebuild;
 }
 
-bool Chunk::IsRebuildingMesh()
+// Occlusion culling
+bool Chunk::IsFaceConnected(int faceA, int faceB)
 {
-	return m_isRebuildingMesh;
+	if (faceA == faceB)
+	{
+		return true;
+	}
+
+	return (m_faceConnections & (1u << GetFacePairBit(faceA, faceB))) != 0;
 }
 
-void Chunk::SwitchToCachedMesh()
+void Chunk::SetVisibleFrame(unsigned int frame)
 {
-	m_pCachedMesh = m_pMesh;
-	m_pMesh = NULL;
+	m_visibleFrame = frame;
 }
 
-void Chunk::UndoCachedMesh()
+unsigned int Chunk::GetVisibleFrame()
 {
-	m_deleteCachedMesh = true;
+	return m_visibleFrame;
+}
+
+int Chunk::GetOppositeFace(int face)
+{
+	// Faces are stored in positive and negative pairs
+	return face ^ 1;
 }
 
 // Updating
@@ -1435,16 +1815,12 @@ void Chunk::Update(float dt)
 // Rendering
 void Chunk::Render()
 {
-	OpenGLTriangleMesh* pMeshToUse = m_pMesh;
-	if (m_pCachedMesh != NULL)
-	{
-		pMeshToUse = m_pCachedMesh;
-	}
-
+	OpenGLTriangleMesh* pMeshToUse = m_pMesh.load();
 	if (pMeshToUse != NULL)
 	{
 		m_pRenderer->PushMatrix();
-			m_pRenderer->TranslateWorldMatrix(m_position.x, m_position.y, m_position.z);
+			// The packed mesh vertices are on block corners, offset from the block centres
+			m_pRenderer->TranslateWorldMatrix(m_position.x - BLOCK_RENDER_SIZE, m_position.y - BLOCK_RENDER_SIZE, m_position.z - BLOCK_RENDER_SIZE);
 
 			// Texture manipulation (for shadow rendering)
 			{
@@ -1463,24 +1839,13 @@ void Chunk::Render()
 			}
 		m_pRenderer->PopMatrix();
 	}
-
-	if (m_deleteCachedMesh)
-	{
-		if (m_pCachedMesh != NULL)
-		{
-			m_pRenderer->ClearMesh(m_pCachedMesh);
-			m_pCachedMesh = NULL;
-		}
-
-		m_deleteCachedMesh = false;
-	}
 }
 
 void Chunk::RenderDebug()
 {
-	float l_length = (Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE) - 0.05f;
-	float l_height = (Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE) - 0.05f;
-	float l_width = (Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE) - 0.05f;
+	float l_length = (Chunk::CHUNK_SIZE_X*Chunk::BLOCK_RENDER_SIZE) - 0.05f;
+	float l_height = (Chunk::CHUNK_SIZE_Y*Chunk::BLOCK_RENDER_SIZE) - 0.05f;
+	float l_width = (Chunk::CHUNK_SIZE_Z*Chunk::BLOCK_RENDER_SIZE) - 0.05f;
 
 	m_pRenderer->SetRenderMode(RM_WIREFRAME);
 	m_pRenderer->SetCullMode(CM_NOCULL);
@@ -1488,7 +1853,7 @@ void Chunk::RenderDebug()
 
 	m_pRenderer->PushMatrix();
 		m_pRenderer->TranslateWorldMatrix(m_position.x, m_position.y, m_position.z);
-		m_pRenderer->TranslateWorldMatrix(Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE);
+		m_pRenderer->TranslateWorldMatrix(Chunk::CHUNK_SIZE_X*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE_Y*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE_Z*Chunk::BLOCK_RENDER_SIZE);
 		m_pRenderer->TranslateWorldMatrix(-Chunk::BLOCK_RENDER_SIZE, -Chunk::BLOCK_RENDER_SIZE, -Chunk::BLOCK_RENDER_SIZE);
 
 		m_pRenderer->ImmediateColourAlpha(1.0f, 1.0f, 0.0f, 1.0f);
@@ -1546,7 +1911,7 @@ void Chunk::RenderDebug()
 void Chunk::Render2D(Camera* pCamera, unsigned int viewport, unsigned int font)
 {
 	int winx, winy;
-	vec3 centerPos = m_position + vec3(Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE);
+	vec3 centerPos = m_position + vec3(Chunk::CHUNK_SIZE_X*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE_Y*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE_Z*Chunk::BLOCK_RENDER_SIZE);
 	centerPos += vec3(-Chunk::BLOCK_RENDER_SIZE, -Chunk::BLOCK_RENDER_SIZE, -Chunk::BLOCK_RENDER_SIZE);
 	m_pRenderer->PushMatrix();
 		m_pRenderer->SetProjectionMode(PM_PERSPECTIVE, viewport);
@@ -20,12 +20,66 @@
 
 #include "../Renderer/Renderer.h"
 #include "../Renderer/camera.h"
+#include "BlockStorage.h"
+#include "ChunkMeshQueue.h"
+
+// Chunk dimensions in blocks, set at build time e.g. with cmake -DVOX_CHUNK_SIZE_X=32 -DVOX_CHUNK_SIZE_Z=32
+#ifndef VOX_CHUNK_SIZE_X
+#define VOX_CHUNK_SIZE_X 16
+#endif //VOX_CHUNK_SIZE_X
+#ifndef VOX_CHUNK_SIZE_Y
+#define VOX_CHUNK_SIZE_Y 16
+#endif //VOX_CHUNK_SIZE_Y
+#ifndef VOX_CHUNK_SIZE_Z
+#define VOX_CHUNK_SIZE_Z 16
+#endif //VOX_CHUNK_SIZE_Z
 
 class ChunkManager;
 class Player;
 class SceneryManager;
 class VoxSettings;
 
+// Chunk faces, in the order that the mesh adds them for each block
+enum ChunkFace
+{
+	ChunkFace_Front = 0,	// Z+
+	ChunkFace_Back,			// Z-
+	ChunkFace_Right,		// X+
+	ChunkFace_Left,			// X-
+	ChunkFace_Top,			// Y+
+	ChunkFace_Bottom,		// Y-
+
+	ChunkFace_NUM,
+};
+
+// A merged face, built by the mesh creation before it is added to the mesh
+struct ChunkMeshQuad
+{
+	int m_sortKey;
+	int m_face;
+	int m_x;
+	int m_y;
+	int m_z;
+	int m_width;
+	int m_height;
+	unsigned int m_colour;
+	unsigned char m_ao;		// Ambient occlusion of the u, v corners (0,0), (1,0), (1,1), (0,1), 2 bits each
+};
+
+typedef std::vector<ChunkMeshQuad> ChunkMeshQuadList;
+
+// Chunk lifecycle, each stage is claimed with a compare and swap so only one thread can move a chunk on from it
+enum ChunkState
+{
+	ChunkState_Queued = 0,		// Waiting for a worker to set it up
+	ChunkState_Generating,		// Blocks are being loaded or generated
+	ChunkState_Generated,		// Blocks are ready, waiting to be meshed
+	ChunkState_Meshing,			// First mesh is being built or is waiting to be uploaded
+	ChunkState_Ready,			// Meshed and rendering, no jobs in flight
+	ChunkState_Rebuilding,		// Still rendering the old mesh while a new one is built
+	ChunkState_Unloading,		// Removed from the world, waiting to be deleted
+};
+
 class Chunk
 {
 public:
@@ -42,8 +96,13 @@ public:
 	// Initialize
 	void Initialize();
 
+	// Lifecycle state
+	ChunkState GetState();
+	bool TransitionState(ChunkState fromState, ChunkState toState);
+	ChunkState ExchangeState(ChunkState state);
+	static bool IsSetupState(ChunkState state);
+
 	// Creation and destruction
-	void SetCreated(bool created);
 	bool IsCreated();
 	void Unload();
 	void Setup();
@@ -52,11 +111,13 @@ public:
 
 	// Saving and loading
 	void SaveChunk();
-	void LoadChunk();
+	bool LoadChunk();
+	bool IsLoadedFromFile();
 
 	// Position
 	void SetPosition(vec3 pos);
 	vec3 GetPosition();
+	vec3 GetCenter();
 
 	// Neighbours
 	int GetNumNeighbours();
@@ -80,7 +141,8 @@ public:
 	int GetGridY() const;
 	int GetGridZ() const;
 
-	// Batch update
+	// Batch update, only the neighbours next to the blocks that changed are rebuilt.
+	// The whole batch runs under the chunk manager's storage lock, since the dirty box is shared by every editing thread.
 	void StartBatchUpdate();
 	void StopBatchUpdate();
 
@@ -92,6 +154,8 @@ public:
 	void GetColour(int x, int y, int z, float* r, float* g, float* b, float* a);
 	void SetColour(int x, int y, int z, unsigned int colour);
 	unsigned int GetColour(int x, int y, int z);
+	static unsigned int PackColour(float r, float g, float b, float a);
+	unsigned int GetBlockMemoryUsage();
 
 	// Flags
 	bool IsEmpty();
@@ -100,18 +164,26 @@ public:
 	bool UpdateSurroundedFlag();
 	void UpdateEmptyFlag();
 
-	// Create mesh
-	void CreateMesh();
-	void CompleteMesh();
-	void UpdateMergedSide(int *merged, int blockx, int blocky, int blockz, int width, int height, vec3 *p1, vec3 *p2, vec3 *p3, vec3 *p4, int startX, int startY, int maxX, int maxY, bool positive, bool zFace, bool xFace, bool yFace);
+	// Create mesh, the mesh buffer is built on a worker thread and completed on the render thread
+	void CreateMesh(ChunkMeshBuffer* pMeshBuffer);
+	void CompleteMesh(ChunkMeshBuffer* pMeshBuffer);
+	int GetNumMeshVertices();
+
+	// Level of detail, level n meshes the chunk as cells of 2^n blocks. Changing the level rebuilds the mesh.
+	void SetLODLevel(int lodLevel);
+	int GetLODLevel();
 
 	// Rebuild
-	void RebuildMesh();
+	ChunkMeshBuffer* RebuildMesh();
 	void SetNeedsRebuild(bool rebuild, bool rebuildNeighours);
+	void AddRebuildNeighbours(unsigned int neighbours);
 	bool NeedsRebuild();
-	bool IsRebuildingMesh();
-	void SwitchToCachedMesh();
-	void UndoCachedMesh();
+
+	// Occlusion culling
+	bool IsFaceConnected(int faceA, int faceB);
+	void SetVisibleFrame(unsigned int frame);
+	unsigned int GetVisibleFrame();
+	static int GetOppositeFace(int face);
 
 	// Updating
 	void Update(float dt);
@@ -130,20 +202,53 @@ protected:
 
 private:
 	/* Private methods */
+	static void SampleNoiseLattice(vec3 position, float* pLattice);
+	static float InterpolateNoiseLattice(const float* pLattice, int x, int y, int z);
+	void GetMeshNeighbours(Chunk** pNeighbours);
+	void GetPaddedOccupancy(const unsigned long long* pOccupancy, unsigned char* pPaddedOccupancy);
+	static unsigned char GetFaceAO(int face, int layer, int u, int v, const unsigned char* pPaddedOccupancy);
+	void MergeLayerFaces(int face, int layer, unsigned int* pVisible, unsigned int* pMergePhase1, unsigned int* pMergePhase2, unsigned int* pColours, const unsigned char* pPaddedOccupancy, bool faceMerging, ChunkMeshQuadList* pQuadList);
+	void CreateLODQuads(int lodLevel, const unsigned long long* pOccupancy, Chunk** pNeighbours, ChunkMeshQuadList* pQuadList);
+	static void AddMeshQuads(ChunkMeshQuadList* pQuadList, ChunkMeshBuffer* pMeshBuffer);
+	static bool IsPositiveFace(int face);
+	static void GetFaceBlock(int face, int layer, int u, int v, int* x, int* y, int* z);
+	static unsigned int CalculateFaceConnections(const unsigned long long* pOccupancy);
+	static bool IsOccupied(const unsigned long long* pOccupancy, int index);
+	static bool IsWallFull(const unsigned long long* pOccupancy, int face);
+	static int GetFacePairBit(int faceA, int faceB);
 
 public:
 	/* Public members */
-	static const int CHUNK_SIZE = 16;
-	static const int CHUNK_SIZE_SQUARED = CHUNK_SIZE * CHUNK_SIZE;
-	static const int CHUNK_SIZE_CUBED = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+	// Blocks are indexed x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY
+	static const int CHUNK_SIZE_X = VOX_CHUNK_SIZE_X;
+	static const int CHUNK_SIZE_Y = VOX_CHUNK_SIZE_Y;
+	static const int CHUNK_SIZE_Z = VOX_CHUNK_SIZE_Z;
+	static const int CHUNK_SIZE_XY = CHUNK_SIZE_X * CHUNK_SIZE_Y;
+	static const int CHUNK_NUM_BLOCKS = CHUNK_SIZE_XY * CHUNK_SIZE_Z;
+	static const int CHUNK_SIZE_MAX = (CHUNK_SIZE_X > CHUNK_SIZE_Y) ? ((CHUNK_SIZE_X > CHUNK_SIZE_Z) ? CHUNK_SIZE_X : CHUNK_SIZE_Z) : ((CHUNK_SIZE_Y > CHUNK_SIZE_Z) ? CHUNK_SIZE_Y : CHUNK_SIZE_Z);
+	static const int OCCUPANCY_WORDS = (CHUNK_NUM_BLOCKS + 63) / 64;
+	static const int PADDED_CHUNK_SIZE_X = CHUNK_SIZE_X + 2;
+	static const int PADDED_CHUNK_SIZE_Y = CHUNK_SIZE_Y + 2;
+	static const int PADDED_CHUNK_SIZE_Z = CHUNK_SIZE_Z + 2;
 	static const float BLOCK_RENDER_SIZE;
 	static const float CHUNK_RADIUS;
+	static const unsigned int ALL_FACES_CONNECTED = 0x7FFF;
+	// Rebuild neighbour masks, one bit per neighbour chunk at (x+1) + (y+1)*3 + (z+1)*9
+	static const unsigned int FACE_NEIGHBOURS = (1 << 4) | (1 << 10) | (1 << 12) | (1 << 14) | (1 << 16) | (1 << 22);
+	static const unsigned int ALL_NEIGHBOURS = ((1 << 27) - 1) & ~(1 << 13);
+	static const int MAX_LOD_LEVEL = 3;
 
 protected:
 	/* Protected members */
 
 private:
 	/* Private members */
+	// Low frequency generation noise is sampled every NOISE_LATTICE_SPACING blocks and interpolated in between
+	static const int NOISE_LATTICE_SPACING = 4;
+	static const int NOISE_LATTICE_SIZE_X = CHUNK_SIZE_X / NOISE_LATTICE_SPACING + 1;
+	static const int NOISE_LATTICE_SIZE_Y = CHUNK_SIZE_Y / NOISE_LATTICE_SPACING + 1;
+	static const int NOISE_LATTICE_SIZE_Z = CHUNK_SIZE_Z / NOISE_LATTICE_SPACING + 1;
+
 	Renderer* m_pRenderer;
 	ChunkManager* m_pChunkManager;
 	Player* m_pPlayer;
@@ -159,8 +264,14 @@ private:
 	Chunk* m_pzMinus;
 	Chunk* m_pzPlus;
 
-	// Flag for change during a batch update
+	// Flag for change during a batch update, and the inclusive box of blocks that changed
 	bool m_chunkChangedDuringBatchUpdate;
+	int m_dirtyMinX;
+	int m_dirtyMinY;
+	int m_dirtyMinZ;
+	int m_dirtyMaxX;
+	int m_dirtyMaxY;
+	int m_dirtyMaxZ;
 
 	// Grid co-ordinates
 	int m_gridX;
@@ -170,14 +281,15 @@ private:
 	// Chunk position
 	vec3 m_position;
 
-	// Setup and creation flags
-	bool m_created;
-	bool m_setup;
-	bool m_isUnloading;
-	bool m_rebuild;
-	bool m_rebuildNeighours;
-	bool m_isRebuildingMesh;
-	bool m_deleteCachedMesh;
+	// Lifecycle state
+	atomic<ChunkState> m_state;
+
+	// Set by edits and neighbours, independent of the lifecycle so that changes made while we are meshing trigger another rebuild
+	atomic<bool> m_rebuild;
+	bool m_loadedFromFile;
+
+	// Neighbours to rebuild after our next rebuild, the edge and corner ones only when baked ambient occlusion samples them
+	atomic<unsigned int> m_rebuildNeighbours;
 
 	// Counters
 	int m_numRebuilds;
@@ -195,9 +307,25 @@ private:
 	bool m_z_plus_full;
 
 	// The blocks data
-	unsigned int *m_colour;
+	BlockStorage* m_pBlockStorage;
 
-	// Render mesh
-	OpenGLTriangleMesh* m_pMesh;
-	OpenGLTriangleMesh* m_pCachedMesh;
+	// Which pairs of chunk faces can see each other through empty blocks, one bit per pair.
+	// Worked out along with the mesh and swapped in when the mesh is completed.
+	unsigned int m_faceConnections;
+
+	// Frame that the occlusion culling last found this chunk visible
+	unsigned int m_visibleFrame;
+
+	// Vertices in the last completed mesh, also counted when there is no renderer to upload them to
+	int m_numMeshVertices;
+
+	// Level of detail that the next mesh is built at
+	atomic<int> m_lodLevel;
+
+	// Render mesh, only replaced by the render thread. Empty chunks have no mesh.
+	atomic<OpenGLTriangleMesh*> m_pMesh;
 };
+
+// The mesh builder stores a row of blocks in a 32 bit mask, and the lowest level of detail merges 8 blocks into a cell
+static_assert(Chunk::CHUNK_SIZE_MAX <= 32, "Chunk dimensions can't be larger than 32");
+static_assert((Chunk::CHUNK_SIZE_X % (1 << Chunk::MAX_LOD_LEVEL)) == 0 && (Chunk::CHUNK_SIZE_Y % (1 << Chunk::MAX_LOD_LEVEL)) == 0 && (Chunk::CHUNK_SIZE_Z % (1 << Chunk::MAX_LOD_LEVEL)) == 0, "Chunk dimensions must be a multiple of 8");
@@ -0,0 +1,135 @@
+// ******************************************************************************
+// Filename:	ChunkCache.cpp
+// Project:	Game
+// Author:	Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#include "ChunkCache.h"
+#include "RegionFile.h"
+
+
+ChunkCache::ChunkCache(int numBlocks, unsigned int maxBytes)
+{
+	m_numBlocks = numBlocks;
+	m_maxBytes = maxBytes;
+	m_numBytes = 0;
+
+	m_numHits = 0;
+	m_numMisses = 0;
+	m_numEvictions = 0;
+}
+
+ChunkCache::~ChunkCache()
+{
+	m_entryMap.clear();
+	m_entryList.clear();
+}
+
+void ChunkCache::SetMaxBytes(unsigned int maxBytes)
+{
+	lock_guard<mutex> lock(m_lock);
+
+	m_maxBytes = maxBytes;
+	EvictChunks();
+}
+
+// Chunks
+void ChunkCache::StoreChunk(int gridX, int gridY, int gridZ, const unsigned int* pColours)
+{
+	if (m_maxBytes == 0)
+	{
+		return;
+	}
+
+	ChunkCacheEntry entry;
+	entry.m_key.x = gridX;
+	entry.m_key.y = gridY;
+	entry.m_key.z = gridZ;
+
+	// Compress outside of the lock, so the workers restoring chunks aren't held up
+	RegionFile::Compress(pColours, m_numBlocks, &entry.m_vData);
+	entry.m_vData.shrink_to_fit();
+
+	lock_guard<mutex> lock(m_lock);
+
+	ChunkCacheEntryMap::iterator it = m_entryMap.find(entry.m_key);
+	if (it != m_entryMap.end())
+	{
+		RemoveEntry(it, NULL);
+	}
+
+	m_numBytes += (unsigned int)entry.m_vData.size();
+	m_entryList.push_front(ChunkCacheEntry());
+	m_entryList.front().m_key = entry.m_key;
+	m_entryList.front().m_vData.swap(entry.m_vData);
+	m_entryMap[entry.m_key] = m_entryList.begin();
+
+	EvictChunks();
+}
+
+bool ChunkCache::RestoreChunk(int gridX, int gridY, int gridZ, unsigned int* pColours)
+{
+	ChunkCacheKey key;
+	key.x = gridX;
+	key.y = gridY;
+	key.z = gridZ;
+
+	vector<unsigned char> vData;
+
+	m_lock.lock();
+	ChunkCacheEntryMap::iterator it = m_entryMap.find(key);
+	if (it == m_entryMap.end())
+	{
+		m_numMisses++;
+		m_lock.unlock();
+
+		return false;
+	}
+
+	// Take the data out of the cache, the loaded chunk is the only copy of its blocks from now on
+	RemoveEntry(it, &vData);
+	m_numHits++;
+	m_lock.unlock();
+
+	return RegionFile::Decompress(vData.empty() ? NULL : &vData[0], (unsigned int)vData.size(), m_numBlocks, pColours);
+}
+
+// Statistics
+void ChunkCache::GetStatistics(int* numChunks, unsigned int* numBytes, int* numHits, int* numMisses, int* numEvictions)
+{
+	lock_guard<mutex> lock(m_lock);
+
+	*numChunks = (int)m_entryMap.size();
+	*numBytes = m_numBytes;
+	*numHits = m_numHits;
+	*numMisses = m_numMisses;
+	*numEvictions = m_numEvictions;
+}
+
+// Private methods
+void ChunkCache::RemoveEntry(ChunkCacheEntryMap::iterator it, vector<unsigned char>* pData)
+{
+	ChunkCacheEntryList::iterator entryIt = it->second;
+	m_numBytes -= (unsigned int)entryIt->m_vData.size();
+	if (pData != NULL)
+	{
+		pData->swap(entryIt->m_vData);
+	}
+	m_entryMap.erase(it);
+	m_entryList.erase(entryIt);
+}
+
+void ChunkCache::EvictChunks()
+{
+	while (m_numBytes > m_maxBytes && m_entryList.empty() == false)
+	{
+		ChunkCacheEntryMap::iterator it = m_entryMap.find(m_entryList.back().m_key);
+		RemoveEntry(it, NULL);
+		m_numEvictions++;
+	}
+}
@@ -0,0 +1,107 @@
+// ******************************************************************************
+// Filename:	ChunkCache.h
+// Project:	Game
+// Author:	Steven Ball
+//
+// Purpose:
+//   Keeps the blocks of recently unloaded chunks in memory, run length encoded,
+//   so that a chunk that comes back into the loader radius is restored with a
+//   decompress instead of being generated or read from its region file again.
+//
+//   The cache is bounded by the size of the compressed data, the least
+//   recently unloaded chunks are evicted when it is full. A restored chunk
+//   is taken out of the cache, the loaded chunk owns its blocks from then on.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "../tinythread/tinythread.h"
+using namespace tthread;
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+struct ChunkCacheKey
+{
+	int x;
+	int y;
+	int z;
+};
+
+inline bool operator==(const ChunkCacheKey& l, const ChunkCacheKey& r)
+{
+	return l.x == r.x && l.y == r.y && l.z == r.z;
+}
+
+struct ChunkCacheKeyHash
+{
+	size_t operator()(const ChunkCacheKey& key) const
+	{
+		return ((size_t)key.x * 73856093) ^ ((size_t)key.y * 19349663) ^ ((size_t)key.z * 83492791);
+	}
+};
+
+struct ChunkCacheEntry
+{
+	ChunkCacheKey m_key;
+	vector<unsigned char> m_vData;
+};
+
+typedef list<ChunkCacheEntry> ChunkCacheEntryList;
+typedef unordered_map<ChunkCacheKey, ChunkCacheEntryList::iterator, ChunkCacheKeyHash> ChunkCacheEntryMap;
+
+class ChunkCache
+{
+public:
+	/* Public methods */
+	ChunkCache(int numBlocks, unsigned int maxBytes);
+	~ChunkCache();
+
+	void SetMaxBytes(unsigned int maxBytes);
+
+	// Stores the blocks of a chunk that is being unloaded, replacing anything already cached for it
+	void StoreChunk(int gridX, int gridY, int gridZ, const unsigned int* pColours);
+
+	// Restores the blocks of a chunk into pColours and removes it from the cache, returns false on a miss
+	bool RestoreChunk(int gridX, int gridY, int gridZ, unsigned int* pColours);
+
+	// Statistics
+	void GetStatistics(int* numChunks, unsigned int* numBytes, int* numHits, int* numMisses, int* numEvictions);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	void RemoveEntry(ChunkCacheEntryMap::iterator it, vector<unsigned char>* pData);
+	void EvictChunks();
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	int m_numBlocks;
+	unsigned int m_maxBytes;
+	unsigned int m_numBytes;
+
+	// Most recently stored chunks are at the front of the list
+	ChunkCacheEntryList m_entryList;
+	ChunkCacheEntryMap m_entryMap;
+
+	int m_numHits;
+	int m_numMisses;
+	int m_numEvictions;
+
+	mutex m_lock;
+};
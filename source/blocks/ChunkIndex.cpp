@@ -0,0 +1,98 @@
+// ******************************************************************************
+// Filename:	ChunkIndex.cpp
+// Project:	Game
+// Author:	Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#include "ChunkIndex.h"
+#include "Chunk.h"
+
+
+ChunkIndex::ChunkIndex(int size)
+{
+	m_size = 1;
+	m_sizeShift = 0;
+	while (m_size < size)
+	{
+		m_size *= 2;
+		m_sizeShift++;
+	}
+	m_sizeMask = m_size - 1;
+
+	int numSlots = m_size * m_size * m_size;
+	m_pSlots = new atomic<Chunk*>[numSlots];
+	for (int i = 0; i < numSlots; i++)
+	{
+		m_pSlots[i].store(NULL, memory_order_relaxed);
+	}
+}
+
+ChunkIndex::~ChunkIndex()
+{
+	delete[] m_pSlots;
+}
+
+int ChunkIndex::GetSize() const
+{
+	return m_size;
+}
+
+// Lookup
+Chunk* ChunkIndex::GetChunk(int x, int y, int z) const
+{
+	Chunk* pChunk = m_pSlots[GetSlotIndex(x, y, z)].load(memory_order_acquire);
+
+	// The slot is shared by every grid position that wraps to it
+	if (pChunk != NULL && pChunk->GetGridX() == x && pChunk->GetGridY() == y && pChunk->GetGridZ() == z)
+	{
+		return pChunk;
+	}
+
+	return NULL;
+}
+
+bool ChunkIndex::IsSlotFree(int x, int y, int z) const
+{
+	Chunk* pChunk = m_pSlots[GetSlotIndex(x, y, z)].load(memory_order_acquire);
+
+	return pChunk == NULL || (pChunk->GetGridX() == x && pChunk->GetGridY() == y && pChunk->GetGridZ() == z);
+}
+
+// Adding and removing
+bool ChunkIndex::AddChunk(Chunk* pChunk)
+{
+	atomic<Chunk*>* pSlot = &m_pSlots[GetSlotIndex(pChunk->GetGridX(), pChunk->GetGridY(), pChunk->GetGridZ())];
+
+	Chunk* pSlotChunk = pSlot->load(memory_order_relaxed);
+	if (pSlotChunk != NULL && pSlotChunk != pChunk)
+	{
+		return false;
+	}
+
+	pSlot->store(pChunk, memory_order_release);
+
+	return true;
+}
+
+void ChunkIndex::RemoveChunk(Chunk* pChunk)
+{
+	atomic<Chunk*>* pSlot = &m_pSlots[GetSlotIndex(pChunk->GetGridX(), pChunk->GetGridY(), pChunk->GetGridZ())];
+
+	// Only clear the slot if it is ours
+	if (pSlot->load(memory_order_relaxed) == pChunk)
+	{
+		pSlot->store(NULL, memory_order_release);
+	}
+}
+
+// Private methods
+int ChunkIndex::GetSlotIndex(int x, int y, int z) const
+{
+	// Masking wraps negative coordinates correctly with two's complement
+	return (x & m_sizeMask) | ((y & m_sizeMask) << m_sizeShift) | ((z & m_sizeMask) << (m_sizeShift * 2));
+}
@@ -0,0 +1,66 @@
+// ******************************************************************************
+// Filename:	ChunkIndex.h
+// Project:	Game
+// Author:	Steven Ball
+//
+// Purpose:
+//   A fixed size 3D ring buffer of chunk slots, addressed by the chunk grid
+//   coordinates wrapped by the size of the buffer. As long as the loaded
+//   chunks span less than the size of the buffer, each chunk has its own slot,
+//   so looking up a chunk (or a chunk's neighbour) is an array index.
+//
+//   Lookups are lock free. Adding and removing chunks is serialized by the
+//   chunk manager's chunk map lock.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include <atomic>
+using namespace std;
+
+class Chunk;
+
+class ChunkIndex
+{
+public:
+	/* Public methods */
+	ChunkIndex(int size);
+	~ChunkIndex();
+
+	int GetSize() const;
+
+	// Lookup
+	Chunk* GetChunk(int x, int y, int z) const;
+	bool IsSlotFree(int x, int y, int z) const;
+
+	// Adding and removing, returns false if the slot is being used by another chunk
+	bool AddChunk(Chunk* pChunk);
+	void RemoveChunk(Chunk* pChunk);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	int GetSlotIndex(int x, int y, int z) const;
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	// Size is a power of 2, so wrapping the coordinates is a mask
+	int m_size;
+	int m_sizeMask;
+	int m_sizeShift;
+
+	atomic<Chunk*>* m_pSlots;
+};
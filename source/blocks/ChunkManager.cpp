@@ -13,8 +13,41 @@
 #include "../Player/Player.h"
 #include "../VoxSettings.h"
 #include "../models/QubicleBinaryManager.h"
+#include "Prefab.h"
 
 #include <algorithm>
+#include <float.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/time.h>
+#endif //_WIN32
+
+
+// Time in seconds, for measuring chunk setup
+static double GetChunkTimerSeconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER ticks;
+	LARGE_INTEGER ticksPerSecond;
+	QueryPerformanceCounter(&ticks);
+	QueryPerformanceFrequency(&ticksPerSecond);
+	return (double)ticks.QuadPart / (double)ticksPerSecond.QuadPart;
+#else
+	struct timeval tm;
+	gettimeofday(&tm, NULL);
+	return (double)tm.tv_sec + (double)tm.tv_usec / 1000000.0;
+#endif //_WIN32
+}
+
+// Chunk streaming
+const float ChunkManager::UNLOADER_RADIUS_MARGIN = 24.0f;
+const float ChunkManager::LOD_HYSTERESIS = 8.0f;
+const float ChunkManager::PREFETCH_SECONDS = 1.5f;
+const float ChunkManager::MAX_PREFETCH_SPEED = 100.0f;
+const float ChunkManager::VIEW_DIRECTION_BIAS = 32.0f;
 
 
 ChunkManager::ChunkManager(Renderer* pRenderer, VoxSettings* pVoxSettings, QubicleBinaryManager* pQubicleBinaryManager)
@@ -24,12 +57,46 @@ ChunkManager::ChunkManager(Renderer* pRenderer, VoxSettings* pVoxSettings, Qubic
 	m_pVoxSettings = pVoxSettings;
 	m_pQubicleBinaryManager = pQubicleBinaryManager;
 
-	// Chunk material
+	// Chunk material, there is no renderer when running headless
 	m_chunkMaterialID = -1;
-	m_pRenderer->CreateMaterial(Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(0.0f, 0.0f, 0.0f, 1.0f), 64, &m_chunkMaterialID);
+	if (m_pRenderer != NULL)
+		m_pRenderer->CreateMaterial(Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(0.0f, 0.0f, 0.0f, 1.0f), 64, &m_chunkMaterialID);
 
 	// Loader radius
 	m_loaderRadius = 128.0f;
+	m_unloaderRadius = m_loaderRadius + UNLOADER_RADIUS_MARGIN;
+	m_pChunkIndex.store(new ChunkIndex(GetChunkIndexSize(m_loaderRadius, m_unloaderRadius)));
+	m_chunkIndexResizePending = false;
+
+	// Heightmap cache, big enough for every column of loaded chunks
+	int indexSize = GetChunkIndexSize(m_loaderRadius, m_unloaderRadius);
+	m_pHeightmapCache = new HeightmapCache(m_pVoxSettings, Chunk::CHUNK_SIZE_X, Chunk::CHUNK_SIZE_Z, indexSize * indexSize);
+
+	// Unloaded chunk cache, the size is in megabytes of compressed blocks
+	unsigned int chunkCacheBytes = (m_pVoxSettings->m_chunkCacheSize > 0) ? (unsigned int)m_pVoxSettings->m_chunkCacheSize * 1024 * 1024 : 0;
+	m_pChunkCache = new ChunkCache(Chunk::CHUNK_NUM_BLOCKS, chunkCacheBytes);
+
+	// Prefabs
+	m_pPrefabManager = new PrefabManager(m_pQubicleBinaryManager);
+
+	// Chunk streaming scheduler
+	m_schedulerGrid.x = m_schedulerGrid.y = m_schedulerGrid.z = 0;
+	m_schedulerPrefetchGrid = m_schedulerGrid;
+	m_schedulerPlayerCenter = vec3(0.0f, 0.0f, 0.0f);
+	m_schedulerPrefetchCenter = vec3(0.0f, 0.0f, 0.0f);
+	m_schedulerForward = vec3(0.0f, 0.0f, 0.0f);
+	m_schedulerQueueForward = vec3(0.0f, 0.0f, 0.0f);
+	m_unloadScanCoordKeys = m_schedulerGrid;
+	m_numUnloadChecksRemaining = 0;
+	m_streamingPlayerValid = false;
+	m_streamingPlayerCenter = vec3(0.0f, 0.0f, 0.0f);
+	m_streamingPrefetchCenter = vec3(0.0f, 0.0f, 0.0f);
+	m_streamingForward = vec3(0.0f, 0.0f, 0.0f);
+	m_playerVelocity = vec3(0.0f, 0.0f, 0.0f);
+	m_lastPlayerCenter = vec3(0.0f, 0.0f, 0.0f);
+	m_wakeGrid = m_schedulerGrid;
+	m_wakePrefetchGrid = m_schedulerGrid;
+	m_wakeForward = vec3(0.0f, 0.0f, 0.0f);
 
 	// Update lock
 	m_stepLockEnabled = false;
@@ -38,31 +105,164 @@ ChunkManager::ChunkManager(Renderer* pRenderer, VoxSettings* pVoxSettings, Qubic
 	// Rendering modes
 	m_wireframeRender = false;
 	m_faceMerging = true;
+	m_bakedAO = m_pVoxSettings->m_bakedAO;
+
+	// Region files, create the folder for them
+	if (m_pVoxSettings->m_saveChunks)
+	{
+		string folder = m_pVoxSettings->m_regionFolder;
+		for (unsigned int i = 1; i <= folder.size(); i++)
+		{
+			if (i == folder.size() || folder[i] == '/')
+			{
+#ifdef _WIN32
+				_mkdir(folder.substr(0, i).c_str());
+#else
+				mkdir(folder.substr(0, i).c_str(), 0755);
+#endif //_WIN32
+			}
+		}
+	}
+
+	// Chunk setup timings
+	m_numGeneratedChunks = 0;
+	m_totalGenerateTime = 0.0;
+	m_numLoadedChunks = 0;
+	m_totalLoadTime = 0.0;
+
+	// Occlusion culling
+	m_occlusionCullingValid = false;
+	m_occlusionFrame = 0;
+
+	// Render counters
+	m_numChunksRendered = 0;
+	m_numChunksCulled = 0;
+	m_numChunksOccluded = 0;
+	m_numShadowChunksRendered = 0;
+	m_numShadowChunksCulled = 0;
+
+	// Chunk job workers, by default leave one hardware thread free for the main thread
+	m_numWorkerThreads = m_pVoxSettings->m_chunkWorkerThreads;
+	if (m_numWorkerThreads <= 0)
+	{
+		m_numWorkerThreads = (int)thread::hardware_concurrency() - 1;
+	}
+	if (m_numWorkerThreads < 1)
+	{
+		m_numWorkerThreads = 1;
+	}
+	m_workerThreadsActive = true;
+	m_nextJobSerial = 0;
+	m_numOutstandingChunkJobs = 0;
+	m_numMeshesCompleted = 0;
+	for (int i = 0; i < m_numWorkerThreads; i++)
+	{
+		m_vpWorkerThreads.push_back(new thread(_ChunkWorkerThread, this));
+	}
 
 	// Threading
 	m_updateThreadActive = true;
-	m_updateThreadFinished = false;
+	m_updateThreadWakeup = true;
+	m_updateThreadIdle = false;
+	m_renderListDirty = false;
 	m_pUpdatingChunksThread = new thread(_UpdatingChunksThread, this);
 }
 
 ChunkManager::~ChunkManager()
 {
-	m_stepLockEnabled = false;
-	m_updateStepLock = true;
+	// Stop the updating thread
+	m_updateThreadLock.lock();
 	m_updateThreadActive = false;
-	while (m_updateThreadFinished == false)
+	m_updateThreadCondition.notify_all();
+	m_updateThreadLock.unlock();
+
+	m_pUpdatingChunksThread->join();
+	delete m_pUpdatingChunksThread;
+	m_pUpdatingChunksThread = NULL;
+
+	// Stop the chunk job workers
+	m_chunkJobQueueLock.lock();
+	m_workerThreadsActive = false;
+	m_chunkJobQueue.clear();
+	m_chunkJobQueueCondition.notify_all();
+	m_chunkJobQueueLock.unlock();
+
+	for (unsigned int i = 0; i < m_vpWorkerThreads.size(); i++)
 	{
-#ifdef _WIN32
-    		Sleep(200);
-#else
-    		usleep(200000);
-#endif
+		m_vpWorkerThreads[i]->join();
+		delete m_vpWorkerThreads[i];
+		m_vpWorkerThreads[i] = 0;
 	}
-#ifdef _WIN32
-	Sleep(200);
-#else
-	usleep(200000);
-#endif
+	m_vpWorkerThreads.clear();
+
+	// Nothing is rendering any more, so release the render list before deleting the retired chunks
+	atomic_store(&m_pRenderList, shared_ptr<ChunkRenderList>());
+
+	// Save and delete the chunks that are still loaded, the player has already been deleted by now.
+	// Nothing is going to be loaded again, so don't bother caching them.
+	m_pPlayer = NULL;
+	delete m_pChunkCache;
+	m_pChunkCache = NULL;
+	ChunkList loadedChunkList;
+	m_ChunkMapMutexLock.lock();
+	for (map<ChunkCoordKeys, Chunk*>::iterator it = m_chunksMap.begin(); it != m_chunksMap.end(); ++it)
+	{
+		loadedChunkList.push_back(it->second);
+	}
+	m_ChunkMapMutexLock.unlock();
+
+	for (unsigned int i = 0; i < loadedChunkList.size(); i++)
+	{
+		// The worker threads have stopped, so any chunk can be taken whatever stage it got to
+		ChunkState previousState = loadedChunkList[i]->ExchangeState(ChunkState_Unloading);
+		UnloadChunk(loadedChunkList[i], Chunk::IsSetupState(previousState));
+	}
+	DeleteRetiredChunks();
+
+	// Mesh buffers that were never uploaded
+	m_completedMeshQueue.TakeAll(&m_vpPendingMeshUploads);
+	for (unsigned int i = 0; i < m_vpPendingMeshUploads.size(); i++)
+	{
+		delete m_vpPendingMeshUploads[i];
+		m_vpPendingMeshUploads[i] = 0;
+	}
+	m_vpPendingMeshUploads.clear();
+
+	// Meshes released by the retired chunks
+	m_releasedMeshesLock.lock();
+	for (unsigned int i = 0; i < m_vpReleasedMeshes.size(); i++)
+	{
+		m_pRenderer->ClearMesh(m_vpReleasedMeshes[i]);
+		m_vpReleasedMeshes[i] = 0;
+	}
+	m_vpReleasedMeshes.clear();
+	m_releasedMeshesLock.unlock();
+
+	// Close the region files
+	m_regionFileMap.clear();
+	m_regionFileList.clear();
+
+	// Delete the chunk indices
+	delete m_pChunkIndex.load();
+	for (unsigned int i = 0; i < m_vpRetiredChunkIndices.size(); i++)
+	{
+		delete m_vpRetiredChunkIndices[i];
+		m_vpRetiredChunkIndices[i] = 0;
+	}
+	m_vpRetiredChunkIndices.clear();
+
+	delete m_pHeightmapCache;
+	m_pHeightmapCache = NULL;
+
+	delete m_pPrefabManager;
+	m_pPrefabManager = NULL;
+
+	// Delete the storage for chunks that were never loaded
+	for (ChunkStorageLoaderMap::iterator it = m_chunkStorageMap.begin(); it != m_chunkStorageMap.end(); ++it)
+	{
+		delete it->second;
+	}
+	m_chunkStorageMap.clear();
 }
 
 // Player pointer
@@ -93,7 +293,24 @@ unsigned int ChunkManager::GetChunkMaterialID()
 // Loader radius
 void ChunkManager::SetLoaderRadius(float radius)
 {
+	m_ChunkMapMutexLock.lock();
 	m_loaderRadius = radius;
+	m_unloaderRadius = radius + UNLOADER_RADIUS_MARGIN;
+
+	// Every loaded chunk needs checking against the new unloader radius
+	m_numUnloadChecksRemaining = (int)m_chunksMap.size();
+
+	m_chunkIndexResizePending = true;
+	ResizeChunkIndex();
+	m_ChunkMapMutexLock.unlock();
+
+	m_updateThreadLock.lock();
+	m_updateThreadWakeup = true;
+	m_updateThreadCondition.notify_one();
+	m_updateThreadLock.unlock();
+
+	int indexSize = GetChunkIndexSize(m_loaderRadius, m_unloaderRadius);
+	m_pHeightmapCache->SetMaxTiles(indexSize * indexSize);
 }
 
 float ChunkManager::GetLoaderRadius()
@@ -101,15 +318,28 @@ float ChunkManager::GetLoaderRadius()
 	return m_loaderRadius;
 }
 
+float ChunkManager::GetUnloaderRadius()
+{
+	return m_unloaderRadius;
+}
+
 // Step update
 void ChunkManager::SetStepLockEnabled(bool enabled)
 {
+	m_updateThreadLock.lock();
 	m_stepLockEnabled = enabled;
+	m_updateThreadWakeup = true;
+	m_updateThreadCondition.notify_one();
+	m_updateThreadLock.unlock();
 }
 
 void ChunkManager::StepNextUpdate()
 {
+	m_updateThreadLock.lock();
 	m_updateStepLock = false;
+	m_updateThreadWakeup = true;
+	m_updateThreadCondition.notify_one();
+	m_updateThreadLock.unlock();
 }
 
 // Chunk Creation
@@ -125,24 +355,33 @@ void ChunkManager::CreateNewChunk(int x, int y, int z)
 	pNewChunk->SetPlayer(m_pPlayer);
 	pNewChunk->SetSceneryManager(m_pSceneryManager);
 
-	float xPos = x * (Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f);
-	float yPos = y * (Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f);
-	float zPos = z * (Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f);
+	float xPos = x * (Chunk::CHUNK_SIZE_X * Chunk::BLOCK_RENDER_SIZE*2.0f);
+	float yPos = y * (Chunk::CHUNK_SIZE_Y * Chunk::BLOCK_RENDER_SIZE*2.0f);
+	float zPos = z * (Chunk::CHUNK_SIZE_Z * Chunk::BLOCK_RENDER_SIZE*2.0f);
 
 	pNewChunk->SetPosition(vec3(xPos, yPos, zPos));
 	pNewChunk->SetGrid(coordKeys.x, coordKeys.y, coordKeys.z);
 
+	// Start at the level of detail for the player's distance, so distant chunks aren't meshed at full detail first
+	pNewChunk->SetLODLevel(GetChunkLODLevel(length(GetChunkCenter(coordKeys) - m_schedulerPlayerCenter), 0));
+
 	m_ChunkMapMutexLock.lock();
+	if (m_pChunkIndex.load(memory_order_relaxed)->AddChunk(pNewChunk) == false)
+	{
+		// A chunk that wraps to the same index slot hasn't been unloaded yet
+		m_ChunkMapMutexLock.unlock();
+		delete pNewChunk;
+		return;
+	}
 	m_chunksMap[coordKeys] = pNewChunk;
 	m_ChunkMapMutexLock.unlock();
 
-	pNewChunk->Setup();
-	pNewChunk->SetNeedsRebuild(false, true);
-	pNewChunk->RebuildMesh();
-	pNewChunk->CompleteMesh();
-	pNewChunk->SetCreated(true);
+	m_renderListDirty = true;
 
 	UpdateChunkNeighbours(pNewChunk, x, y, z);
+
+	// Generate and mesh the chunk on the worker threads, it gets completed in Update()
+	QueueChunkJob(pNewChunk, ChunkJobType_Setup);
 }
 
 void ChunkManager::UpdateChunkNeighbours(Chunk* pChunk, int x, int y, int z)
@@ -218,7 +457,7 @@ void ChunkManager::UpdateChunkNeighbours(Chunk* pChunk, int x, int y, int z)
 	}
 }
 
-void ChunkManager::UnloadChunk(Chunk* pChunk)
+void ChunkManager::UnloadChunk(Chunk* pChunk, bool hasBlocks)
 {
 	ChunkCoordKeys coordKeys;
 	coordKeys.x = pChunk->GetGridX();
@@ -281,6 +520,12 @@ void ChunkManager::UnloadChunk(Chunk* pChunk)
 		}
 	}
 
+	// Save and cache the blocks, so the chunk doesn't need generating again when it is next loaded
+	if (hasBlocks)
+	{
+		pChunk->SaveChunk();
+	}
+
 	// Remove from map
 	m_ChunkMapMutexLock.lock();
 	map<ChunkCoordKeys, Chunk*>::iterator it = m_chunksMap.find(coordKeys);
@@ -288,6 +533,7 @@ void ChunkManager::UnloadChunk(Chunk* pChunk)
 	{
 		m_chunksMap.erase(coordKeys);
 	}
+	m_pChunkIndex.load(memory_order_relaxed)->RemoveChunk(pChunk);
 	m_ChunkMapMutexLock.unlock();
 
 	// Clear chunk linkage
@@ -296,17 +542,103 @@ void ChunkManager::UnloadChunk(Chunk* pChunk)
 		m_pPlayer->ClearChunkCacheForChunk(pChunk);
 	}
 
-	// Unload and delete
-	pChunk->Unload();
-	delete pChunk;
+	// Jobs for other chunks that are already running might still be reading from this chunk, so delay the delete until they are done
+	RetiredChunk retiredChunk;
+	retiredChunk.m_pChunk = pChunk;
+	m_chunkJobQueueLock.lock();
+	retiredChunk.m_jobSerial = m_nextJobSerial;
+	m_chunkJobQueueLock.unlock();
+	retiredChunk.m_pRenderList = atomic_load(&m_pRenderList);
+	m_vRetiredChunkList.push_back(retiredChunk);
+
+	m_renderListDirty = true;
+}
+
+// Rebuilding chunks
+void ChunkManager::AddRebuildChunk(int x, int y, int z)
+{
+	ChunkCoordKeys coordKeys;
+	coordKeys.x = x;
+	coordKeys.y = y;
+	coordKeys.z = z;
+
+	m_rebuildChunkKeysLock.lock();
+	m_rebuildChunkKeys.insert(coordKeys);
+	m_rebuildChunkKeysLock.unlock();
+
+	WakeUpdatingChunksThread();
+}
+
+// Chunk jobs
+int ChunkManager::GetNumWorkerThreads()
+{
+	return m_numWorkerThreads;
+}
+
+void ChunkManager::QueueChunkJob(Chunk* pChunk, ChunkJobType jobType)
+{
+	ChunkJob job;
+	job.m_pChunk = pChunk;
+	job.m_jobType = jobType;
+
+	m_numOutstandingChunkJobs++;
+
+	m_chunkJobQueueLock.lock();
+	if (jobType == ChunkJobType_Rebuild)
+	{
+		// Rebuilds are for chunks that are already visible, so get them done first
+		m_chunkJobQueue.push_front(job);
+	}
+	else
+	{
+		m_chunkJobQueue.push_back(job);
+	}
+	m_chunkJobQueueCondition.notify_one();
+	m_chunkJobQueueLock.unlock();
+}
+
+int ChunkManager::GetNumQueuedChunkJobs()
+{
+	m_chunkJobQueueLock.lock();
+	int numJobs = (int)m_chunkJobQueue.size();
+	m_chunkJobQueueLock.unlock();
+
+	return numJobs;
+}
+
+void ChunkManager::DeleteRetiredChunks()
+{
+	// Find the oldest job that is still running
+	m_chunkJobQueueLock.lock();
+	bool jobsInFlight = (m_inFlightJobSerials.empty() == false);
+	unsigned int oldestJobSerial = jobsInFlight ? *m_inFlightJobSerials.begin() : 0;
+	m_chunkJobQueueLock.unlock();
+
+	for (unsigned int i = 0; i < m_vRetiredChunkList.size();)
+	{
+		RetiredChunk retiredChunk = m_vRetiredChunkList[i];
+
+		if ((jobsInFlight == false || oldestJobSerial >= retiredChunk.m_jobSerial) && retiredChunk.m_pRenderList.expired())
+		{
+			// The chunk unloads itself when it is deleted
+			delete retiredChunk.m_pChunk;
+
+			m_vRetiredChunkList[i] = m_vRetiredChunkList.back();
+			m_vRetiredChunkList.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
 }
 
 // Getting chunk and positional information
 void ChunkManager::GetGridFromPosition(vec3 position, int* gridX, int* gridY, int* gridZ)
 {
-	*gridX = (int)((position.x + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE);
-	*gridY = (int)((position.y + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE);
-	*gridZ = (int)((position.z + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE);
+	*gridX = (int)((position.x + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE_X);
+	*gridY = (int)((position.y + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE_Y);
+	*gridZ = (int)((position.z + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE_Z);
 
 	if (position.x <= -0.5f)
 		*gridX -= 1;
@@ -318,9 +650,9 @@ void ChunkManager::GetGridFromPosition(vec3 position, int* gridX, int* gridY, in
 
 Chunk* ChunkManager::GetChunkFromPosition(float posX, float posY, float posZ)
 {
-	int gridX = (int)((posX + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE);
-	int gridY = (int)((posY + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE);
-	int gridZ = (int)((posZ + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE);
+	int gridX = (int)((posX + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE_X);
+	int gridY = (int)((posY + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE_Y);
+	int gridZ = (int)((posZ + Chunk::BLOCK_RENDER_SIZE) / Chunk::CHUNK_SIZE_Z);
 
 	if (posX <= -0.5f)
 		gridX -= 1;
@@ -334,22 +666,28 @@ Chunk* ChunkManager::GetChunkFromPosition(float posX, float posY, float posZ)
 
 Chunk* ChunkManager::GetChunk(int aX, int aY, int aZ)
 {
-	ChunkCoordKeys chunkKey;
-	chunkKey.x = aX;
-	chunkKey.y = aY;
-	chunkKey.z = aZ;
+	return m_pChunkIndex.load(memory_order_acquire)->GetChunk(aX, aY, aZ);
+}
 
-	m_ChunkMapMutexLock.lock();
-	map<ChunkCoordKeys, Chunk*>::iterator it = m_chunksMap.find(chunkKey);
-	if (it != m_chunksMap.end())
+// World block co-ordinates
+void ChunkManager::GetBlockFromPosition(vec3 position, int* blockX, int* blockY, int* blockZ)
+{
+	// Blocks are centred on their position
+	float blockSize = Chunk::BLOCK_RENDER_SIZE*2.0f;
+	*blockX = (int)floor((position.x + Chunk::BLOCK_RENDER_SIZE) / blockSize);
+	*blockY = (int)floor((position.y + Chunk::BLOCK_RENDER_SIZE) / blockSize);
+	*blockZ = (int)floor((position.z + Chunk::BLOCK_RENDER_SIZE) / blockSize);
+}
+
+int ChunkManager::GetGridFromBlock(int block, int chunkSize)
+{
+	// Round down, so that negative blocks are in the right chunk
+	if (block >= 0)
 	{
-		Chunk* lpReturn = m_chunksMap[chunkKey];
-		m_ChunkMapMutexLock.unlock();
-		return lpReturn;
+		return block / chunkSize;
 	}
-	m_ChunkMapMutexLock.unlock();
 
-	return NULL;
+	return (block + 1) / chunkSize - 1;
 }
 
 // Getting the active block state given a position and chunk information
@@ -369,9 +707,9 @@ bool ChunkManager::GetBlockActiveFrom3DPosition(float x, float y, float z, vec3
 	(*blockY) = (int)((abs(y) + Chunk::BLOCK_RENDER_SIZE) / (Chunk::BLOCK_RENDER_SIZE*2.0f));
 	(*blockZ) = (int)((abs(z) + Chunk::BLOCK_RENDER_SIZE) / (Chunk::BLOCK_RENDER_SIZE*2.0f));
 
-	(*blockX) = (*blockX) % Chunk::CHUNK_SIZE;
-	(*blockY) = (*blockY) % Chunk::CHUNK_SIZE;
-	(*blockZ) = (*blockZ) % Chunk::CHUNK_SIZE;
+	(*blockX) = (*blockX) % Chunk::CHUNK_SIZE_X;
+	(*blockY) = (*blockY) % Chunk::CHUNK_SIZE_Y;
+	(*blockZ) = (*blockZ) % Chunk::CHUNK_SIZE_Z;
 
 	(*blockPos).x = (*pChunk)->GetPosition().x + (*blockX) * (Chunk::BLOCK_RENDER_SIZE*2.0f);
 	(*blockPos).y = (*pChunk)->GetPosition().y + (*blockY) * (Chunk::BLOCK_RENDER_SIZE*2.0f);
@@ -385,9 +723,9 @@ bool ChunkManager::GetBlockActiveFrom3DPosition(float x, float y, float z, vec3
 		}
 		else
 		{
-			(*blockPos).x = (*pChunk)->GetPosition().x - ((*blockX) * (Chunk::BLOCK_RENDER_SIZE*2.0f)) + (Chunk::CHUNK_SIZE * (Chunk::BLOCK_RENDER_SIZE*2.0f));
+			(*blockPos).x = (*pChunk)->GetPosition().x - ((*blockX) * (Chunk::BLOCK_RENDER_SIZE*2.0f)) + (Chunk::CHUNK_SIZE_X * (Chunk::BLOCK_RENDER_SIZE*2.0f));
 
-			(*blockX) = (Chunk::CHUNK_SIZE) - (*blockX);
+			(*blockX) = (Chunk::CHUNK_SIZE_X) - (*blockX);
 		}
 	}
 	if (y < 0.0f)
@@ -398,9 +736,9 @@ bool ChunkManager::GetBlockActiveFrom3DPosition(float x, float y, float z, vec3
 		}
 		else
 		{
-			(*blockPos).y = (*pChunk)->GetPosition().y - ((*blockY) * (Chunk::BLOCK_RENDER_SIZE*2.0f)) + (Chunk::CHUNK_SIZE * (Chunk::BLOCK_RENDER_SIZE*2.0f));
+			(*blockPos).y = (*pChunk)->GetPosition().y - ((*blockY) * (Chunk::BLOCK_RENDER_SIZE*2.0f)) + (Chunk::CHUNK_SIZE_Y * (Chunk::BLOCK_RENDER_SIZE*2.0f));
 
-			(*blockY) = (Chunk::CHUNK_SIZE) - (*blockY);
+			(*blockY) = (Chunk::CHUNK_SIZE_Y) - (*blockY);
 		}
 	}
 	if (z < 0.0f)
@@ -411,9 +749,9 @@ bool ChunkManager::GetBlockActiveFrom3DPosition(float x, float y, float z, vec3
 		}
 		else
 		{
-			(*blockPos).z = (*pChunk)->GetPosition().z - ((*blockZ) * (Chunk::BLOCK_RENDER_SIZE*2.0f)) + (Chunk::CHUNK_SIZE * (Chunk::BLOCK_RENDER_SIZE*2.0f));
+			(*blockPos).z = (*pChunk)->GetPosition().z - ((*blockZ) * (Chunk::BLOCK_RENDER_SIZE*2.0f)) + (Chunk::CHUNK_SIZE_Z * (Chunk::BLOCK_RENDER_SIZE*2.0f));
 
-			(*blockZ) = (Chunk::CHUNK_SIZE) - (*blockZ);
+			(*blockZ) = (Chunk::CHUNK_SIZE_Z) - (*blockZ);
 		}
 	}
 
@@ -426,9 +764,9 @@ void ChunkManager::GetBlockGridFrom3DPositionChunkStorage(float x, float y, floa
 	(*blockY) = (int)((abs(y) + Chunk::BLOCK_RENDER_SIZE) / (Chunk::BLOCK_RENDER_SIZE*2.0f));
 	(*blockZ) = (int)((abs(z) + Chunk::BLOCK_RENDER_SIZE) / (Chunk::BLOCK_RENDER_SIZE*2.0f));
 
-	(*blockX) = (*blockX) % Chunk::CHUNK_SIZE;
-	(*blockY) = (*blockY) % Chunk::CHUNK_SIZE;
-	(*blockZ) = (*blockZ) % Chunk::CHUNK_SIZE;
+	(*blockX) = (*blockX) % Chunk::CHUNK_SIZE_X;
+	(*blockY) = (*blockY) % Chunk::CHUNK_SIZE_Y;
+	(*blockZ) = (*blockZ) % Chunk::CHUNK_SIZE_Z;
 
 	if (x < 0.0f)
 	{
@@ -437,7 +775,7 @@ void ChunkManager::GetBlockGridFrom3DPositionChunkStorage(float x, float y, floa
 		}
 		else
 		{
-			(*blockX) = (Chunk::CHUNK_SIZE) - (*blockX);
+			(*blockX) = (Chunk::CHUNK_SIZE_X) - (*blockX);
 		}
 	}
 	if (y < 0.0f)
@@ -447,7 +785,7 @@ void ChunkManager::GetBlockGridFrom3DPositionChunkStorage(float x, float y, floa
 		}
 		else
 		{
-			(*blockY) = (Chunk::CHUNK_SIZE) - (*blockY);
+			(*blockY) = (Chunk::CHUNK_SIZE_Y) - (*blockY);
 		}
 	}
 	if (z < 0.0f)
@@ -457,619 +795,1656 @@ void ChunkManager::GetBlockGridFrom3DPositionChunkStorage(float x, float y, floa
 		}
 		else
 		{
-			(*blockZ) = (Chunk::CHUNK_SIZE) - (*blockZ);
+			(*blockZ) = (Chunk::CHUNK_SIZE_Z) - (*blockZ);
 		}
 	}
 }
 
-// Adding to chunk storage for parts of the world generation that are outside of loaded chunks
-ChunkStorageLoader* ChunkManager::GetChunkStorage(int aX, int aY, int aZ, bool CreateIfNotExist)
+// Raycasting
+bool ChunkManager::Raycast(vec3 origin, vec3 direction, float maxDistance, ChunkRaycastHit* pHit)
 {
-	m_chunkStorageListLock.lock();
-	for (unsigned int i = 0; i < m_vpChunkStorageList.size(); i++)
+	// Hold on to the render list while walking, so that the chunks we pass through can't be deleted
+	shared_ptr<ChunkRenderList> pRenderList = GetRenderList();
+
+	float blockSize = Chunk::BLOCK_RENDER_SIZE*2.0f;
+	float rayOrigin[3] = { origin.x, origin.y, origin.z };
+	float rayDirection[3] = { direction.x, direction.y, direction.z };
+
+	// The block that the ray starts in, and its chunk
+	int block[3];
+	GetBlockFromPosition(origin, &block[0], &block[1], &block[2]);
+
+	int chunkSize[3] = { Chunk::CHUNK_SIZE_X, Chunk::CHUNK_SIZE_Y, Chunk::CHUNK_SIZE_Z };
+	int grid[3];
+	int local[3];
+	for (int i = 0; i < 3; i++)
 	{
-		if (m_vpChunkStorageList[i]->m_gridX == aX && m_vpChunkStorageList[i]->m_gridY == aY && m_vpChunkStorageList[i]->m_gridZ == aZ)
-		{
-			m_chunkStorageListLock.unlock();
+		grid[i] = GetGridFromBlock(block[i], chunkSize[i]);
+		local[i] = block[i] - grid[i] * chunkSize[i];
+	}
+	Chunk* pChunk = GetChunk(grid[0], grid[1], grid[2]);
 
-			// Found and existing chunk storage, return it
-			return m_vpChunkStorageList[i];
+	// Amanatides-Woo traversal, tMax is the distance along the ray to the next block boundary on each axis
+	int step[3];
+	float tMax[3];
+	float tDelta[3];
+	for (int i = 0; i < 3; i++)
+	{
+		if (rayDirection[i] > 0.0f)
+		{
+			step[i] = 1;
+			tMax[i] = ((block[i] + 0.5f) * blockSize - rayOrigin[i]) / rayDirection[i];
+			tDelta[i] = blockSize / rayDirection[i];
+		}
+		else if (rayDirection[i] < 0.0f)
+		{
+			step[i] = -1;
+			tMax[i] = ((block[i] - 0.5f) * blockSize - rayOrigin[i]) / rayDirection[i];
+			tDelta[i] = -blockSize / rayDirection[i];
+		}
+		else
+		{
+			step[i] = 0;
+			tMax[i] = FLT_MAX;
+			tDelta[i] = FLT_MAX;
 		}
 	}
-	m_chunkStorageListLock.unlock();
 
-	// No storage found, create a new one
-	if (CreateIfNotExist)
+	int enteredAxis = -1;
+	float distance = 0.0f;
+	while (distance <= maxDistance)
 	{
-		ChunkStorageLoader* pNewStorage = new ChunkStorageLoader(aX, aY, aZ);
-		pNewStorage->m_gridX = aX;
-		pNewStorage->m_gridY = aY;
-		pNewStorage->m_gridZ = aZ;
+		if (pChunk != NULL && pChunk->IsSetup() && pChunk->GetActive(local[0], local[1], local[2]))
+		{
+			if (pHit != NULL)
+			{
+				pHit->m_pChunk = pChunk;
+				pHit->m_blockX = local[0];
+				pHit->m_blockY = local[1];
+				pHit->m_blockZ = local[2];
+				pHit->m_blockPosition = vec3(block[0] * blockSize, block[1] * blockSize, block[2] * blockSize);
+				pHit->m_normal = vec3(0.0f, 0.0f, 0.0f);
+				if (enteredAxis == 0) pHit->m_normal.x = (float)-step[0];
+				if (enteredAxis == 1) pHit->m_normal.y = (float)-step[1];
+				if (enteredAxis == 2) pHit->m_normal.z = (float)-step[2];
+				pHit->m_distance = distance;
+			}
 
-		m_chunkStorageListLock.lock();
-		m_vpChunkStorageList.push_back(pNewStorage);
-		m_chunkStorageListLock.unlock();
+			return true;
+		}
 
-		return pNewStorage;
+		// Step into the next block along the axis with the closest boundary
+		int axis = (tMax[0] < tMax[1]) ? ((tMax[0] < tMax[2]) ? 0 : 2) : ((tMax[1] < tMax[2]) ? 1 : 2);
+		if (step[axis] == 0)
+		{
+			break;
+		}
+
+		distance = tMax[axis];
+		tMax[axis] += tDelta[axis];
+		block[axis] += step[axis];
+		local[axis] += step[axis];
+		enteredAxis = axis;
+
+		if (local[axis] < 0 || local[axis] >= chunkSize[axis])
+		{
+			// Into the next chunk, looked up through the lock free chunk index, since the
+			// neighbour pointers are written by the updating thread when chunks unload
+			local[axis] -= step[axis] * chunkSize[axis];
+			grid[axis] += step[axis];
+
+			pChunk = GetChunk(grid[0], grid[1], grid[2]);
+		}
 	}
 
-	return NULL;
+	return false;
 }
 
-void ChunkManager::RemoveChunkStorageLoader(ChunkStorageLoader* pChunkStorage)
+bool ChunkManager::HasLineOfSight(vec3 from, vec3 to)
 {
-	m_chunkStorageListLock.lock();
-	ChunkStorageLoaderList::iterator iter = std::find(m_vpChunkStorageList.begin(), m_vpChunkStorageList.end(), pChunkStorage);
-	if (iter != m_vpChunkStorageList.end())
+	vec3 toTarget = to - from;
+	float distance = length(toTarget);
+	if (distance <= 0.0f)
 	{
-		m_vpChunkStorageList.erase(iter);
+		return true;
 	}
-	m_chunkStorageListLock.unlock();
 
-	delete pChunkStorage;
-	pChunkStorage = NULL;
+	return Raycast(from, toTarget / distance, distance, NULL) == false;
 }
 
-// Importing into the world chunks
-void ChunkManager::ImportQubicleBinaryMatrix(QubicleMatrix* pMatrix, vec3 position, QubicleImportDirection direction)
+// Adding to chunk storage for parts of the world generation that are outside of loaded chunks
+ChunkStorageLoader* ChunkManager::GetChunkStorage(int aX, int aY, int aZ, bool CreateIfNotExist)
 {
-	bool mirrorX = false;
-	bool mirrorY = false;
-	bool mirrorZ = false;
-	bool flipXZ = false;
-	bool flipXY = false;
-	bool flipYZ = false;
-
-	switch (direction)
-	{
-	case QubicleImportDirection_Normal: {  } break;
-	case QubicleImportDirection_MirrorX: { mirrorX = true; } break;
-	case QubicleImportDirection_MirrorY: { mirrorY = true; } break;
-	case QubicleImportDirection_MirrorZ: { mirrorZ = true; } break;
-	case QubicleImportDirection_RotateY90: { mirrorX = true; flipXZ = true; } break;
-	case QubicleImportDirection_RotateY180: { mirrorX = true; mirrorZ = true; } break;
-	case QubicleImportDirection_RotateY270: { mirrorZ = true; flipXZ = true; } break;
-	case QubicleImportDirection_RotateX90: { mirrorZ = true; flipYZ = true; } break;
-	case QubicleImportDirection_RotateX180: { mirrorZ = true; mirrorY = true; } break;
-	case QubicleImportDirection_RotateX270: { mirrorY = true; flipYZ = true; } break;
-	case QubicleImportDirection_RotateZ90: { mirrorY = true; flipXY = true; } break;
-	case QubicleImportDirection_RotateZ180: { mirrorX = true; mirrorY = true; } break;
-	case QubicleImportDirection_RotateZ270: { mirrorX = true; flipXY = true; } break;
-	}
-
-	ChunkList vChunkBatchUpdateList;
+	// Find and create under the same lock, so two threads can't create storage for the same chunk
+	lock_guard<recursive_mutex> guard(m_chunkStorageListLock);
 
-	float r = 1.0f;
-	float g = 1.0f;
-	float b = 1.0f;
-	float a = 1.0f;
+	ChunkCoordKeys coordKeys;
+	coordKeys.x = aX;
+	coordKeys.y = aY;
+	coordKeys.z = aZ;
 
-	unsigned int xValueToUse = pMatrix->m_matrixSizeX;
-	unsigned int yValueToUse = pMatrix->m_matrixSizeY;
-	unsigned int zValueToUse = pMatrix->m_matrixSizeZ;
-	if (flipXZ)
-	{
-		xValueToUse = pMatrix->m_matrixSizeZ;
-		zValueToUse = pMatrix->m_matrixSizeX;
-	}
-	if (flipXY)
-	{
-		xValueToUse = pMatrix->m_matrixSizeY;
-		yValueToUse = pMatrix->m_matrixSizeX;
-	}
-	if (flipYZ)
+	ChunkStorageLoaderMap::iterator it = m_chunkStorageMap.find(coordKeys);
+	if (it != m_chunkStorageMap.end())
 	{
-		yValueToUse = pMatrix->m_matrixSizeZ;
-		zValueToUse = pMatrix->m_matrixSizeY;
+		// Found and existing chunk storage, return it
+		return it->second;
 	}
 
-	int xPosition = 0;
-	if (mirrorX)
-		xPosition = xValueToUse - 1;
-
-	for (unsigned int x = 0; x < xValueToUse; x++)
+	// No storage found, create a new one
+	if (CreateIfNotExist)
 	{
-		int yPosition = 0;
-		if (mirrorY)
-			yPosition = yValueToUse - 1;
-
-		for (unsigned int y = 0; y < yValueToUse; y++)
-		{
-			int zPosition = 0;
-			if (mirrorZ)
-				zPosition = zValueToUse - 1;
+		ChunkStorageLoader* pNewStorage = new ChunkStorageLoader(aX, aY, aZ);
+		m_chunkStorageMap[coordKeys] = pNewStorage;
 
-			for (unsigned int z = 0; z < zValueToUse; z++)
-			{
-				int xPosition_modified = xPosition;
-				int yPosition_modified = yPosition;
-				int zPosition_modified = zPosition;
-				if (flipXZ)
-				{
-					xPosition_modified = zPosition;
-					zPosition_modified = xPosition;
-				}
-				if (flipXY)
-				{
-					xPosition_modified = yPosition;
-					yPosition_modified = xPosition;
-				}
-				if (flipYZ)
-				{
-					yPosition_modified = zPosition;
-					zPosition_modified = yPosition;
-				}
+		return pNewStorage;
+	}
 
-				if (pMatrix->GetActive(xPosition_modified, yPosition_modified, zPosition_modified) == false)
-				{
-					// Do nothing
-				}
-				else
-				{
-					unsigned int colour = pMatrix->GetColourCompact(xPosition_modified, yPosition_modified, zPosition_modified);
+	return NULL;
+}
 
-					vec3 blockPos = position - vec3((xValueToUse + 0.05f)*0.5f, 0.0f, (zValueToUse + 0.05f)*0.5f) + vec3(x*Chunk::BLOCK_RENDER_SIZE*2.0f, y*Chunk::BLOCK_RENDER_SIZE*2.0f, z*Chunk::BLOCK_RENDER_SIZE*2.0f);
+ChunkStorageLoader* ChunkManager::TakeChunkStorage(int aX, int aY, int aZ)
+{
+	// Remove the storage from the list, the caller takes ownership of it
+	lock_guard<recursive_mutex> guard(m_chunkStorageListLock);
 
-					vec3 blockPosition;
-					int blockX, blockY, blockZ;
-					Chunk* pChunk = NULL;
-					bool blockActive = GetBlockActiveFrom3DPosition(blockPos.x, blockPos.y, blockPos.z, &blockPosition, &blockX, &blockY, &blockZ, &pChunk);
+	ChunkCoordKeys coordKeys;
+	coordKeys.x = aX;
+	coordKeys.y = aY;
+	coordKeys.z = aZ;
 
-					if (pChunk != NULL)
-					{
-						pChunk->SetColour(blockX, blockY, blockZ, colour);
+	ChunkStorageLoaderMap::iterator it = m_chunkStorageMap.find(coordKeys);
+	if (it != m_chunkStorageMap.end())
+	{
+		ChunkStorageLoader* pStorage = it->second;
+		m_chunkStorageMap.erase(it);
 
-						// Add to batch update list (no duplicates)
-						bool found = false;
-						for (int i = 0; i < (int)vChunkBatchUpdateList.size() && found == false; i++)
-						{
-							if (vChunkBatchUpdateList[i] == pChunk)
-							{
-								found = true;
-							}
-						}
-						if (found == false)
-						{
-							vChunkBatchUpdateList.push_back(pChunk);
-							pChunk->StartBatchUpdate();
-						}
-					}
-					else
-					{
-						// Add to the chunk storage
-						int gridX;
-						int gridY;
-						int gridZ;
-						GetGridFromPosition(blockPos, &gridX, &gridY, &gridZ);
-						ChunkStorageLoader* pStorage = GetChunkStorage(gridX, gridY, gridZ, true);
-
-						if (pStorage != NULL)
-						{
-							GetBlockGridFrom3DPositionChunkStorage(blockPos.x, blockPos.y, blockPos.z, &blockX, &blockY, &blockZ, pStorage);
+		return pStorage;
+	}
 
-							pStorage->SetBlockColour(blockX, blockY, blockZ, colour);
-						}
-					}
-				}
+	return NULL;
+}
 
-				if (mirrorZ)
-					zPosition--;
-				else
-					zPosition++;
-			}
+void ChunkManager::ApplyLateChunkStorage(Chunk* pChunk)
+{
+	// The chunk becomes setup under the lock, so no edit can write to it directly before the blocks that were stored
+	// for it while it was generating are applied, and an older stored block can't overwrite a newer edit.
+	lock_guard<recursive_mutex> guard(m_chunkStorageListLock);
 
-			if (mirrorY)
-				yPosition--;
-			else
-				yPosition++;
-		}
+	pChunk->TransitionState(ChunkState_Generating, ChunkState_Generated);
 
-		if (mirrorX)
-			xPosition--;
-		else
-			xPosition++;
+	ChunkStorageLoader* pChunkStorage = TakeChunkStorage(pChunk->GetGridX(), pChunk->GetGridY(), pChunk->GetGridZ());
+	if (pChunkStorage == NULL)
+	{
+		return;
 	}
 
-	for (int i = 0; i < (int)vChunkBatchUpdateList.size(); i++)
+	for (unsigned int i = 0; i < pChunkStorage->m_vBlocks.size(); i++)
 	{
-		vChunkBatchUpdateList[i]->StopBatchUpdate();
+		int index = pChunkStorage->m_vBlocks[i].m_index;
+		pChunk->SetColour(index % Chunk::CHUNK_SIZE_X, (index / Chunk::CHUNK_SIZE_X) % Chunk::CHUNK_SIZE_Y, index / Chunk::CHUNK_SIZE_XY, pChunkStorage->m_vBlocks[i].m_colour);
 	}
-	vChunkBatchUpdateList.clear();
+
+	delete pChunkStorage;
 }
 
-QubicleBinary* ChunkManager::ImportQubicleBinary(QubicleBinary* qubicleBinaryFile, vec3 position, QubicleImportDirection direction)
+int ChunkManager::GetNumStrandedStorageBlocks()
 {
-	int numMatrices = qubicleBinaryFile->GetNumMatrices();
+	lock_guard<recursive_mutex> guard(m_chunkStorageListLock);
 
-	for (int i = 0; i < numMatrices; i++)
+	int numBlocks = 0;
+	for (ChunkStorageLoaderMap::iterator it = m_chunkStorageMap.begin(); it != m_chunkStorageMap.end(); ++it)
 	{
-		QubicleMatrix* pMatrix = qubicleBinaryFile->GetQubicleMatrix(i);
-
-		ImportQubicleBinaryMatrix(pMatrix, position, direction);
+		if (GetEditableChunk(it->first.x, it->first.y, it->first.z) != NULL)
+		{
+			numBlocks += (int)it->second->m_vBlocks.size();
+		}
 	}
 
-	return qubicleBinaryFile;
+	return numBlocks;
 }
 
-QubicleBinary* ChunkManager::ImportQubicleBinary(const char* filename, vec3 position, QubicleImportDirection direction)
+void ChunkManager::RemoveChunkStorageLoader(ChunkStorageLoader* pChunkStorage)
 {
-	QubicleBinary* qubicleBinaryFile = m_pQubicleBinaryManager->GetQubicleBinaryFile(filename, true);
-	if (qubicleBinaryFile != NULL)
+	m_chunkStorageListLock.lock();
+	ChunkCoordKeys coordKeys;
+	coordKeys.x = pChunkStorage->m_gridX;
+	coordKeys.y = pChunkStorage->m_gridY;
+	coordKeys.z = pChunkStorage->m_gridZ;
+
+	ChunkStorageLoaderMap::iterator it = m_chunkStorageMap.find(coordKeys);
+	if (it != m_chunkStorageMap.end() && it->second == pChunkStorage)
 	{
-		return ImportQubicleBinary(qubicleBinaryFile, position, direction);
+		m_chunkStorageMap.erase(it);
 	}
+	m_chunkStorageListLock.unlock();
 
-	return NULL;
+	delete pChunkStorage;
+	pChunkStorage = NULL;
 }
 
-// Rendering modes
-void ChunkManager::SetWireframeRender(bool wireframe)
+// Region files, for saving and loading chunks
+shared_ptr<RegionFile> ChunkManager::GetRegionFile(int gridX, int gridY, int gridZ, int* localX, int* localY, int* localZ)
 {
-	m_wireframeRender = wireframe;
-}
+	if (m_pVoxSettings->m_saveChunks == false)
+	{
+		return shared_ptr<RegionFile>();
+	}
 
-void ChunkManager::SetFaceMerging(bool faceMerge)
-{
-	m_faceMerging = faceMerge;
-}
+	ChunkCoordKeys regionKeys;
+	RegionFile::GetRegionFromGrid(gridX, gridY, gridZ, &regionKeys.x, &regionKeys.y, &regionKeys.z, localX, localY, localZ);
 
-bool ChunkManager::GetFaceMerging()
-{
-	return m_faceMerging;
-}
+	lock_guard<mutex> lock(m_regionFileMapLock);
 
-// Updating
-void ChunkManager::Update(float dt)
+	shared_ptr<RegionFile> pRegionFile;
+	RegionFileMap::iterator it = m_regionFileMap.find(regionKeys);
+	if (it != m_regionFileMap.end())
+	{
+		// Move to the front of the list
+		m_regionFileList.splice(m_regionFileList.begin(), m_regionFileList, it->second);
+		pRegionFile = it->second->second;
+	}
+	else
+	{
+		char filename[256];
+		snprintf(filename, 256, "%sr.%i.%i.%i.vxr", m_pVoxSettings->m_regionFolder.c_str(), regionKeys.x, regionKeys.y, regionKeys.z);
+
+		pRegionFile = shared_ptr<RegionFile>(new RegionFile(filename, Chunk::CHUNK_SIZE_X, Chunk::CHUNK_SIZE_Y, Chunk::CHUNK_SIZE_Z));
+		m_regionFileList.push_front(RegionFileEntry(regionKeys, pRegionFile));
+		m_regionFileMap[regionKeys] = m_regionFileList.begin();
+
+		CloseRegionFiles();
+	}
+
+	return pRegionFile->IsOpen() ? pRegionFile : shared_ptr<RegionFile>();
+}
+
+void ChunkManager::CloseRegionFiles()
+{
+	// Close the least recently used files. A file that a chunk is still reading or writing is skipped, since
+	// opening it again before it is closed would give two offset tables for the same file.
+	RegionFileList::iterator it = m_regionFileList.end();
+	while ((int)m_regionFileList.size() > MAX_OPEN_REGION_FILES && it != m_regionFileList.begin())
+	{
+		--it;
+		if (it->second.use_count() == 1)
+		{
+			m_regionFileMap.erase(it->first);
+			it = m_regionFileList.erase(it);
+		}
+	}
+}
+
+// Compressed blocks of recently unloaded chunks
+void ChunkManager::CacheChunk(int gridX, int gridY, int gridZ, const unsigned int* pColours)
+{
+	if (m_pChunkCache == NULL)
+	{
+		return;
+	}
+
+	m_pChunkCache->StoreChunk(gridX, gridY, gridZ, pColours);
+}
+
+bool ChunkManager::RestoreCachedChunk(int gridX, int gridY, int gridZ, unsigned int* pColours)
+{
+	if (m_pChunkCache == NULL)
+	{
+		return false;
+	}
+
+	return m_pChunkCache->RestoreChunk(gridX, gridY, gridZ, pColours);
+}
+
+void ChunkManager::GetChunkCacheStatistics(int* numChunks, unsigned int* numBytes, int* numHits, int* numMisses, int* numEvictions)
+{
+	if (m_pChunkCache == NULL)
+	{
+		*numChunks = *numHits = *numMisses = *numEvictions = 0;
+		*numBytes = 0;
+		return;
+	}
+
+	m_pChunkCache->GetStatistics(numChunks, numBytes, numHits, numMisses, numEvictions);
+}
+
+// Terrain generation heightmap, shared by all of the chunks in a column
+shared_ptr<HeightmapTile> ChunkManager::GetHeightmapTile(int gridX, int gridZ)
+{
+	return m_pHeightmapCache->GetTile(gridX, gridZ);
+}
+
+void ChunkManager::GetHeightmapCacheStatistics(int* numTiles, int* numHits, int* numMisses)
+{
+	m_pHeightmapCache->GetStatistics(numTiles, numHits, numMisses);
+}
+
+// Chunk setup timings
+void ChunkManager::AddChunkSetupTime(bool loadedFromFile, double seconds)
+{
+	lock_guard<mutex> lock(m_chunkSetupTimingLock);
+
+	if (loadedFromFile)
+	{
+		m_numLoadedChunks++;
+		m_totalLoadTime += seconds;
+	}
+	else
+	{
+		m_numGeneratedChunks++;
+		m_totalGenerateTime += seconds;
+	}
+}
+
+void ChunkManager::GetChunkSetupTimings(int* numGenerated, float* averageGenerateTime, int* numLoaded, float* averageLoadTime)
+{
+	lock_guard<mutex> lock(m_chunkSetupTimingLock);
+
+	*numGenerated = m_numGeneratedChunks;
+	*averageGenerateTime = (m_numGeneratedChunks > 0) ? (float)(m_totalGenerateTime / m_numGeneratedChunks) : 0.0f;
+	*numLoaded = m_numLoadedChunks;
+	*averageLoadTime = (m_numLoadedChunks > 0) ? (float)(m_totalLoadTime / m_numLoadedChunks) : 0.0f;
+}
+
+// Importing into the world chunks
+void ChunkManager::ImportQubicleBinaryMatrix(QubicleMatrix* pMatrix, vec3 position, QubicleImportDirection direction)
+{
+	// Compiled and stamped like a prefab, so chunks that aren't editable get the blocks through their chunk storage
+	Prefab prefab(pMatrix, direction);
+	StampPrefab(&prefab, position, NULL, NULL);
+}
+
+QubicleBinary* ChunkManager::ImportQubicleBinary(QubicleBinary* qubicleBinaryFile, vec3 position, QubicleImportDirection direction)
+{
+	Prefab prefab(qubicleBinaryFile, direction);
+	StampPrefab(&prefab, position, NULL, NULL);
+
+	return qubicleBinaryFile;
+}
+
+QubicleBinary* ChunkManager::ImportQubicleBinary(const char* filename, vec3 position, QubicleImportDirection direction)
+{
+	// The compiled prefab is shared with the world generation, and the model is already loaded by then
+	Prefab* pPrefab = GetPrefab(filename, direction);
+	if (pPrefab == NULL)
+	{
+		return NULL;
+	}
+
+	StampPrefab(pPrefab, position, NULL, NULL);
+
+	// Don't refresh the model, it is shared between the chunk worker threads
+	return m_pQubicleBinaryManager->GetQubicleBinaryFile(filename, false);
+}
+
+// Editing blocks in world space
+void ChunkManager::SetBlocksInBox(vec3 minPosition, vec3 maxPosition, unsigned int colour)
+{
+	int minX, minY, minZ;
+	int maxX, maxY, maxZ;
+	GetBlockFromPosition(minPosition, &minX, &minY, &minZ);
+	GetBlockFromPosition(maxPosition, &maxX, &maxY, &maxZ);
+
+	SetBlocksInRegion(minX, minY, minZ, maxX, maxY, maxZ, vec3(0.0f, 0.0f, 0.0f), -1.0f, colour);
+}
+
+void ChunkManager::SetBlocksInSphere(vec3 center, float radius, unsigned int colour)
+{
+	int minX, minY, minZ;
+	int maxX, maxY, maxZ;
+	GetBlockFromPosition(center - vec3(radius, radius, radius), &minX, &minY, &minZ);
+	GetBlockFromPosition(center + vec3(radius, radius, radius), &maxX, &maxY, &maxZ);
+
+	SetBlocksInRegion(minX, minY, minZ, maxX, maxY, maxZ, center, radius, colour);
+}
+
+void ChunkManager::SetBlocks(const ChunkBlockEditList& vEdits)
+{
+	// Group the edits by chunk, as chunk local block indices
+	ChunkStorageBlockListMap chunkEdits;
+	for (unsigned int i = 0; i < vEdits.size(); i++)
+	{
+		int blockX, blockY, blockZ;
+		GetBlockFromPosition(vEdits[i].m_position, &blockX, &blockY, &blockZ);
+
+		ChunkCoordKeys coordKeys;
+		coordKeys.x = GetGridFromBlock(blockX, Chunk::CHUNK_SIZE_X);
+		coordKeys.y = GetGridFromBlock(blockY, Chunk::CHUNK_SIZE_Y);
+		coordKeys.z = GetGridFromBlock(blockZ, Chunk::CHUNK_SIZE_Z);
+
+		int x = blockX - coordKeys.x * Chunk::CHUNK_SIZE_X;
+		int y = blockY - coordKeys.y * Chunk::CHUNK_SIZE_Y;
+		int z = blockZ - coordKeys.z * Chunk::CHUNK_SIZE_Z;
+
+		ChunkStorageBlock block;
+		block.m_index = x + y * Chunk::CHUNK_SIZE_X + z * Chunk::CHUNK_SIZE_XY;
+		block.m_colour = vEdits[i].m_colour;
+		chunkEdits[coordKeys].push_back(block);
+	}
+
+	ChunkList vChunkBatchUpdateList;
+
+	// Hold the storage lock for the whole edit, see m_chunkStorageListLock
+	m_chunkStorageListLock.lock();
+
+	for (ChunkStorageBlockListMap::iterator it = chunkEdits.begin(); it != chunkEdits.end(); ++it)
+	{
+		const ChunkStorageBlockList& vBlocks = it->second;
+
+		Chunk* pChunk = GetEditableChunk(it->first.x, it->first.y, it->first.z);
+		if (pChunk != NULL)
+		{
+			pChunk->StartBatchUpdate();
+			for (unsigned int i = 0; i < vBlocks.size(); i++)
+			{
+				int index = vBlocks[i].m_index;
+				pChunk->SetColour(index % Chunk::CHUNK_SIZE_X, (index / Chunk::CHUNK_SIZE_X) % Chunk::CHUNK_SIZE_Y, index / Chunk::CHUNK_SIZE_XY, vBlocks[i].m_colour);
+			}
+			vChunkBatchUpdateList.push_back(pChunk);
+		}
+		else
+		{
+			ChunkStorageLoader* pStorage = GetChunkStorage(it->first.x, it->first.y, it->first.z, true);
+			pStorage->m_vBlocks.insert(pStorage->m_vBlocks.end(), vBlocks.begin(), vBlocks.end());
+		}
+	}
+
+	for (unsigned int i = 0; i < vChunkBatchUpdateList.size(); i++)
+	{
+		vChunkBatchUpdateList[i]->StopBatchUpdate();
+	}
+
+	m_chunkStorageListLock.unlock();
+}
+
+void ChunkManager::SetBlocksInRegion(int minX, int minY, int minZ, int maxX, int maxY, int maxZ, vec3 sphereCenter, float sphereRadius, unsigned int colour)
+{
+	float blockSize = Chunk::BLOCK_RENDER_SIZE*2.0f;
+	float radiusSquared = sphereRadius * sphereRadius;
+
+	ChunkList vChunkBatchUpdateList;
+
+	// Hold the storage lock for the whole edit, see m_chunkStorageListLock
+	m_chunkStorageListLock.lock();
+
+	for (int gridX = GetGridFromBlock(minX, Chunk::CHUNK_SIZE_X); gridX <= GetGridFromBlock(maxX, Chunk::CHUNK_SIZE_X); gridX++)
+	{
+		for (int gridY = GetGridFromBlock(minY, Chunk::CHUNK_SIZE_Y); gridY <= GetGridFromBlock(maxY, Chunk::CHUNK_SIZE_Y); gridY++)
+		{
+			for (int gridZ = GetGridFromBlock(minZ, Chunk::CHUNK_SIZE_Z); gridZ <= GetGridFromBlock(maxZ, Chunk::CHUNK_SIZE_Z); gridZ++)
+			{
+				int chunkBlockX = gridX * Chunk::CHUNK_SIZE_X;
+				int chunkBlockY = gridY * Chunk::CHUNK_SIZE_Y;
+				int chunkBlockZ = gridZ * Chunk::CHUNK_SIZE_Z;
+
+				// The part of the region inside this chunk, in chunk local blocks
+				int startX = (minX > chunkBlockX) ? minX - chunkBlockX : 0;
+				int startY = (minY > chunkBlockY) ? minY - chunkBlockY : 0;
+				int startZ = (minZ > chunkBlockZ) ? minZ - chunkBlockZ : 0;
+				int endX = (maxX < chunkBlockX + Chunk::CHUNK_SIZE_X - 1) ? maxX - chunkBlockX : Chunk::CHUNK_SIZE_X - 1;
+				int endY = (maxY < chunkBlockY + Chunk::CHUNK_SIZE_Y - 1) ? maxY - chunkBlockY : Chunk::CHUNK_SIZE_Y - 1;
+				int endZ = (maxZ < chunkBlockZ + Chunk::CHUNK_SIZE_Z - 1) ? maxZ - chunkBlockZ : Chunk::CHUNK_SIZE_Z - 1;
+
+				Chunk* pChunk = GetEditableChunk(gridX, gridY, gridZ);
+				ChunkStorageLoader* pStorage = NULL;
+				if (pChunk != NULL)
+				{
+					pChunk->StartBatchUpdate();
+				}
+
+				for (int z = startZ; z <= endZ; z++)
+				{
+					for (int y = startY; y <= endY; y++)
+					{
+						for (int x = startX; x <= endX; x++)
+						{
+							if (sphereRadius >= 0.0f)
+							{
+								float dx = (chunkBlockX + x) * blockSize - sphereCenter.x;
+								float dy = (chunkBlockY + y) * blockSize - sphereCenter.y;
+								float dz = (chunkBlockZ + z) * blockSize - sphereCenter.z;
+								if (dx*dx + dy*dy + dz*dz > radiusSquared)
+								{
+									continue;
+								}
+							}
+
+							if (pChunk != NULL)
+							{
+								pChunk->SetColour(x, y, z, colour);
+							}
+							else
+							{
+								if (pStorage == NULL)
+								{
+									pStorage = GetChunkStorage(gridX, gridY, gridZ, true);
+								}
+								pStorage->SetBlockColour(x, y, z, colour);
+							}
+						}
+					}
+				}
+
+				if (pChunk != NULL)
+				{
+					vChunkBatchUpdateList.push_back(pChunk);
+				}
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < vChunkBatchUpdateList.size(); i++)
+	{
+		vChunkBatchUpdateList[i]->StopBatchUpdate();
+	}
+
+	m_chunkStorageListLock.unlock();
+}
+
+// Chunks that are setup are edited in place, edits to any other chunk go to its chunk storage until it is setup
+Chunk* ChunkManager::GetEditableChunk(int gridX, int gridY, int gridZ)
+{
+	Chunk* pChunk = GetChunk(gridX, gridY, gridZ);
+	if (pChunk != NULL && pChunk->IsSetup() && pChunk->IsUnloading() == false)
+	{
+		return pChunk;
+	}
+
+	return NULL;
+}
+
+// Prefabs
+Prefab* ChunkManager::GetPrefab(const char* filename, QubicleImportDirection direction)
+{
+	return m_pPrefabManager->GetPrefab(filename, direction);
+}
+
+void ChunkManager::StampPrefab(Prefab* pPrefab, vec3 position, Chunk* pGeneratingChunk, unsigned int* pGeneratingColours)
+{
+	int numParts = pPrefab->GetNumParts();
+	if (numParts == 0)
+	{
+		return;
+	}
+
+	int minX, minY, minZ;
+	int maxX, maxY, maxZ;
+	pPrefab->GetBlockBounds(position, &minX, &minY, &minZ, &maxX, &maxY, &maxZ);
+
+	const unsigned int* pColours = pPrefab->GetColours();
+
+	// The chunks that the prefab bounds overlap
+	int gridMinX = GetGridFromBlock(minX, Chunk::CHUNK_SIZE_X);
+	int gridMinY = GetGridFromBlock(minY, Chunk::CHUNK_SIZE_Y);
+	int gridMinZ = GetGridFromBlock(minZ, Chunk::CHUNK_SIZE_Z);
+	int gridMaxX = GetGridFromBlock(maxX, Chunk::CHUNK_SIZE_X);
+	int gridMaxY = GetGridFromBlock(maxY, Chunk::CHUNK_SIZE_Y);
+	int gridMaxZ = GetGridFromBlock(maxZ, Chunk::CHUNK_SIZE_Z);
+
+	ChunkList vChunkBatchUpdateList;
+	PrefabRunList vChunkRuns;
+
+	// Hold the storage lock for the whole stamp, see m_chunkStorageListLock
+	m_chunkStorageListLock.lock();
+
+	for (int gridX = gridMinX; gridX <= gridMaxX; gridX++)
+	{
+		for (int gridY = gridMinY; gridY <= gridMaxY; gridY++)
+		{
+			for (int gridZ = gridMinZ; gridZ <= gridMaxZ; gridZ++)
+			{
+				int chunkBlockX = gridX * Chunk::CHUNK_SIZE_X;
+				int chunkBlockY = gridY * Chunk::CHUNK_SIZE_Y;
+				int chunkBlockZ = gridZ * Chunk::CHUNK_SIZE_Z;
+
+				// Clip the prefab runs to this chunk, in chunk local block co-ordinates
+				vChunkRuns.clear();
+				for (int i = 0; i < numParts; i++)
+				{
+					const PrefabPart& part = pPrefab->GetPart(i);
+
+					int originX, originY, originZ;
+					pPrefab->GetPartOrigin(i, position, &originX, &originY, &originZ);
+
+					for (unsigned int j = 0; j < part.m_vRuns.size(); j++)
+					{
+						const PrefabRun& run = part.m_vRuns[j];
+
+						int y = originY + run.m_y - chunkBlockY;
+						int z = originZ + run.m_z - chunkBlockZ;
+						if (y < 0 || y >= Chunk::CHUNK_SIZE_Y || z < 0 || z >= Chunk::CHUNK_SIZE_Z)
+						{
+							continue;
+						}
+
+						int xStart = originX + run.m_x - chunkBlockX;
+						int xEnd = xStart + run.m_length;
+						int clippedStart = xStart < 0 ? 0 : xStart;
+						int clippedEnd = xEnd > Chunk::CHUNK_SIZE_X ? Chunk::CHUNK_SIZE_X : xEnd;
+						if (clippedStart >= clippedEnd)
+						{
+							continue;
+						}
+
+						PrefabRun chunkRun;
+						chunkRun.m_x = clippedStart;
+						chunkRun.m_y = y;
+						chunkRun.m_z = z;
+						chunkRun.m_length = clippedEnd - clippedStart;
+						chunkRun.m_colourOffset = run.m_colourOffset + (clippedStart - xStart);
+						vChunkRuns.push_back(chunkRun);
+					}
+				}
+
+				if (vChunkRuns.empty())
+				{
+					continue;
+				}
+
+				// The chunk that is generating writes straight into its generation buffer
+				if (pGeneratingChunk != NULL && pGeneratingChunk->GetGridX() == gridX && pGeneratingChunk->GetGridY() == gridY && pGeneratingChunk->GetGridZ() == gridZ)
+				{
+					for (unsigned int i = 0; i < vChunkRuns.size(); i++)
+					{
+						const PrefabRun& run = vChunkRuns[i];
+						int index = run.m_x + run.m_y * Chunk::CHUNK_SIZE_X + run.m_z * Chunk::CHUNK_SIZE_XY;
+						memcpy(&pGeneratingColours[index], &pColours[run.m_colourOffset], sizeof(unsigned int) * run.m_length);
+					}
+
+					continue;
+				}
+
+				Chunk* pChunk = GetEditableChunk(gridX, gridY, gridZ);
+				if (pChunk != NULL)
+				{
+					pChunk->StartBatchUpdate();
+					for (unsigned int i = 0; i < vChunkRuns.size(); i++)
+					{
+						const PrefabRun& run = vChunkRuns[i];
+						for (int x = 0; x < run.m_length; x++)
+						{
+							pChunk->SetColour(run.m_x + x, run.m_y, run.m_z, pColours[run.m_colourOffset + x]);
+						}
+					}
+					vChunkBatchUpdateList.push_back(pChunk);
+				}
+				else
+				{
+					ChunkStorageLoader* pStorage = GetChunkStorage(gridX, gridY, gridZ, true);
+					for (unsigned int i = 0; i < vChunkRuns.size(); i++)
+					{
+						const PrefabRun& run = vChunkRuns[i];
+						pStorage->SetBlockColours(run.m_x, run.m_y, run.m_z, run.m_length, &pColours[run.m_colourOffset]);
+					}
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < (int)vChunkBatchUpdateList.size(); i++)
+	{
+		vChunkBatchUpdateList[i]->StopBatchUpdate();
+	}
+
+	m_chunkStorageListLock.unlock();
+}
+
+// Rendering modes
+void ChunkManager::SetWireframeRender(bool wireframe)
+{
+	m_wireframeRender = wireframe;
+}
+
+void ChunkManager::SetFaceMerging(bool faceMerge)
+{
+	m_faceMerging = faceMerge;
+}
+
+bool ChunkManager::GetFaceMerging()
+{
+	return m_faceMerging;
+}
+
+void ChunkManager::SetBakedAO(bool bakedAO)
+{
+	m_bakedAO = bakedAO;
+}
+
+bool ChunkManager::GetBakedAO()
+{
+	return m_bakedAO;
+}
+
+// Updating
+void ChunkManager::Update(float dt)
+{
+	UploadChunkMeshes();
+
+	UpdateStreamingPlayer(dt);
+}
+
+void ChunkManager::UploadChunkMeshes()
+{
+	// Delete the meshes that other threads have released
+	ChunkMeshList releasedMeshes;
+	m_releasedMeshesLock.lock();
+	releasedMeshes.swap(m_vpReleasedMeshes);
+	m_releasedMeshesLock.unlock();
+
+	for (unsigned int i = 0; i < releasedMeshes.size(); i++)
+	{
+		m_pRenderer->ClearMesh(releasedMeshes[i]);
+	}
+
+	// Upload the finished meshes in the order they were built, up to the upload budget. Always upload at least one, so big meshes still get through.
+	m_completedMeshQueue.TakeAll(&m_vpPendingMeshUploads);
+
+	ChunkList completedChunkList;
+	unsigned int numUploadedBytes = 0;
+	while (m_vpPendingMeshUploads.empty() == false && (completedChunkList.empty() || numUploadedBytes < MESH_UPLOAD_BYTES_PER_UPDATE))
+	{
+		ChunkMeshBuffer* pMeshBuffer = m_vpPendingMeshUploads.front();
+		m_vpPendingMeshUploads.pop_front();
+
+		Chunk* pChunk = pMeshBuffer->m_pChunk;
+		numUploadedBytes += ChunkMeshQueue::GetNumBytes(pMeshBuffer);
+
+		pChunk->CompleteMesh(pMeshBuffer);
+		delete pMeshBuffer;
+		m_numMeshesCompleted++;
+
+		// The chunk can't be unloaded or rebuilt again until now, since its mesh buffer was waiting to be uploaded
+		if (pChunk->TransitionState(ChunkState_Meshing, ChunkState_Ready) == false)
+		{
+			pChunk->TransitionState(ChunkState_Rebuilding, ChunkState_Ready);
+		}
+
+		completedChunkList.push_back(pChunk);
+	}
+
+	// Let the scheduler know, now that these chunks know if they are empty, and there are free job slots
+	if (completedChunkList.empty() == false)
+	{
+		m_completedChunkKeysLock.lock();
+		for (unsigned int i = 0; i < completedChunkList.size(); i++)
+		{
+			ChunkCoordKeys coordKeys;
+			coordKeys.x = completedChunkList[i]->GetGridX();
+			coordKeys.y = completedChunkList[i]->GetGridY();
+			coordKeys.z = completedChunkList[i]->GetGridZ();
+			m_vCompletedChunkKeys.push_back(coordKeys);
+		}
+		m_completedChunkKeysLock.unlock();
+
+		WakeUpdatingChunksThread();
+
+		// Only after the wake up, so the updating thread can't look idle while there is still work from these chunks
+		m_numOutstandingChunkJobs -= (int)completedChunkList.size();
+	}
+}
+
+int ChunkManager::GetNumPendingMeshUploads()
+{
+	return (int)m_vpPendingMeshUploads.size();
+}
+
+int ChunkManager::GetNumMeshesCompleted()
+{
+	return m_numMeshesCompleted;
+}
+
+void ChunkManager::WakeUpdatingChunksThread()
+{
+	m_updateThreadLock.lock();
+	m_updateThreadWakeup = true;
+	m_updateThreadCondition.notify_one();
+	m_updateThreadLock.unlock();
+}
+
+void ChunkManager::_UpdatingChunksThread(void* pData)
+{
+	ChunkManager* lpChunkManager = (ChunkManager*)pData;
+	lpChunkManager->UpdatingChunksThread();
+}
+
+void ChunkManager::_ChunkWorkerThread(void* pData)
+{
+	ChunkManager* lpChunkManager = (ChunkManager*)pData;
+	lpChunkManager->ChunkWorkerThread();
+}
+
+void ChunkManager::ChunkWorkerThread()
+{
+	while (true)
+	{
+		m_chunkJobQueueLock.lock();
+		while (m_workerThreadsActive && m_chunkJobQueue.empty())
+		{
+			m_chunkJobQueueCondition.wait(m_chunkJobQueueLock);
+		}
+
+		if (m_workerThreadsActive == false)
+		{
+			m_chunkJobQueueLock.unlock();
+			break;
+		}
+
+		ChunkJob job = m_chunkJobQueue.front();
+		m_chunkJobQueue.pop_front();
+		unsigned int jobSerial = m_nextJobSerial++;
+		m_inFlightJobSerials.insert(jobSerial);
+		m_chunkJobQueueLock.unlock();
+
+		Chunk* pChunk = job.m_pChunk;
+		if (job.m_jobType == ChunkJobType_Setup)
+		{
+			pChunk->TransitionState(ChunkState_Queued, ChunkState_Generating);
+
+			double startTime = GetChunkTimerSeconds();
+			pChunk->Setup();
+			AddChunkSetupTime(pChunk->IsLoadedFromFile(), GetChunkTimerSeconds() - startTime);
+			pChunk->SetNeedsRebuild(false, true);
+
+			pChunk->TransitionState(ChunkState_Generated, ChunkState_Meshing);
+		}
+		ChunkMeshBuffer* pMeshBuffer = pChunk->RebuildMesh();
+
+		m_chunkJobQueueLock.lock();
+		m_inFlightJobSerials.erase(m_inFlightJobSerials.find(jobSerial));
+		m_chunkJobQueueLock.unlock();
+
+		m_completedMeshQueue.Push(pMeshBuffer);
+	}
+}
+
+void ChunkManager::UpdatingChunksThread()
+{
+	while (true)
+	{
+		// Sleep until we are woken by the player moving, chunk jobs completing, a rebuild request or shutdown
+		m_updateThreadLock.lock();
+		while (m_updateThreadActive && (m_updateThreadWakeup == false || m_streamingPlayerValid == false || (m_stepLockEnabled == true && m_updateStepLock == true)))
+		{
+			m_updateThreadCondition.wait(m_updateThreadLock);
+		}
+
+		if (m_updateThreadActive == false)
+		{
+			m_updateThreadLock.unlock();
+			break;
+		}
+
+		m_updateThreadWakeup = false;
+		m_updateThreadIdle = false;
+		m_schedulerPlayerCenter = m_streamingPlayerCenter;
+		m_schedulerPrefetchCenter = m_streamingPrefetchCenter;
+		m_schedulerForward = m_streamingForward;
+		m_updateThreadLock.unlock();
+
+		// Keep enough jobs queued to keep all the workers busy, without flooding the queue
+		int MAX_JOBS_PER_WORKER = 4;
+		int numFreeJobs = m_numWorkerThreads * MAX_JOBS_PER_WORKER - GetNumQueuedChunkJobs();
+
+		// Loading chunks, closest and in front of the player first
+		UpdateSchedulerPlayer();
+		ExpandChunkFrontier();
+		int numLoadedChunks = LoadScheduledChunks(numFreeJobs);
+		numFreeJobs -= numLoadedChunks;
+
+		// Unloading chunks
+		bool moreUnloadChecks = UnloadDistantChunks();
+
+		// A smaller chunk index is swapped in once an unload pass has made room for it
+		if (moreUnloadChecks == false)
+		{
+			m_ChunkMapMutexLock.lock();
+			if (m_chunkIndexResizePending)
+			{
+				ResizeChunkIndex();
+				moreUnloadChecks = m_chunkIndexResizePending;
+			}
+			m_ChunkMapMutexLock.unlock();
+		}
+
+		// Let the render thread see the loaded and unloaded chunks
+		if (m_renderListDirty)
+		{
+			PublishRenderList();
+		}
+
+		DeleteRetiredChunks();
+
+		// Rebuilding chunks
+		int numRebuildChunks = QueueRebuildChunks(numFreeJobs);
+
+		m_updateThreadLock.lock();
+		m_updateThreadIdle = (numLoadedChunks == 0 && numRebuildChunks == 0 && moreUnloadChecks == false);
+
+		if (m_stepLockEnabled == true && m_updateStepLock == false)
+		{
+			m_updateStepLock = true;
+		}
+
+		// Loading and rebuilding carry on when jobs complete, but the unload checks need to keep going by themselves
+		if (moreUnloadChecks)
+		{
+			m_updateThreadWakeup = true;
+		}
+		m_updateThreadLock.unlock();
+	}
+}
+
+// Occlusion culling
+void ChunkManager::UpdateOcclusionCulling(vec3 cameraPosition, Frustum* pFrustum)
+{
+	m_occlusionCullingValid = false;
+
+	if (m_pVoxSettings->m_occlusionCulling == false)
+	{
+		return;
+	}
+
+	int gridX;
+	int gridY;
+	int gridZ;
+	GetGridFromPosition(cameraPosition, &gridX, &gridY, &gridZ);
+
+	ChunkCoordKeys cameraKey;
+	cameraKey.x = gridX;
+	cameraKey.y = gridY;
+	cameraKey.z = gridZ;
+
+	// Hold on to the render list, chunks that we can find in the chunk index can't be deleted until it is released
+	shared_ptr<ChunkRenderList> pRenderList = GetRenderList();
+	Chunk* pCameraChunk = GetChunk(cameraKey.x, cameraKey.y, cameraKey.z);
+	if (pCameraChunk == NULL)
+	{
+		// The camera is outside of the loaded chunks, so don't occlusion cull anything
+		return;
+	}
+
+	m_occlusionFrame++;
+	m_occlusionCullingValid = true;
+
+	pCameraChunk->SetVisibleFrame(m_occlusionFrame);
+
+	ChunkVisibilityStep startStep;
+	startStep.m_pChunk = pCameraChunk;
+	startStep.m_enteredFace = -1;
+	startStep.m_directions = 0;
+
+	m_vChunkVisibilitySteps.clear();
+	m_vChunkVisibilitySteps.push_back(startStep);
+
+	// Breadth first flood fill through the chunks, only leaving a chunk through a face that can be seen from the face we entered by.
+	// Never stepping back in a direction that we have already travelled stops the fill from wrapping around behind walls.
+	for (unsigned int i = 0; i < m_vChunkVisibilitySteps.size(); i++)
+	{
+		ChunkVisibilityStep step = m_vChunkVisibilitySteps[i];
+
+		for (int face = 0; face < ChunkFace_NUM; face++)
+		{
+			if (step.m_directions & (1 << Chunk::GetOppositeFace(face)))
+			{
+				continue;
+			}
+
+			if (step.m_enteredFace != -1 && step.m_pChunk->IsFaceConnected(step.m_enteredFace, face) == false)
+			{
+				continue;
+			}
+
+			Chunk* pNeighbour = GetNeighbourChunk(step.m_pChunk, face);
+			if (pNeighbour == NULL || pNeighbour->GetVisibleFrame() == m_occlusionFrame)
+			{
+				continue;
+			}
+
+			if (IsChunkInFrustum(pNeighbour, pFrustum) == false)
+			{
+				continue;
+			}
+
+			pNeighbour->SetVisibleFrame(m_occlusionFrame);
+
+			ChunkVisibilityStep nextStep;
+			nextStep.m_pChunk = pNeighbour;
+			nextStep.m_enteredFace = Chunk::GetOppositeFace(face);
+			nextStep.m_directions = step.m_directions | (1 << face);
+			m_vChunkVisibilitySteps.push_back(nextStep);
+		}
+	}
+}
+
+// Rendering
+void ChunkManager::Render(Frustum* pFrustum, vec3 cameraPosition, bool shadowRender)
+{
+	m_pRenderer->StartMeshRender();
+
+	// Store cull mode
+	CullMode cullMode = m_pRenderer->GetCullMode();
+
+	if (m_wireframeRender)
+	{
+		m_pRenderer->SetLineWidth(1.0f);
+		m_pRenderer->SetRenderMode(RM_WIREFRAME);
+	}
+	else
+	{
+		m_pRenderer->SetRenderMode(RM_SOLID);
+	}
+
+	int numRendered = 0;
+	int numCulled = 0;
+	int numOccluded = 0;
+
+	// Hold on to the render list while we are drawing, so that none of its chunks can be deleted
+	shared_ptr<ChunkRenderList> pRenderList = GetRenderList();
+
+	m_pRenderer->PushMatrix();
+		for (unsigned int i = 0; pRenderList != NULL && i < pRenderList->m_vpChunks.size(); i++)
+		{
+			Chunk* pChunk = pRenderList->m_vpChunks[i];
+
+			if (pChunk != NULL && pChunk->IsCreated())
+			{
+				// Chunks that change level are rebuilt, until then they keep rendering their old mesh
+				if (shadowRender == false)
+				{
+					pChunk->SetLODLevel(GetChunkLODLevel(length(pChunk->GetCenter() - cameraPosition), pChunk->GetLODLevel()));
+				}
+
+				// The light can see chunks that the camera can't, so the shadow render only uses the frustum
+				if (shadowRender == false && IsChunkOccluded(pChunk))
+				{
+					numOccluded++;
+				}
+				else if (IsChunkInFrustum(pChunk, pFrustum))
+				{
+					pChunk->Render();
+					numRendered++;
+				}
+				else
+				{
+					numCulled++;
+				}
+			}
+		}
+	m_pRenderer->PopMatrix();
+
+	// Restore cull mode
+	m_pRenderer->SetCullMode(cullMode);
+
+	m_pRenderer->EndMeshRender();
+
+	if (shadowRender)
+	{
+		m_numShadowChunksRendered = numRendered;
+		m_numShadowChunksCulled = numCulled;
+	}
+	else
+	{
+		m_numChunksRendered = numRendered;
+		m_numChunksCulled = numCulled;
+		m_numChunksOccluded = numOccluded;
+	}
+}
+
+void ChunkManager::RenderDebug(Frustum* pFrustum)
+{
+	m_pRenderer->SetRenderMode(RM_SOLID);
+
+	shared_ptr<ChunkRenderList> pRenderList = GetRenderList();
+	for (unsigned int i = 0; pRenderList != NULL && i < pRenderList->m_vpChunks.size(); i++)
+	{
+		Chunk* pChunk = pRenderList->m_vpChunks[i];
+
+		if (pChunk != NULL && pChunk->IsCreated() && IsChunkOccluded(pChunk) == false && IsChunkInFrustum(pChunk, pFrustum))
+		{
+			pChunk->RenderDebug();
+		}
+	}
+}
+
+void ChunkManager::Render2D(Camera* pCamera, unsigned int viewport, unsigned int font, Frustum* pFrustum)
+{
+	shared_ptr<ChunkRenderList> pRenderList = GetRenderList();
+	for (unsigned int i = 0; pRenderList != NULL && i < pRenderList->m_vpChunks.size(); i++)
+	{
+		Chunk* pChunk = pRenderList->m_vpChunks[i];
+
+		if (pChunk != NULL && pChunk->IsCreated() && IsChunkInFrustum(pChunk, pFrustum))
+		{
+			pChunk->Render2D(pCamera, viewport, font);
+		}
+	}
+}
+
+// Render list
+shared_ptr<ChunkRenderList> ChunkManager::GetRenderList()
+{
+	return atomic_load(&m_pRenderList);
+}
+
+// Meshes can only be deleted on the render thread
+void ChunkManager::ReleaseMesh(OpenGLTriangleMesh* pMesh)
 {
+	m_releasedMeshesLock.lock();
+	m_vpReleasedMeshes.push_back(pMesh);
+	m_releasedMeshesLock.unlock();
 }
 
-void ChunkManager::_UpdatingChunksThread(void* pData)
+// Render counters
+void ChunkManager::GetRenderCounters(int* numRendered, int* numCulled, int* numOccluded, int* numShadowRendered, int* numShadowCulled)
 {
-	ChunkManager* lpChunkManager = (ChunkManager*)pData;
-	lpChunkManager->UpdatingChunksThread();
+	*numRendered = m_numChunksRendered;
+	*numCulled = m_numChunksCulled;
+	*numOccluded = m_numChunksOccluded;
+	*numShadowRendered = m_numShadowChunksRendered;
+	*numShadowCulled = m_numShadowChunksCulled;
 }
 
-void ChunkManager::UpdatingChunksThread()
+// Private methods
+bool ChunkManager::IsChunkInFrustum(Chunk* pChunk, Frustum* pFrustum)
+{
+	if (pFrustum == NULL)
+	{
+		return true;
+	}
+
+	// Test the chunk's bounding box, CHUNK_RADIUS is slightly smaller than the box corners so it can't be used to reject
+	return pFrustum->CubeInFrustum(pChunk->GetCenter(), Chunk::CHUNK_SIZE_X * Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE_Y * Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE_Z * Chunk::BLOCK_RENDER_SIZE) != Frustum::FRUSTUM_OUTSIDE;
+}
+
+bool ChunkManager::IsChunkOccluded(Chunk* pChunk)
+{
+	if (m_occlusionCullingValid == false)
+	{
+		return false;
+	}
+
+	return pChunk->GetVisibleFrame() != m_occlusionFrame;
+}
+
+Chunk* ChunkManager::GetNeighbourChunk(Chunk* pChunk, int face)
+{
+	ChunkCoordKeys coordKeys;
+	coordKeys.x = pChunk->GetGridX();
+	coordKeys.y = pChunk->GetGridY();
+	coordKeys.z = pChunk->GetGridZ();
+
+	ChunkCoordKeys neighbourKeys = GetNeighbourCoordKeys(coordKeys, face);
+
+	return GetChunk(neighbourKeys.x, neighbourKeys.y, neighbourKeys.z);
+}
+
+ChunkCoordKeys ChunkManager::GetNeighbourCoordKeys(const ChunkCoordKeys& chunkCoordKeys, int face)
+{
+	ChunkCoordKeys coordKeys = chunkCoordKeys;
+
+	switch (face)
+	{
+	case ChunkFace_Front: { coordKeys.z++; } break;
+	case ChunkFace_Back: { coordKeys.z--; } break;
+	case ChunkFace_Right: { coordKeys.x++; } break;
+	case ChunkFace_Left: { coordKeys.x--; } break;
+	case ChunkFace_Top: { coordKeys.y++; } break;
+	case ChunkFace_Bottom: { coordKeys.y--; } break;
+	}
+
+	return coordKeys;
+}
+
+int ChunkManager::GetChunkIndexSize(float loaderRadius, float unloaderRadius)
+{
+	// Loaded chunks can be up to the unloader radius from the prefetch position, which is up to half the loader radius ahead of the player.
+	// The index is the same size on every axis, so it is sized for the shortest chunk side.
+	int minChunkSize = (Chunk::CHUNK_SIZE_X < Chunk::CHUNK_SIZE_Y) ? Chunk::CHUNK_SIZE_X : Chunk::CHUNK_SIZE_Y;
+	minChunkSize = (minChunkSize < Chunk::CHUNK_SIZE_Z) ? minChunkSize : Chunk::CHUNK_SIZE_Z;
+	float chunkLength = minChunkSize * Chunk::BLOCK_RENDER_SIZE * 2.0f;
+	int maxChunkDistance = (int)ceil((unloaderRadius + loaderRadius * 0.5f) / chunkLength);
+
+	return (maxChunkDistance + 1) * 2;
+}
+
+void ChunkManager::ResizeChunkIndex()
 {
-	while (m_updateThreadActive)
+	// The chunk index needs to be big enough to give every loaded chunk its own slot, the chunk map lock must be held
+	int indexSize = GetChunkIndexSize(m_loaderRadius, m_unloaderRadius);
+	ChunkIndex* pOldChunkIndex = m_pChunkIndex.load(memory_order_relaxed);
+	if (indexSize <= pOldChunkIndex->GetSize() && indexSize >= pOldChunkIndex->GetSize() / 2)
+	{
+		m_chunkIndexResizePending = false;
+		return;
+	}
+
+	ChunkIndex* pChunkIndex = new ChunkIndex(indexSize);
+	for (map<ChunkCoordKeys, Chunk*>::iterator it = m_chunksMap.begin(); it != m_chunksMap.end(); ++it)
 	{
-		while (m_pPlayer == NULL)
+		if (pChunkIndex->AddChunk(it->second) == false)
 		{
-#ifdef _WIN32
-			Sleep(100);
-#else
-			usleep(100000);
-#endif
+			// A smaller index only fits once the chunks outside of the new radius are unloaded, check them again and retry after
+			delete pChunkIndex;
+			m_numUnloadChecksRemaining = (int)m_chunksMap.size();
+			return;
 		}
+	}
+
+	m_pChunkIndex.store(pChunkIndex, memory_order_release);
+	m_vpRetiredChunkIndices.push_back(pOldChunkIndex);
+	m_chunkIndexResizePending = false;
+}
+
+int ChunkManager::GetChunkLODLevel(float distance, int currentLODLevel)
+{
+	if (m_pVoxSettings->m_chunkLOD == false)
+	{
+		return 0;
+	}
+
+	float lodDistances[Chunk::MAX_LOD_LEVEL] = { m_pVoxSettings->m_chunkLOD1Distance, m_pVoxSettings->m_chunkLOD2Distance, m_pVoxSettings->m_chunkLOD3Distance };
 
-		while (m_stepLockEnabled == true && m_updateStepLock == true)
+	// Chunks have to move LOD_HYSTERESIS past a band to change level, so a chunk on the edge of a band isn't rebuilt every time the camera moves
+	int lodLevel = 0;
+	for (int i = 0; i < Chunk::MAX_LOD_LEVEL; i++)
+	{
+		float bandDistance = lodDistances[i] + ((i < currentLODLevel) ? -LOD_HYSTERESIS : LOD_HYSTERESIS);
+		if (distance > bandDistance)
 		{
-#ifdef _WIN32
-			Sleep(100);
-#else
-			usleep(100000);
-#endif
+			lodLevel = i + 1;
 		}
+	}
 
-		ChunkList updateChunkList;
-		ChunkCoordKeysList addChunkList;
-		ChunkList rebuildChunkList;
-		ChunkList unloadChunkList;
+	return lodLevel;
+}
 
-		m_ChunkMapMutexLock.lock();
-		typedef map<ChunkCoordKeys, Chunk*>::iterator it_type;
-		for (it_type iterator = m_chunksMap.begin(); iterator != m_chunksMap.end(); iterator++)
-		{
-			Chunk* pChunk = iterator->second;
+vec3 ChunkManager::GetChunkCenter(const ChunkCoordKeys& coordKeys)
+{
+	float xPos = coordKeys.x * Chunk::CHUNK_SIZE_X * Chunk::BLOCK_RENDER_SIZE*2.0f;
+	float yPos = coordKeys.y * Chunk::CHUNK_SIZE_Y * Chunk::BLOCK_RENDER_SIZE*2.0f;
+	float zPos = coordKeys.z * Chunk::CHUNK_SIZE_Z * Chunk::BLOCK_RENDER_SIZE*2.0f;
 
-			updateChunkList.push_back(pChunk);
-		}
-		m_ChunkMapMutexLock.unlock();
+	return vec3(xPos, yPos, zPos) + vec3(Chunk::CHUNK_SIZE_X*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE_Y*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE_Z*Chunk::BLOCK_RENDER_SIZE);
+}
 
-		// Updating chunks
-		int numAddedChunks = 0;
-		int MAX_NUM_CHUNKS_ADD = 10;
-		sort(updateChunkList.begin(), updateChunkList.end(), Chunk::ClosestToCamera);
-		for (unsigned int i = 0; i < (int)updateChunkList.size(); i++)
-		{
-			Chunk* pChunk = updateChunkList[i];
+// Render list
+void ChunkManager::PublishRenderList()
+{
+	m_renderListDirty = false;
 
-			if (pChunk != NULL)
-			{
-				pChunk->Update(0.01f);
+	shared_ptr<ChunkRenderList> pRenderList = make_shared<ChunkRenderList>();
 
-				int gridX = pChunk->GetGridX();
-				int gridY = pChunk->GetGridY();
-				int gridZ = pChunk->GetGridZ();
+	m_ChunkMapMutexLock.lock();
+	pRenderList->m_vpChunks.reserve(m_chunksMap.size());
+	for (map<ChunkCoordKeys, Chunk*>::iterator it = m_chunksMap.begin(); it != m_chunksMap.end(); ++it)
+	{
+		pRenderList->m_vpChunks.push_back(it->second);
+	}
+	m_ChunkMapMutexLock.unlock();
 
-				float xPos = gridX * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-				float yPos = gridY * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-				float zPos = gridZ * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
+	// The previous list keeps this one alive, so chunks retired while the previous list was current stay alive while any frame uses it
+	shared_ptr<ChunkRenderList> pPreviousRenderList = atomic_load(&m_pRenderList);
+	if (pPreviousRenderList != NULL)
+	{
+		pPreviousRenderList->m_pNextRenderList = pRenderList;
+	}
 
-				vec3 chunkCenter = vec3(xPos, yPos, zPos) + vec3(Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE);
-				vec3 distanceVec = chunkCenter - m_pPlayer->GetCenter();
-				float lengthValue = length(distanceVec);
+	atomic_store(&m_pRenderList, pRenderList);
+}
 
-				if (lengthValue > m_loaderRadius)
-				{
-					unloadChunkList.push_back(pChunk);
-				}
-				else
-				{
-					if (numAddedChunks < MAX_NUM_CHUNKS_ADD)
-					{
-						// Check neighbours
-						if (pChunk->GetNumNeighbours() < 6 && (pChunk->IsEmpty() == false) || (gridY == 0))
-						{
-							if (pChunk->GetxMinus() == NULL)
-							{
-								ChunkCoordKeys coordKey;
-								coordKey.x = gridX - 1;
-								coordKey.y = gridY;
-								coordKey.z = gridZ;
-								float xPos = coordKey.x * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float yPos = coordKey.y * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float zPos = coordKey.z * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-
-								vec3 chunkCenter = vec3(xPos, yPos, zPos) + vec3(Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE);
-								vec3 distanceVec = chunkCenter - m_pPlayer->GetCenter();
-								float lengthValue = length(distanceVec);
-
-								if (lengthValue <= m_loaderRadius)
-								{
-									addChunkList.push_back(coordKey);
-									numAddedChunks++;
-								}
-							}
-							if (pChunk->GetxPlus() == NULL)
-							{
-								ChunkCoordKeys coordKey;
-								coordKey.x = gridX + 1;
-								coordKey.y = gridY;
-								coordKey.z = gridZ;
-								float xPos = coordKey.x * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float yPos = coordKey.y * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float zPos = coordKey.z * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-
-								vec3 chunkCenter = vec3(xPos, yPos, zPos) + vec3(Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE);
-								vec3 distanceVec = chunkCenter - m_pPlayer->GetCenter();
-								float lengthValue = length(distanceVec);
-
-								if (lengthValue <= m_loaderRadius)
-								{
-									addChunkList.push_back(coordKey);
-									numAddedChunks++;
-								}
-							}
-							if (pChunk->GetyMinus() == NULL)
-							{
-								ChunkCoordKeys coordKey;
-								coordKey.x = gridX;
-								coordKey.y = gridY - 1;
-								coordKey.z = gridZ;
-								float xPos = coordKey.x * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float yPos = coordKey.y * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float zPos = coordKey.z * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-
-								vec3 chunkCenter = vec3(xPos, yPos, zPos) + vec3(Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE);
-								vec3 distanceVec = chunkCenter - m_pPlayer->GetCenter();
-								float lengthValue = length(distanceVec);
-
-								if (lengthValue <= m_loaderRadius)
-								{
-									addChunkList.push_back(coordKey);
-									numAddedChunks++;
-								}
-							}
-							if (pChunk->GetyPlus() == NULL)
-							{
-								ChunkCoordKeys coordKey;
-								coordKey.x = gridX;
-								coordKey.y = gridY + 1;
-								coordKey.z = gridZ;
-								float xPos = coordKey.x * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float yPos = coordKey.y * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float zPos = coordKey.z * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-
-								vec3 chunkCenter = vec3(xPos, yPos, zPos) + vec3(Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE);
-								vec3 distanceVec = chunkCenter - m_pPlayer->GetCenter();
-								float lengthValue = length(distanceVec);
-
-								if (lengthValue <= m_loaderRadius)
-								{
-									addChunkList.push_back(coordKey);
-									numAddedChunks++;
-								}
-							}
-							if (pChunk->GetzMinus() == NULL)
-							{
-								ChunkCoordKeys coordKey;
-								coordKey.x = gridX;
-								coordKey.y = gridY;
-								coordKey.z = gridZ - 1;
-								float xPos = coordKey.x * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float yPos = coordKey.y * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float zPos = coordKey.z * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-
-								vec3 chunkCenter = vec3(xPos, yPos, zPos) + vec3(Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE);
-								vec3 distanceVec = chunkCenter - m_pPlayer->GetCenter();
-								float lengthValue = length(distanceVec);
-
-								if (lengthValue <= m_loaderRadius)
-								{
-									addChunkList.push_back(coordKey);
-									numAddedChunks++;
-								}
-							}
-							if (pChunk->GetzPlus() == NULL)
-							{
-								ChunkCoordKeys coordKey;
-								coordKey.x = gridX;
-								coordKey.y = gridY;
-								coordKey.z = gridZ + 1;
-								float xPos = coordKey.x * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float yPos = coordKey.y * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-								float zPos = coordKey.z * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-
-								vec3 chunkCenter = vec3(xPos, yPos, zPos) + vec3(Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE, Chunk::CHUNK_SIZE*Chunk::BLOCK_RENDER_SIZE);
-								vec3 distanceVec = chunkCenter - m_pPlayer->GetCenter();
-								float lengthValue = length(distanceVec);
-
-								if (lengthValue <= m_loaderRadius)
-								{
-									addChunkList.push_back(coordKey);
-									numAddedChunks++;
-								}
-							}
-						}
-					}
-				}
-			}
-		}
-		updateChunkList.clear();
+// Chunk streaming scheduler
+void ChunkManager::UpdateStreamingPlayer(float dt)
+{
+	// Track the player on the main thread
+	if (m_pPlayer == NULL)
+	{
+		return;
+	}
 
-		// Adding chunks
-		for (unsigned int i = 0; i < (int)addChunkList.size(); i++)
-		{
-			ChunkCoordKeys coordKey = addChunkList[i];
-			Chunk* pChunk = GetChunk(coordKey.x, coordKey.y, coordKey.z);
+	SetStreamingPosition(m_pPlayer->GetCenter(), m_pPlayer->GetForwardVector(), dt);
+}
 
-			if (pChunk == NULL)
-			{
-				CreateNewChunk(coordKey.x, coordKey.y, coordKey.z);
-			}
-			else
-			{
-				UpdateChunkNeighbours(pChunk, coordKey.x, coordKey.y, coordKey.z);
-			}
+void ChunkManager::SetStreamingPosition(vec3 playerCenter, vec3 forward, float dt)
+{
+	// Wake the updating thread when the player moves into a new chunk or turns
+	if (dt > 0.0f)
+	{
+		vec3 velocity = (playerCenter - m_lastPlayerCenter) / dt;
+		if (length(velocity) > MAX_PREFETCH_SPEED)
+		{
+			// Teleported
+			velocity = vec3(0.0f, 0.0f, 0.0f);
 		}
-		addChunkList.clear();
 
-		// Unloading chunks
-		for (unsigned int i = 0; i < (int)unloadChunkList.size(); i++)
-		{
-			Chunk* pChunk = unloadChunkList[i];
+		m_playerVelocity += (velocity - m_playerVelocity) * 0.2f;
+	}
+	m_lastPlayerCenter = playerCenter;
 
-			UnloadChunk(pChunk);
-		}
-		unloadChunkList.clear();
+	// Prefetch the chunks that the player is heading towards
+	vec3 prefetchOffset = m_playerVelocity * PREFETCH_SECONDS;
+	float maxPrefetchDistance = m_loaderRadius * 0.5f;
+	if (length(prefetchOffset) > maxPrefetchDistance)
+	{
+		prefetchOffset = normalize(prefetchOffset) * maxPrefetchDistance;
+	}
+	vec3 prefetchCenter = playerCenter + prefetchOffset;
+
+	if (length(forward) > 0.0f)
+	{
+		forward = normalize(forward);
+	}
+
+	ChunkCoordKeys grid;
+	ChunkCoordKeys prefetchGrid;
+	GetGridFromPosition(playerCenter, &grid.x, &grid.y, &grid.z);
+	GetGridFromPosition(prefetchCenter, &prefetchGrid.x, &prefetchGrid.y, &prefetchGrid.z);
 
-		// Check for rebuild chunks
+	m_updateThreadLock.lock();
+	m_streamingPlayerCenter = playerCenter;
+	m_streamingPrefetchCenter = prefetchCenter;
+	m_streamingForward = forward;
+
+	if (m_streamingPlayerValid == false || !(grid == m_wakeGrid) || !(prefetchGrid == m_wakePrefetchGrid) || dot(forward, m_wakeForward) < 0.85f)
+	{
+		m_streamingPlayerValid = true;
+		m_wakeGrid = grid;
+		m_wakePrefetchGrid = prefetchGrid;
+		m_wakeForward = forward;
+
+		m_updateThreadWakeup = true;
+		m_updateThreadCondition.notify_one();
+	}
+	m_updateThreadLock.unlock();
+}
+
+bool ChunkManager::IsStreamingComplete()
+{
+	m_updateThreadLock.lock();
+	bool complete = (m_streamingPlayerValid && m_updateThreadWakeup == false && m_updateThreadIdle && m_numOutstandingChunkJobs == 0);
+	m_updateThreadLock.unlock();
+
+	return complete;
+}
+
+void ChunkManager::UpdateSchedulerPlayer()
+{
+	ChunkCoordKeys grid;
+	ChunkCoordKeys prefetchGrid;
+	GetGridFromPosition(m_schedulerPlayerCenter, &grid.x, &grid.y, &grid.z);
+	GetGridFromPosition(m_schedulerPrefetchCenter, &prefetchGrid.x, &prefetchGrid.y, &prefetchGrid.z);
+
+	// The load priorities only change when the player moves into a new chunk, or turns far enough
+	if (!(grid == m_schedulerGrid) || !(prefetchGrid == m_schedulerPrefetchGrid) || dot(m_schedulerForward, m_schedulerQueueForward) < 0.85f)
+	{
+		m_schedulerGrid = grid;
+		m_schedulerPrefetchGrid = prefetchGrid;
+		m_schedulerQueueForward = m_schedulerForward;
+
+		RebuildChunkLoadQueue();
+
+		// Every loaded chunk needs checking against the new position
 		m_ChunkMapMutexLock.lock();
-		for (it_type iterator = m_chunksMap.begin(); iterator != m_chunksMap.end(); iterator++)
-		{
-			Chunk* pChunk = iterator->second;
+		m_numUnloadChecksRemaining = (int)m_chunksMap.size();
+		m_ChunkMapMutexLock.unlock();
+	}
+
+	// Always make sure that the player's own chunk gets loaded
+	AddFrontierChunk(m_schedulerGrid);
+}
+
+void ChunkManager::ExpandChunkFrontier()
+{
+	ChunkCoordKeysList completedChunkKeys;
+	m_completedChunkKeysLock.lock();
+	completedChunkKeys.swap(m_vCompletedChunkKeys);
+	m_completedChunkKeysLock.unlock();
+
+	for (unsigned int i = 0; i < completedChunkKeys.size(); i++)
+	{
+		ChunkCoordKeys coordKeys = completedChunkKeys[i];
+		Chunk* pChunk = GetChunk(coordKeys.x, coordKeys.y, coordKeys.z);
 
-			if (pChunk != NULL)
+		if (pChunk != NULL && CanExpandFromChunk(pChunk))
+		{
+			for (int face = 0; face < ChunkFace_NUM; face++)
 			{
-				if (pChunk->NeedsRebuild())
-				{
-					rebuildChunkList.push_back(pChunk);
-				}
+				AddFrontierChunk(GetNeighbourCoordKeys(coordKeys, face));
 			}
 		}
-		m_ChunkMapMutexLock.unlock();
+	}
+}
 
-		// Rebuilding chunks
-		int numRebuildChunks = 0;
-		int MAX_NUM_CHUNKS_REBUILD = 30;
-		for (unsigned int i = 0; i < (int)rebuildChunkList.size() && numRebuildChunks < MAX_NUM_CHUNKS_REBUILD; i++)
+int ChunkManager::LoadScheduledChunks(int maxChunks)
+{
+	int numAddedChunks = 0;
+	ChunkLoadCandidateList vDeferredCandidates;
+
+	while (numAddedChunks < maxChunks && m_chunkLoadQueue.empty() == false)
+	{
+		ChunkLoadCandidate candidate = m_chunkLoadQueue.top();
+		if (candidate.m_priority > m_loaderRadius + VIEW_DIRECTION_BIAS)
 		{
-			Chunk* pChunk = rebuildChunkList[i];
+			// Everything left in the queue is outside of the loader radius
+			break;
+		}
+		m_chunkLoadQueue.pop();
 
-			pChunk->SwitchToCachedMesh();
-			pChunk->RebuildMesh();
-			pChunk->CompleteMesh();
-			pChunk->UndoCachedMesh();
+		ChunkCoordKeys coordKeys = candidate.m_coordKeys;
+		ChunkCoordKeysSet::iterator it = m_chunkFrontier.find(coordKeys);
+		if (it == m_chunkFrontier.end())
+		{
+			// Stale entry, already loaded or dropped from the frontier
+			continue;
+		}
 
-			numRebuildChunks++;
+		if (GetChunk(coordKeys.x, coordKeys.y, coordKeys.z) != NULL || (!(coordKeys == m_schedulerGrid) && CanExpandIntoChunk(coordKeys) == false))
+		{
+			m_chunkFrontier.erase(it);
+			continue;
 		}
-		rebuildChunkList.clear();
 
-		if (m_stepLockEnabled == true && m_updateStepLock == false)
+		// Wait for the chunk that wraps to the same index slot to be unloaded
+		if (GetChunkLoadDistance(coordKeys) > m_loaderRadius || m_pChunkIndex.load(memory_order_relaxed)->IsSlotFree(coordKeys.x, coordKeys.y, coordKeys.z) == false)
 		{
-			m_updateStepLock = true;
+			vDeferredCandidates.push_back(candidate);
+			continue;
 		}
 
-#ifdef _WIN32
-		Sleep(10);
-#else
-		usleep(10000);
-#endif
+		m_chunkFrontier.erase(it);
+		CreateNewChunk(coordKeys.x, coordKeys.y, coordKeys.z);
+		numAddedChunks++;
+	}
+
+	for (unsigned int i = 0; i < vDeferredCandidates.size(); i++)
+	{
+		m_chunkLoadQueue.push(vDeferredCandidates[i]);
 	}
 
-	m_updateThreadFinished = true;
+	return numAddedChunks;
 }
 
-// Rendering
-void ChunkManager::Render()
+bool ChunkManager::UnloadDistantChunks()
 {
-	m_pRenderer->StartMeshRender();
-
-	// Store cull mode
-	CullMode cullMode = m_pRenderer->GetCullMode();
+	// Only check a slice of the loaded chunks each update, so the cost doesn't grow with the number of loaded chunks
+	ChunkList unloadChunkList;
 
-	if (m_wireframeRender)
+	m_ChunkMapMutexLock.lock();
+	int numChecks = (int)m_chunksMap.size();
+	if (numChecks > m_numUnloadChecksRemaining)
 	{
-		m_pRenderer->SetLineWidth(1.0f);
-		m_pRenderer->SetRenderMode(RM_WIREFRAME);
+		numChecks = m_numUnloadChecksRemaining;
 	}
-	else
+	if (numChecks > MAX_UNLOAD_CHECKS_PER_UPDATE)
 	{
-		m_pRenderer->SetRenderMode(RM_SOLID);
+		numChecks = MAX_UNLOAD_CHECKS_PER_UPDATE;
 	}
-
-	m_pRenderer->PushMatrix();
-		m_ChunkMapMutexLock.lock();
-		typedef map<ChunkCoordKeys, Chunk*>::iterator it_type;
-		for (it_type iterator = m_chunksMap.begin(); iterator != m_chunksMap.end(); iterator++)
+	m_numUnloadChecksRemaining -= numChecks;
+	map<ChunkCoordKeys, Chunk*>::iterator it = m_chunksMap.upper_bound(m_unloadScanCoordKeys);
+	for (int i = 0; i < numChecks; i++)
+	{
+		if (it == m_chunksMap.end())
 		{
-			Chunk* pChunk = iterator->second;
+			it = m_chunksMap.begin();
+		}
 
-			if (pChunk != NULL && pChunk->IsCreated())
+		Chunk* pChunk = it->second;
+		m_unloadScanCoordKeys = it->first;
+
+		// Only unload when the player isn't heading back towards the chunk. Claiming it from ready fails if it has a job in progress.
+		// Claimed under the storage lock, so no edit is still writing to the chunk once it is unloading.
+		if (pChunk != NULL && GetChunkLoadDistance(it->first) > m_unloaderRadius)
+		{
+			lock_guard<recursive_mutex> guard(m_chunkStorageListLock);
+			if (pChunk->TransitionState(ChunkState_Ready, ChunkState_Unloading))
 			{
-				pChunk->Render();
+				unloadChunkList.push_back(pChunk);
 			}
 		}
-		m_ChunkMapMutexLock.unlock();
-	m_pRenderer->PopMatrix();
 
-	// Restore cull mode
-	m_pRenderer->SetCullMode(cullMode);
+		it++;
+	}
+	m_ChunkMapMutexLock.unlock();
 
-	m_pRenderer->EndMeshRender();
+	for (unsigned int i = 0; i < unloadChunkList.size(); i++)
+	{
+		Chunk* pChunk = unloadChunkList[i];
+
+		ChunkCoordKeys coordKeys;
+		coordKeys.x = pChunk->GetGridX();
+		coordKeys.y = pChunk->GetGridY();
+		coordKeys.z = pChunk->GetGridZ();
+
+		UnloadChunk(pChunk, true);
+
+		// Put the chunk back on the frontier, so it can be loaded again if the player comes back
+		if (CanExpandIntoChunk(coordKeys))
+		{
+			AddFrontierChunk(coordKeys);
+		}
+	}
+
+	return m_numUnloadChecksRemaining > 0;
 }
 
-void ChunkManager::RenderDebug()
+int ChunkManager::QueueRebuildChunks(int maxChunks)
 {
-	m_pRenderer->SetRenderMode(RM_SOLID);
-
-	m_ChunkMapMutexLock.lock();
-	typedef map<ChunkCoordKeys, Chunk*>::iterator it_type;
-	for (it_type iterator = m_chunksMap.begin(); iterator != m_chunksMap.end(); iterator++)
+	ChunkCoordKeysSet rebuildChunkKeys;
+	m_rebuildChunkKeysLock.lock();
+	rebuildChunkKeys.swap(m_rebuildChunkKeys);
+	m_rebuildChunkKeysLock.unlock();
+
+	int numRebuildChunks = 0;
+	ChunkCoordKeysList retryChunkKeys;
+	for (ChunkCoordKeysSet::iterator it = rebuildChunkKeys.begin(); it != rebuildChunkKeys.end(); it++)
 	{
-		Chunk* pChunk = iterator->second;
+		Chunk* pChunk = GetChunk(it->x, it->y, it->z);
+		if (pChunk == NULL || pChunk->NeedsRebuild() == false)
+		{
+			continue;
+		}
 
-		if (pChunk != NULL && pChunk->IsCreated())
+		// Claim the chunk for the rebuild, chunks that are still being set up or meshed are tried again later
+		if (numRebuildChunks >= maxChunks || pChunk->TransitionState(ChunkState_Ready, ChunkState_Rebuilding) == false)
 		{
-			pChunk->RenderDebug();
+			retryChunkKeys.push_back(*it);
+			continue;
 		}
+
+		QueueChunkJob(pChunk, ChunkJobType_Rebuild);
+
+		numRebuildChunks++;
 	}
-	m_ChunkMapMutexLock.unlock();
+
+	m_rebuildChunkKeysLock.lock();
+	m_rebuildChunkKeys.insert(retryChunkKeys.begin(), retryChunkKeys.end());
+	m_rebuildChunkKeysLock.unlock();
+
+	return numRebuildChunks;
 }
 
-void ChunkManager::Render2D(Camera* pCamera, unsigned int viewport, unsigned int font)
+void ChunkManager::RebuildChunkLoadQueue()
 {
-	m_ChunkMapMutexLock.lock();
-	typedef map<ChunkCoordKeys, Chunk*>::iterator it_type;
-	for (it_type iterator = m_chunksMap.begin(); iterator != m_chunksMap.end(); iterator++)
+	// Recalculate the priorities for the whole frontier, and drop the chunks that can't be loaded any more
+	m_chunkLoadQueue = ChunkLoadQueue();
+
+	for (ChunkCoordKeysSet::iterator it = m_chunkFrontier.begin(); it != m_chunkFrontier.end();)
+	{
+		if (GetChunk(it->x, it->y, it->z) != NULL || CanExpandIntoChunk(*it) == false)
+		{
+			m_chunkFrontier.erase(it++);
+			continue;
+		}
+
+		ChunkLoadCandidate candidate;
+		candidate.m_priority = GetChunkLoadPriority(*it);
+		candidate.m_coordKeys = *it;
+		m_chunkLoadQueue.push(candidate);
+
+		it++;
+	}
+}
+
+void ChunkManager::AddFrontierChunk(const ChunkCoordKeys& coordKeys)
+{
+	if (m_chunkFrontier.find(coordKeys) != m_chunkFrontier.end())
+	{
+		return;
+	}
+
+	if (GetChunk(coordKeys.x, coordKeys.y, coordKeys.z) != NULL)
+	{
+		return;
+	}
+
+	m_chunkFrontier.insert(coordKeys);
+
+	ChunkLoadCandidate candidate;
+	candidate.m_priority = GetChunkLoadPriority(coordKeys);
+	candidate.m_coordKeys = coordKeys;
+	m_chunkLoadQueue.push(candidate);
+}
+
+bool ChunkManager::CanExpandFromChunk(Chunk* pChunk)
+{
+	// The world grows out from chunks with blocks in them, and along the ground layer of chunks
+	return pChunk->IsCreated() && (pChunk->IsEmpty() == false || pChunk->GetGridY() == 0);
+}
+
+bool ChunkManager::CanExpandIntoChunk(const ChunkCoordKeys& coordKeys)
+{
+	for (int face = 0; face < ChunkFace_NUM; face++)
 	{
-		Chunk* pChunk = iterator->second;
+		ChunkCoordKeys neighbourKeys = GetNeighbourCoordKeys(coordKeys, face);
+		Chunk* pNeighbour = GetChunk(neighbourKeys.x, neighbourKeys.y, neighbourKeys.z);
 
-		if (pChunk != NULL && pChunk->IsCreated())
+		if (pNeighbour != NULL && CanExpandFromChunk(pNeighbour))
 		{
-			pChunk->Render2D(pCamera, viewport, font);
+			return true;
 		}
 	}
-	m_ChunkMapMutexLock.unlock();
+
+	return false;
+}
+
+float ChunkManager::GetChunkLoadDistance(const ChunkCoordKeys& coordKeys)
+{
+	// Distance to the player, or to where the player is heading if that is closer
+	vec3 chunkCenter = GetChunkCenter(coordKeys);
+
+	float playerDistance = length(chunkCenter - m_schedulerPlayerCenter);
+	float prefetchDistance = length(chunkCenter - m_schedulerPrefetchCenter);
+
+	return (playerDistance < prefetchDistance) ? playerDistance : prefetchDistance;
+}
+
+float ChunkManager::GetChunkLoadPriority(const ChunkCoordKeys& coordKeys)
+{
+	// Chunks behind the player get loaded as if they were up to VIEW_DIRECTION_BIAS further away
+	vec3 toChunk = GetChunkCenter(coordKeys) - m_schedulerPlayerCenter;
+	float facing = 1.0f;
+	if (length(toChunk) > 0.0f)
+	{
+		facing = dot(normalize(toChunk), m_schedulerForward);
+	}
+
+	return GetChunkLoadDistance(coordKeys) + VIEW_DIRECTION_BIAS * (1.0f - facing) * 0.5f;
 }
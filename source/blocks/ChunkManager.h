@@ -20,8 +20,19 @@
 #include "../models/QubicleBinary.h"
 
 #include "Chunk.h"
+#include "RegionFile.h"
+#include "ChunkIndex.h"
+#include "ChunkMeshQueue.h"
+#include "HeightmapCache.h"
+#include "ChunkCache.h"
 
 #include <map>
+#include <list>
+#include <unordered_map>
+#include <set>
+#include <deque>
+#include <queue>
+#include <memory>
 using namespace std;
 
 #include "../tinythread/tinythread.h"
@@ -31,6 +42,8 @@ class Player;
 class SceneryManager;
 class VoxSettings;
 class QubicleBinaryManager;
+class Prefab;
+class PrefabManager;
 
 struct ChunkCoordKeys {
 	int x;
@@ -55,6 +68,14 @@ inline bool const operator<(const ChunkCoordKeys& l, const ChunkCoordKeys& r) {
 	return false;
 };
 
+struct ChunkCoordKeysHash
+{
+	size_t operator()(const ChunkCoordKeys& keys) const
+	{
+		return ((unsigned int)keys.x * 73856093u) ^ ((unsigned int)keys.y * 19349663u) ^ ((unsigned int)keys.z * 83492791u);
+	}
+};
+
 typedef std::vector<Chunk*> ChunkList;
 typedef std::vector<ChunkCoordKeys> ChunkCoordKeysList;
 
@@ -76,6 +97,15 @@ enum QubicleImportDirection
 };
 
 
+// A block that was set in a chunk before the chunk was loaded, the index is x + y * CHUNK_SIZE_X + z * CHUNK_SIZE_XY
+struct ChunkStorageBlock
+{
+	int m_index;
+	unsigned int m_colour;
+};
+
+typedef std::vector<ChunkStorageBlock> ChunkStorageBlockList;
+
 class ChunkStorageLoader
 {
 public:
@@ -85,8 +115,8 @@ public:
 
 	vec3 m_position;
 
-	bool m_blockSet[Chunk::CHUNK_SIZE][Chunk::CHUNK_SIZE][Chunk::CHUNK_SIZE];
-	unsigned int m_colour[Chunk::CHUNK_SIZE][Chunk::CHUNK_SIZE][Chunk::CHUNK_SIZE];
+	// Only the blocks that have been set are stored, in the order they were set
+	ChunkStorageBlockList m_vBlocks;
 
 	ChunkStorageLoader(int x, int y, int z)
 	{
@@ -94,34 +124,132 @@ public:
 		m_gridY = y;
 		m_gridZ = z;
 
-		float xPos = x * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-		float yPos = y * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
-		float zPos = z * Chunk::CHUNK_SIZE * Chunk::BLOCK_RENDER_SIZE*2.0f;
+		float xPos = x * Chunk::CHUNK_SIZE_X * Chunk::BLOCK_RENDER_SIZE*2.0f;
+		float yPos = y * Chunk::CHUNK_SIZE_Y * Chunk::BLOCK_RENDER_SIZE*2.0f;
+		float zPos = z * Chunk::CHUNK_SIZE_Z * Chunk::BLOCK_RENDER_SIZE*2.0f;
 
 		m_position = vec3(xPos, yPos, zPos);
+	}
 
-		// Reset initial arrays
-		for (int x = 0; x < Chunk::CHUNK_SIZE; x++)
+	void SetBlockColour(int x, int y, int z, unsigned int colour)
+	{
+		ChunkStorageBlock block;
+		block.m_index = x + y * Chunk::CHUNK_SIZE_X + z * Chunk::CHUNK_SIZE_XY;
+		block.m_colour = colour;
+		m_vBlocks.push_back(block);
+	}
+
+	// Sets a run of blocks along x
+	void SetBlockColours(int x, int y, int z, int length, const unsigned int* pColours)
+	{
+		int index = x + y * Chunk::CHUNK_SIZE_X + z * Chunk::CHUNK_SIZE_XY;
+		m_vBlocks.reserve(m_vBlocks.size() + length);
+		for (int i = 0; i < length; i++)
 		{
-			for (int y = 0; y < Chunk::CHUNK_SIZE; y++)
-			{
-				for (int z = 0; z < Chunk::CHUNK_SIZE; z++)
-				{
-					m_blockSet[x][y][z] = false;
-					m_colour[x][y][z] = 0;
-				}
-			}
+			ChunkStorageBlock block;
+			block.m_index = index + i;
+			block.m_colour = pColours[i];
+			m_vBlocks.push_back(block);
 		}
 	}
 
-	void SetBlockColour(int x, int y, int z, unsigned int colour)
+	// Writes the stored blocks into a chunk sized colour array, later blocks replace earlier ones at the same index
+	void ApplyBlocks(unsigned int* pColours) const
 	{
-		m_blockSet[x][y][z] = true;
-		m_colour[x][y][z] = colour;
+		for (unsigned int i = 0; i < m_vBlocks.size(); i++)
+		{
+			pColours[m_vBlocks[i].m_index] = m_vBlocks[i].m_colour;
+		}
 	}
 };
 
-typedef std::vector<ChunkStorageLoader*> ChunkStorageLoaderList;
+typedef std::unordered_map<ChunkCoordKeys, ChunkStorageLoader*, ChunkCoordKeysHash> ChunkStorageLoaderMap;
+typedef std::unordered_map<ChunkCoordKeys, ChunkStorageBlockList, ChunkCoordKeysHash> ChunkStorageBlockListMap;
+
+// A single block edit in world space, a colour with zero alpha removes the block
+struct ChunkBlockEdit
+{
+	vec3 m_position;
+	unsigned int m_colour;
+};
+
+typedef std::vector<ChunkBlockEdit> ChunkBlockEditList;
+
+// The block that a raycast hit, the normal is the face of the block that the ray entered through
+struct ChunkRaycastHit
+{
+	Chunk* m_pChunk;
+	int m_blockX;
+	int m_blockY;
+	int m_blockZ;
+	vec3 m_blockPosition;
+	vec3 m_normal;
+	float m_distance;
+};
+
+
+enum ChunkJobType
+{
+	ChunkJobType_Setup = 0,
+	ChunkJobType_Rebuild,
+};
+
+struct ChunkJob
+{
+	Chunk* m_pChunk;
+	ChunkJobType m_jobType;
+};
+
+// An immutable list of the loaded chunks, published by the updating thread for the render thread to use without locking.
+// Each list keeps the lists published after it alive, so once a list has expired no frame can be using it, or any older list.
+struct ChunkRenderList
+{
+	ChunkList m_vpChunks;
+	shared_ptr<ChunkRenderList> m_pNextRenderList;
+};
+
+struct RetiredChunk
+{
+	Chunk* m_pChunk;
+	unsigned int m_jobSerial;
+	weak_ptr<ChunkRenderList> m_pRenderList;
+};
+
+// A step of the occlusion culling flood fill, the chunk and the face that we entered it through
+struct ChunkVisibilityStep
+{
+	Chunk* m_pChunk;
+	int m_enteredFace;
+	int m_directions;
+};
+
+// A missing chunk that the streaming scheduler can load, lower priority values are loaded first
+struct ChunkLoadCandidate
+{
+	float m_priority;
+	ChunkCoordKeys m_coordKeys;
+};
+
+struct ChunkLoadCandidateCompare
+{
+	bool operator()(const ChunkLoadCandidate& lhs, const ChunkLoadCandidate& rhs) const
+	{
+		return lhs.m_priority > rhs.m_priority;
+	}
+};
+
+typedef std::deque<ChunkJob> ChunkJobQueue;
+typedef std::vector<RetiredChunk> RetiredChunkList;
+typedef std::vector<thread*> ThreadList;
+typedef std::pair<ChunkCoordKeys, shared_ptr<RegionFile> > RegionFileEntry;
+typedef std::list<RegionFileEntry> RegionFileList;
+typedef std::map<ChunkCoordKeys, RegionFileList::iterator> RegionFileMap;
+typedef std::vector<ChunkVisibilityStep> ChunkVisibilityStepList;
+typedef std::vector<ChunkIndex*> ChunkIndexList;
+typedef std::vector<OpenGLTriangleMesh*> ChunkMeshList;
+typedef std::set<ChunkCoordKeys> ChunkCoordKeysSet;
+typedef std::vector<ChunkLoadCandidate> ChunkLoadCandidateList;
+typedef std::priority_queue<ChunkLoadCandidate, ChunkLoadCandidateList, ChunkLoadCandidateCompare> ChunkLoadQueue;
 
 
 class ChunkManager
@@ -143,9 +271,10 @@ public:
 	// Chunk rendering material
 	unsigned int GetChunkMaterialID();
 
-	// Loader radius
+	// Loader radius, chunks are unloaded a little further out than they are loaded
 	void SetLoaderRadius(float radius);
 	float GetLoaderRadius();
+	float GetUnloaderRadius();
 
 	// Step update
 	void SetStepLockEnabled(bool enabled);
@@ -153,47 +282,158 @@ public:
 
 	// Chunk Creation
 	void CreateNewChunk(int x, int y, int z);
-	void UnloadChunk(Chunk* pChunk);
+	// The chunk must already be in the unloading state, hasBlocks is false if it was never set up
+	void UnloadChunk(Chunk* pChunk, bool hasBlocks);
 	void UpdateChunkNeighbours(Chunk* pChunk, int x, int y, int z);
 
+	// Rebuilding chunks
+	void AddRebuildChunk(int x, int y, int z);
+
+	// Chunk jobs
+	int GetNumWorkerThreads();
+	void QueueChunkJob(Chunk* pChunk, ChunkJobType jobType);
+	int GetNumQueuedChunkJobs();
+	void DeleteRetiredChunks();
+
 	// Getting chunk and positional information
 	void GetGridFromPosition(vec3 position, int* gridX, int* gridY, int* gridZ);
 	Chunk* GetChunkFromPosition(float posX, float posY, float posZ);
 	Chunk* GetChunk(int aX, int aY, int aZ);
 
+	// World block co-ordinates
+	static void GetBlockFromPosition(vec3 position, int* blockX, int* blockY, int* blockZ);
+	static int GetGridFromBlock(int block, int chunkSize);
+
 	// Getting the active block state given a position and chunk information
 	bool GetBlockActiveFrom3DPosition(float x, float y, float z, vec3 *blockPos, int* blockX, int* blockY, int* blockZ, Chunk** pChunk);
 	void GetBlockGridFrom3DPositionChunkStorage(float x, float y, float z, int* blockX, int* blockY, int* blockZ, ChunkStorageLoader* ChunkStorage);
 
+	// Raycasting, walks the ray block by block and returns the first active block (the direction must be normalized)
+	bool Raycast(vec3 origin, vec3 direction, float maxDistance, ChunkRaycastHit* pHit);
+	bool HasLineOfSight(vec3 from, vec3 to);
+
 	// Adding to chunk storage for parts of the world generation that are outside of loaded chunks
 	ChunkStorageLoader* GetChunkStorage(int aX, int aY, int aZ, bool CreateIfNotExist);
+	ChunkStorageLoader* TakeChunkStorage(int aX, int aY, int aZ);
 	void RemoveChunkStorageLoader(ChunkStorageLoader* pChunkStorage);
 
-	// Importing into the world chunks
+	// Moves a generating chunk to generated, applying the blocks that were stored for it while it was generating
+	void ApplyLateChunkStorage(Chunk* pChunk);
+
+	// Blocks left in storage for chunks that are already setup, these are never applied so it should always be 0
+	int GetNumStrandedStorageBlocks();
+
+	// Region files, for saving and loading chunks. Only the most recently used ones are kept open,
+	// the returned file stays open for as long as the caller holds on to it.
+	shared_ptr<RegionFile> GetRegionFile(int gridX, int gridY, int gridZ, int* localX, int* localY, int* localZ);
+
+	// Compressed blocks of recently unloaded chunks
+	void CacheChunk(int gridX, int gridY, int gridZ, const unsigned int* pColours);
+	bool RestoreCachedChunk(int gridX, int gridY, int gridZ, unsigned int* pColours);
+	void GetChunkCacheStatistics(int* numChunks, unsigned int* numBytes, int* numHits, int* numMisses, int* numEvictions);
+
+	// Terrain generation heightmap, shared by all of the chunks in a column
+	shared_ptr<HeightmapTile> GetHeightmapTile(int gridX, int gridZ);
+	void GetHeightmapCacheStatistics(int* numTiles, int* numHits, int* numMisses);
+
+	// Chunk setup timings
+	void AddChunkSetupTime(bool loadedFromFile, double seconds);
+	void GetChunkSetupTimings(int* numGenerated, float* averageGenerateTime, int* numLoaded, float* averageLoadTime);
+
+	// Importing into the world chunks, the models are compiled and stamped as prefabs
 	void ImportQubicleBinaryMatrix(QubicleMatrix* pMatrix, vec3 position, QubicleImportDirection direction);
 	QubicleBinary* ImportQubicleBinary(QubicleBinary* qubicleBinaryFile, vec3 position, QubicleImportDirection direction);
 	QubicleBinary* ImportQubicleBinary(const char* filename, vec3 position, QubicleImportDirection direction);
 
+	// Editing blocks in world space, the edits are grouped per chunk so that each changed chunk is only rebuilt once
+	void SetBlocksInBox(vec3 minPosition, vec3 maxPosition, unsigned int colour);
+	void SetBlocksInSphere(vec3 center, float radius, unsigned int colour);
+	void SetBlocks(const ChunkBlockEditList& vEdits);
+
+	// Prefabs, compiled models that are stamped into the world during generation and for imports.
+	// Blocks that land in pGeneratingChunk are written to pGeneratingColours, the chunk's generation buffer.
+	Prefab* GetPrefab(const char* filename, QubicleImportDirection direction);
+	void StampPrefab(Prefab* pPrefab, vec3 position, Chunk* pGeneratingChunk, unsigned int* pGeneratingColours);
+
 	// Rendering modes
 	void SetWireframeRender(bool wireframe);
 	void SetFaceMerging(bool faceMerge);
 	bool GetFaceMerging();
+	void SetBakedAO(bool bakedAO);
+	bool GetBakedAO();
 
 	// Updating
 	void Update(float dt);
+	void UploadChunkMeshes();
+	int GetNumPendingMeshUploads();
+	int GetNumMeshesCompleted();
+	void WakeUpdatingChunksThread();
 	static void _UpdatingChunksThread(void* pData);
 	void UpdatingChunksThread();
+	static void _ChunkWorkerThread(void* pData);
+	void ChunkWorkerThread();
 
-	// Rendering
-	void Render();
-	void RenderDebug();
-	void Render2D(Camera* pCamera, unsigned int viewport, unsigned int font);
+	// Streaming position, set from the player in Update(), or directly when there is no player (e.g. the benchmark)
+	void SetStreamingPosition(vec3 playerCenter, vec3 forward, float dt);
+
+	// True once every chunk around the streaming position is loaded and meshed, and there is nothing left to rebuild
+	bool IsStreamingComplete();
+
+	// Occlusion culling, finds the chunks that can be seen from the camera's chunk
+	void UpdateOcclusionCulling(vec3 cameraPosition, Frustum* pFrustum);
+
+	// Rendering, chunks outside of pFrustum are culled (NULL renders every chunk).
+	// The camera render also picks each chunk's level of detail from its distance to cameraPosition.
+	void Render(Frustum* pFrustum, vec3 cameraPosition, bool shadowRender);
+	void RenderDebug(Frustum* pFrustum);
+	void Render2D(Camera* pCamera, unsigned int viewport, unsigned int font, Frustum* pFrustum);
+
+	// The current render list, hold on to it while using the chunks in it
+	shared_ptr<ChunkRenderList> GetRenderList();
+
+	// Meshes can only be deleted on the render thread, other threads hand them over here
+	void ReleaseMesh(OpenGLTriangleMesh* pMesh);
+
+	// Render counters, from the last main and shadow render
+	void GetRenderCounters(int* numRendered, int* numCulled, int* numOccluded, int* numShadowRendered, int* numShadowCulled);
 
 protected:
 	/* Protected methods */
 
 private:
 	/* Private methods */
+	bool IsChunkInFrustum(Chunk* pChunk, Frustum* pFrustum);
+	bool IsChunkOccluded(Chunk* pChunk);
+	Chunk* GetNeighbourChunk(Chunk* pChunk, int face);
+	static ChunkCoordKeys GetNeighbourCoordKeys(const ChunkCoordKeys& coordKeys, int face);
+	static vec3 GetChunkCenter(const ChunkCoordKeys& coordKeys);
+	static int GetChunkIndexSize(float loaderRadius, float unloaderRadius);
+	void ResizeChunkIndex();
+	int GetChunkLODLevel(float distance, int currentLODLevel);
+
+	// Region files
+	void CloseRegionFiles();
+
+	// Editing blocks
+	void SetBlocksInRegion(int minX, int minY, int minZ, int maxX, int maxY, int maxZ, vec3 sphereCenter, float sphereRadius, unsigned int colour);
+	Chunk* GetEditableChunk(int gridX, int gridY, int gridZ);
+
+	// Render list
+	void PublishRenderList();
+
+	// Chunk streaming scheduler
+	void UpdateStreamingPlayer(float dt);
+	void UpdateSchedulerPlayer();
+	void ExpandChunkFrontier();
+	int LoadScheduledChunks(int maxChunks);
+	bool UnloadDistantChunks();
+	int QueueRebuildChunks(int maxChunks);
+	void RebuildChunkLoadQueue();
+	void AddFrontierChunk(const ChunkCoordKeys& coordKeys);
+	bool CanExpandFromChunk(Chunk* pChunk);
+	bool CanExpandIntoChunk(const ChunkCoordKeys& coordKeys);
+	float GetChunkLoadDistance(const ChunkCoordKeys& coordKeys);
+	float GetChunkLoadPriority(const ChunkCoordKeys& coordKeys);
 
 public:
 	/* Public members */
@@ -214,6 +454,7 @@ private:
 
 	// Loader radius
 	float m_loaderRadius;
+	float m_unloaderRadius;
 
 	// Update step lock
 	bool m_stepLockEnabled;
@@ -222,17 +463,138 @@ private:
 	// Render modes
 	bool m_wireframeRender;
 	bool m_faceMerging;
+	bool m_bakedAO;
 
 	// Chunks storage
 	map<ChunkCoordKeys, Chunk*> m_chunksMap;
 
-	// Storage for modifications to chunks that are not loaded yet
-	ChunkStorageLoaderList m_vpChunkStorageList;
-	mutex m_chunkStorageListLock;
+	// Lock free chunk lookup by grid position, replaced indices are kept until we are deleted since readers may still be using them
+	atomic<ChunkIndex*> m_pChunkIndex;
+	ChunkIndexList m_vpRetiredChunkIndices;
+	bool m_chunkIndexResizePending;
+
+	// Storage for modifications to chunks that are not loaded yet. Chunks only become setup, in ApplyLateChunkStorage(),
+	// or start unloading while the lock is held, so an edit that holds it throughout writes each block either to an
+	// editable chunk or to the storage that the chunk picks up once it is setup.
+	ChunkStorageLoaderMap m_chunkStorageMap;
+	recursive_mutex m_chunkStorageListLock;
+
+	// Compiled prefabs for world generation
+	PrefabManager* m_pPrefabManager;
 
 	// Threading
 	thread* m_pUpdatingChunksThread;
 	mutex m_ChunkMapMutexLock;
 	bool m_updateThreadActive;
-	bool m_updateThreadFinished;
+
+	// The updating thread sleeps until there is something for it to do
+	mutex m_updateThreadLock;
+	condition_variable m_updateThreadCondition;
+	bool m_updateThreadWakeup;
+
+	// Set by the updating thread when its last update had nothing to load, unload or rebuild
+	bool m_updateThreadIdle;
+
+	// Chunk job workers
+	int m_numWorkerThreads;
+	ThreadList m_vpWorkerThreads;
+	ChunkJobQueue m_chunkJobQueue;
+	mutex m_chunkJobQueueLock;
+	condition_variable m_chunkJobQueueCondition;
+	bool m_workerThreadsActive;
+	unsigned int m_nextJobSerial;
+	multiset<unsigned int> m_inFlightJobSerials;
+
+	// Jobs that have been queued and haven't had their mesh uploaded yet
+	atomic<int> m_numOutstandingChunkJobs;
+
+	// Mesh buffers from finished jobs, waiting to be uploaded on the render thread.
+	// The pending uploads are the buffers that didn't fit in the upload budget of a previous frame.
+	ChunkMeshQueue m_completedMeshQueue;
+	ChunkMeshBufferList m_vpPendingMeshUploads;
+	int m_numMeshesCompleted;
+
+	// Meshes released by other threads, deleted on the render thread
+	ChunkMeshList m_vpReleasedMeshes;
+	mutex m_releasedMeshesLock;
+
+	// Unloaded chunks, deleted once no in-flight job or rendered frame can still be referencing them
+	RetiredChunkList m_vRetiredChunkList;
+
+	// Render list, only accessed through atomic_load and atomic_store
+	shared_ptr<ChunkRenderList> m_pRenderList;
+	bool m_renderListDirty;
+
+	// Chunk streaming scheduler, only used by the updating thread.
+	// The frontier is the missing chunks next to loaded chunks that can grow the world, the load queue orders them by priority.
+	ChunkCoordKeysSet m_chunkFrontier;
+	ChunkLoadQueue m_chunkLoadQueue;
+	ChunkCoordKeys m_schedulerGrid;
+	ChunkCoordKeys m_schedulerPrefetchGrid;
+	vec3 m_schedulerPlayerCenter;
+	vec3 m_schedulerPrefetchCenter;
+	vec3 m_schedulerForward;
+	vec3 m_schedulerQueueForward;
+	ChunkCoordKeys m_unloadScanCoordKeys;
+	int m_numUnloadChecksRemaining;
+
+	// The player state for the scheduler, tracked on the main thread and read under the update thread lock
+	bool m_streamingPlayerValid;
+	vec3 m_streamingPlayerCenter;
+	vec3 m_streamingPrefetchCenter;
+	vec3 m_streamingForward;
+
+	// Main thread only, used to decide when the player has moved enough to wake the updating thread
+	vec3 m_playerVelocity;
+	vec3 m_lastPlayerCenter;
+	ChunkCoordKeys m_wakeGrid;
+	ChunkCoordKeys m_wakePrefetchGrid;
+	vec3 m_wakeForward;
+
+	// Chunks that have completed a job, so the scheduler can grow the frontier from them
+	ChunkCoordKeysList m_vCompletedChunkKeys;
+	mutex m_completedChunkKeysLock;
+
+	// Chunks waiting for a mesh rebuild
+	ChunkCoordKeysSet m_rebuildChunkKeys;
+	mutex m_rebuildChunkKeysLock;
+
+	static const int MAX_UNLOAD_CHECKS_PER_UPDATE = 512;
+	static const int MAX_OPEN_REGION_FILES = 64;
+	static const unsigned int MESH_UPLOAD_BYTES_PER_UPDATE = 512 * 1024;
+	static const float UNLOADER_RADIUS_MARGIN;
+	static const float LOD_HYSTERESIS;
+	static const float PREFETCH_SECONDS;
+	static const float MAX_PREFETCH_SPEED;
+	static const float VIEW_DIRECTION_BIAS;
+
+	// Open region files, most recently used first
+	RegionFileList m_regionFileList;
+	RegionFileMap m_regionFileMap;
+	mutex m_regionFileMapLock;
+
+	// Terrain generation heightmap
+	HeightmapCache* m_pHeightmapCache;
+
+	// Recently unloaded chunks
+	ChunkCache* m_pChunkCache;
+
+	// Chunk setup timings
+	int m_numGeneratedChunks;
+	double m_totalGenerateTime;
+	int m_numLoadedChunks;
+	double m_totalLoadTime;
+	mutex m_chunkSetupTimingLock;
+
+	// Occlusion culling
+	bool m_occlusionCullingValid;
+	unsigned int m_occlusionFrame;
+	ChunkVisibilityStepList m_vChunkVisibilitySteps;
+
+	// Render counters
+	int m_numChunksRendered;
+	int m_numChunksCulled;
+	int m_numChunksOccluded;
+	int m_numShadowChunksRendered;
+	int m_numShadowChunksCulled;
 };
@@ -0,0 +1,66 @@
+// ******************************************************************************
+// Filename:	ChunkMeshQueue.cpp
+// Project:	Game
+// Author:	Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#include "ChunkMeshQueue.h"
+
+#include <algorithm>
+
+
+ChunkMeshQueue::ChunkMeshQueue()
+{
+	m_pHead.store(NULL);
+}
+
+ChunkMeshQueue::~ChunkMeshQueue()
+{
+	ChunkMeshBuffer* pMeshBuffer = m_pHead.exchange(NULL);
+	while (pMeshBuffer != NULL)
+	{
+		ChunkMeshBuffer* pNext = pMeshBuffer->m_pNext;
+		delete pMeshBuffer;
+		pMeshBuffer = pNext;
+	}
+}
+
+// Any thread
+void ChunkMeshQueue::Push(ChunkMeshBuffer* pMeshBuffer)
+{
+	ChunkMeshBuffer* pHead = m_pHead.load(memory_order_relaxed);
+	do
+	{
+		pMeshBuffer->m_pNext = pHead;
+	} while (m_pHead.compare_exchange_weak(pHead, pMeshBuffer, memory_order_release, memory_order_relaxed) == false);
+}
+
+// Render thread
+void ChunkMeshQueue::TakeAll(ChunkMeshBufferList* pMeshBufferList)
+{
+	// Take the whole stack in one go, it is newest first
+	ChunkMeshBuffer* pMeshBuffer = m_pHead.exchange(NULL, memory_order_acquire);
+
+	unsigned int firstIndex = (unsigned int)pMeshBufferList->size();
+	while (pMeshBuffer != NULL)
+	{
+		ChunkMeshBuffer* pNext = pMeshBuffer->m_pNext;
+		pMeshBuffer->m_pNext = NULL;
+		pMeshBufferList->push_back(pMeshBuffer);
+		pMeshBuffer = pNext;
+	}
+
+	// Oldest first
+	reverse(pMeshBufferList->begin() + firstIndex, pMeshBufferList->end());
+}
+
+// Upload size of a buffer
+unsigned int ChunkMeshQueue::GetNumBytes(const ChunkMeshBuffer* pMeshBuffer)
+{
+	return (unsigned int)(pMeshBuffer->m_vVertices.size() * sizeof(OpenGLMesh_PackedVertex));
+}
@@ -0,0 +1,76 @@
+// ******************************************************************************
+// Filename:	ChunkMeshQueue.h
+// Project:	Game
+// Author:	Steven Ball
+//
+// Purpose:
+//   Hands finished chunk meshes from the worker threads to the render thread.
+//   A mesh buffer is the CPU side of a chunk mesh, built completely by a
+//   worker thread before it is pushed, so the render thread never sees a
+//   mesh that is still being written.
+//
+//   Pushing is lock free and can be done from any thread, only the render
+//   thread takes the buffers back out of the queue.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "../Renderer/mesh.h"
+
+#include <atomic>
+#include <deque>
+#include <vector>
+using namespace std;
+
+class Chunk;
+
+struct ChunkMeshBuffer
+{
+	Chunk* m_pChunk;
+	vector<OpenGLMesh_PackedVertex> m_vVertices;
+	unsigned int m_faceConnections;
+
+	// Next buffer in the queue
+	ChunkMeshBuffer* m_pNext;
+};
+
+typedef deque<ChunkMeshBuffer*> ChunkMeshBufferList;
+
+class ChunkMeshQueue
+{
+public:
+	/* Public methods */
+	ChunkMeshQueue();
+	~ChunkMeshQueue();
+
+	// Any thread
+	void Push(ChunkMeshBuffer* pMeshBuffer);
+
+	// Render thread, adds the queued buffers to the end of the list, in the order that they were pushed
+	void TakeAll(ChunkMeshBufferList* pMeshBufferList);
+
+	// Upload size of a buffer
+	static unsigned int GetNumBytes(const ChunkMeshBuffer* pMeshBuffer);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	// The most recently pushed buffer, each buffer links to the one pushed before it
+	atomic<ChunkMeshBuffer*> m_pHead;
+};
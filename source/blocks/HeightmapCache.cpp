@@ -0,0 +1,156 @@
+// ******************************************************************************
+// Filename:	HeightmapCache.cpp
+// Project:	Game
+// Author:	Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#include "HeightmapCache.h"
+#include "../simplex/simplexnoise.h"
+#include "../VoxSettings.h"
+
+// The terrain height range doesn't follow the chunk size, so every chunk size generates the same landscape
+static const float TERRAIN_HEIGHT_SCALE = 16.0f;
+
+// Frees the tile's arrays along with the tile, once the last user lets go of it
+static void DeleteHeightmapTile(HeightmapTile* pTile)
+{
+	delete[] pTile->m_pLandscapeNoise;
+	delete[] pTile->m_pHeight;
+	delete pTile;
+}
+
+HeightmapCache::HeightmapCache(VoxSettings* pVoxSettings, int tileSizeX, int tileSizeZ, int maxTiles)
+{
+	m_pVoxSettings = pVoxSettings;
+	m_tileSizeX = tileSizeX;
+	m_tileSizeZ = tileSizeZ;
+	m_maxTiles = maxTiles;
+
+	m_numHits = 0;
+	m_numMisses = 0;
+}
+
+HeightmapCache::~HeightmapCache()
+{
+	m_tileMap.clear();
+	m_tileList.clear();
+}
+
+void HeightmapCache::SetMaxTiles(int maxTiles)
+{
+	lock_guard<mutex> lock(m_lock);
+
+	m_maxTiles = maxTiles;
+	EvictTiles();
+}
+
+// Tiles
+shared_ptr<HeightmapTile> HeightmapCache::GetTile(int gridX, int gridZ)
+{
+	HeightmapTileKey key(gridX, gridZ);
+
+	m_lock.lock();
+	HeightmapTileMap::iterator it = m_tileMap.find(key);
+	if (it != m_tileMap.end())
+	{
+		// Move to the front of the list
+		m_tileList.splice(m_tileList.begin(), m_tileList, it->second);
+		shared_ptr<HeightmapTile> pTile = *it->second;
+		m_numHits++;
+		m_lock.unlock();
+
+		return pTile;
+	}
+	m_numMisses++;
+	m_lock.unlock();
+
+	// Generate outside of the lock, so other workers aren't held up by the noise
+	shared_ptr<HeightmapTile> pTile = CreateTile(gridX, gridZ);
+
+	lock_guard<mutex> lock(m_lock);
+
+	// Another worker might have added the same tile while we were generating it
+	it = m_tileMap.find(key);
+	if (it != m_tileMap.end())
+	{
+		return *it->second;
+	}
+
+	m_tileList.push_front(pTile);
+	m_tileMap[key] = m_tileList.begin();
+	EvictTiles();
+
+	return pTile;
+}
+
+// Statistics
+void HeightmapCache::GetStatistics(int* numTiles, int* numHits, int* numMisses)
+{
+	lock_guard<mutex> lock(m_lock);
+
+	*numTiles = (int)m_tileMap.size();
+	*numHits = m_numHits;
+	*numMisses = m_numMisses;
+}
+
+// Private methods
+shared_ptr<HeightmapTile> HeightmapCache::CreateTile(int gridX, int gridZ)
+{
+	HeightmapTile* pTile = new HeightmapTile();
+	pTile->m_gridX = gridX;
+	pTile->m_gridZ = gridZ;
+	pTile->m_pLandscapeNoise = new float[m_tileSizeX * m_tileSizeZ];
+	pTile->m_pHeight = new float[m_tileSizeX * m_tileSizeZ];
+
+	// Evaluate the whole tile in one batch for each noise
+	int numColumns = m_tileSizeX * m_tileSizeZ;
+	float* pXPositions = new float[numColumns];
+	float* pZPositions = new float[numColumns];
+	float* pMountainNoise = new float[numColumns];
+	for (int x = 0; x < m_tileSizeX; x++)
+	{
+		for (int z = 0; z < m_tileSizeZ; z++)
+		{
+			pXPositions[x + z * m_tileSizeX] = (float)(gridX * m_tileSizeX + x);
+			pZPositions[x + z * m_tileSizeX] = (float)(gridZ * m_tileSizeZ + z);
+		}
+	}
+
+	octave_noise_2d_batch(m_pVoxSettings->m_landscapeOctaves, m_pVoxSettings->m_landscapePersistence, m_pVoxSettings->m_landscapeScale, numColumns, pXPositions, pZPositions, pTile->m_pLandscapeNoise);
+	octave_noise_2d_batch(m_pVoxSettings->m_mountainOctaves, m_pVoxSettings->m_mountainPersistence, m_pVoxSettings->m_mountainScale, numColumns, pXPositions, pZPositions, pMountainNoise);
+
+	for (int i = 0; i < numColumns; i++)
+	{
+		float noiseNormalized = ((pTile->m_pLandscapeNoise[i] + 1.0f) * 0.5f);
+
+		float mountainNoiseNormalise = (pMountainNoise[i] + 1.0f) * 0.5f;
+		float mountainMultiplier = m_pVoxSettings->m_mountainMultiplier * mountainNoiseNormalise;
+
+		float noiseHeight = noiseNormalized * TERRAIN_HEIGHT_SCALE;
+		noiseHeight *= mountainMultiplier;
+
+		pTile->m_pHeight[i] = noiseHeight;
+	}
+
+	delete[] pXPositions;
+	delete[] pZPositions;
+	delete[] pMountainNoise;
+
+	return shared_ptr<HeightmapTile>(pTile, DeleteHeightmapTile);
+}
+
+void HeightmapCache::EvictTiles()
+{
+	// Workers that are still using an evicted tile keep it alive until they are done
+	while ((int)m_tileList.size() > m_maxTiles && m_tileList.empty() == false)
+	{
+		shared_ptr<HeightmapTile> pTile = m_tileList.back();
+		m_tileMap.erase(HeightmapTileKey(pTile->m_gridX, pTile->m_gridZ));
+		m_tileList.pop_back();
+	}
+}
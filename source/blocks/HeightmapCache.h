@@ -0,0 +1,91 @@
+// ******************************************************************************
+// Filename:	HeightmapCache.h
+// Project:	Game
+// Author:	Steven Ball
+//
+// Purpose:
+//   Caches the 2D terrain noise for chunk columns. Every chunk in a vertical
+//   stack at the same x, z grid position uses the same landscape and mountain
+//   noise, so it is worked out once per column instead of once per chunk.
+//
+//   Tiles are shared between the worker threads, the least recently used
+//   tiles are evicted when the cache is full.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "../tinythread/tinythread.h"
+using namespace tthread;
+
+#include <map>
+#include <list>
+#include <memory>
+using namespace std;
+
+class VoxSettings;
+
+struct HeightmapTile
+{
+	int m_gridX;
+	int m_gridZ;
+
+	// Per column, indexed by x + z * tileSizeX. The landscape noise is also used as the biome value.
+	float* m_pLandscapeNoise;
+	float* m_pHeight;
+};
+
+typedef list<shared_ptr<HeightmapTile> > HeightmapTileList;
+typedef pair<int, int> HeightmapTileKey;
+typedef map<HeightmapTileKey, HeightmapTileList::iterator> HeightmapTileMap;
+
+class HeightmapCache
+{
+public:
+	/* Public methods */
+	HeightmapCache(VoxSettings* pVoxSettings, int tileSizeX, int tileSizeZ, int maxTiles);
+	~HeightmapCache();
+
+	void SetMaxTiles(int maxTiles);
+
+	// Gets the tile for a chunk column, generating it if it isn't cached. Hold on to the tile while using it.
+	shared_ptr<HeightmapTile> GetTile(int gridX, int gridZ);
+
+	// Statistics
+	void GetStatistics(int* numTiles, int* numHits, int* numMisses);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	shared_ptr<HeightmapTile> CreateTile(int gridX, int gridZ);
+	void EvictTiles();
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	VoxSettings* m_pVoxSettings;
+
+	int m_tileSizeX;
+	int m_tileSizeZ;
+	int m_maxTiles;
+
+	// Most recently used tiles are at the front of the list
+	HeightmapTileList m_tileList;
+	HeightmapTileMap m_tileMap;
+
+	int m_numHits;
+	int m_numMisses;
+
+	mutex m_lock;
+};
@@ -0,0 +1,246 @@
+// ******************************************************************************
+// Filename:	Prefab.cpp
+// Project:	Game
+// Author:	Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#include "Prefab.h"
+#include "../models/QubicleBinaryManager.h"
+
+
+Prefab::Prefab(QubicleBinary* pQubicleBinary, QubicleImportDirection direction)
+{
+	int numMatrices = pQubicleBinary->GetNumMatrices();
+
+	for (int i = 0; i < numMatrices; i++)
+	{
+		CompileMatrix(pQubicleBinary->GetQubicleMatrix(i), direction);
+	}
+}
+
+Prefab::Prefab(QubicleMatrix* pMatrix, QubicleImportDirection direction)
+{
+	CompileMatrix(pMatrix, direction);
+}
+
+Prefab::~Prefab()
+{
+	m_vParts.clear();
+	m_vColours.clear();
+}
+
+// Parts
+int Prefab::GetNumParts() const
+{
+	return (int)m_vParts.size();
+}
+
+const PrefabPart& Prefab::GetPart(int partIndex) const
+{
+	return m_vParts[partIndex];
+}
+
+const unsigned int* Prefab::GetColours() const
+{
+	return m_vColours.empty() ? NULL : &m_vColours[0];
+}
+
+int Prefab::GetNumBlocks() const
+{
+	return (int)m_vColours.size();
+}
+
+void Prefab::GetPartOrigin(int partIndex, vec3 position, int* blockX, int* blockY, int* blockZ) const
+{
+	const PrefabPart& part = m_vParts[partIndex];
+
+	// The same block that the chunk manager picks for a qubicle import at this position
+	ChunkManager::GetBlockFromPosition(position - vec3(part.m_centreX, 0.0f, part.m_centreZ), blockX, blockY, blockZ);
+}
+
+void Prefab::GetBlockBounds(vec3 position, int* minX, int* minY, int* minZ, int* maxX, int* maxY, int* maxZ) const
+{
+	for (int i = 0; i < (int)m_vParts.size(); i++)
+	{
+		int originX;
+		int originY;
+		int originZ;
+		GetPartOrigin(i, position, &originX, &originY, &originZ);
+
+		int partMaxX = originX + m_vParts[i].m_sizeX - 1;
+		int partMaxY = originY + m_vParts[i].m_sizeY - 1;
+		int partMaxZ = originZ + m_vParts[i].m_sizeZ - 1;
+
+		if (i == 0 || originX < *minX) *minX = originX;
+		if (i == 0 || originY < *minY) *minY = originY;
+		if (i == 0 || originZ < *minZ) *minZ = originZ;
+		if (i == 0 || partMaxX > *maxX) *maxX = partMaxX;
+		if (i == 0 || partMaxY > *maxY) *maxY = partMaxY;
+		if (i == 0 || partMaxZ > *maxZ) *maxZ = partMaxZ;
+	}
+}
+
+// Compiling
+void Prefab::CompileMatrix(QubicleMatrix* pMatrix, QubicleImportDirection direction)
+{
+	bool mirrorX = false;
+	bool mirrorY = false;
+	bool mirrorZ = false;
+	bool flipXZ = false;
+	bool flipXY = false;
+	bool flipYZ = false;
+
+	switch (direction)
+	{
+	case QubicleImportDirection_Normal: {  } break;
+	case QubicleImportDirection_MirrorX: { mirrorX = true; } break;
+	case QubicleImportDirection_MirrorY: { mirrorY = true; } break;
+	case QubicleImportDirection_MirrorZ: { mirrorZ = true; } break;
+	case QubicleImportDirection_RotateY90: { mirrorX = true; flipXZ = true; } break;
+	case QubicleImportDirection_RotateY180: { mirrorX = true; mirrorZ = true; } break;
+	case QubicleImportDirection_RotateY270: { mirrorZ = true; flipXZ = true; } break;
+	case QubicleImportDirection_RotateX90: { mirrorZ = true; flipYZ = true; } break;
+	case QubicleImportDirection_RotateX180: { mirrorZ = true; mirrorY = true; } break;
+	case QubicleImportDirection_RotateX270: { mirrorY = true; flipYZ = true; } break;
+	case QubicleImportDirection_RotateZ90: { mirrorY = true; flipXY = true; } break;
+	case QubicleImportDirection_RotateZ180: { mirrorX = true; mirrorY = true; } break;
+	case QubicleImportDirection_RotateZ270: { mirrorX = true; flipXY = true; } break;
+	}
+
+	int xValueToUse = pMatrix->m_matrixSizeX;
+	int yValueToUse = pMatrix->m_matrixSizeY;
+	int zValueToUse = pMatrix->m_matrixSizeZ;
+	if (flipXZ)
+	{
+		xValueToUse = pMatrix->m_matrixSizeZ;
+		zValueToUse = pMatrix->m_matrixSizeX;
+	}
+	if (flipXY)
+	{
+		xValueToUse = pMatrix->m_matrixSizeY;
+		yValueToUse = pMatrix->m_matrixSizeX;
+	}
+	if (flipYZ)
+	{
+		yValueToUse = pMatrix->m_matrixSizeZ;
+		zValueToUse = pMatrix->m_matrixSizeY;
+	}
+
+	PrefabPart part;
+	part.m_centreX = (xValueToUse + 0.05f)*0.5f;
+	part.m_centreZ = (zValueToUse + 0.05f)*0.5f;
+	part.m_sizeX = xValueToUse;
+	part.m_sizeY = yValueToUse;
+	part.m_sizeZ = zValueToUse;
+
+	for (int y = 0; y < yValueToUse; y++)
+	{
+		int yPosition = mirrorY ? (yValueToUse - 1 - y) : y;
+
+		for (int z = 0; z < zValueToUse; z++)
+		{
+			int zPosition = mirrorZ ? (zValueToUse - 1 - z) : z;
+
+			PrefabRun run;
+			run.m_length = 0;
+
+			for (int x = 0; x < xValueToUse; x++)
+			{
+				int xPosition = mirrorX ? (xValueToUse - 1 - x) : x;
+
+				int xPosition_modified = xPosition;
+				int yPosition_modified = yPosition;
+				int zPosition_modified = zPosition;
+				if (flipXZ)
+				{
+					xPosition_modified = zPosition;
+					zPosition_modified = xPosition;
+				}
+				if (flipXY)
+				{
+					xPosition_modified = yPosition;
+					yPosition_modified = xPosition;
+				}
+				if (flipYZ)
+				{
+					yPosition_modified = zPosition;
+					zPosition_modified = yPosition;
+				}
+
+				if (pMatrix->GetActive(xPosition_modified, yPosition_modified, zPosition_modified) == false)
+				{
+					// End of a run
+					if (run.m_length > 0)
+					{
+						part.m_vRuns.push_back(run);
+						run.m_length = 0;
+					}
+				}
+				else
+				{
+					if (run.m_length == 0)
+					{
+						run.m_x = x;
+						run.m_y = y;
+						run.m_z = z;
+						run.m_colourOffset = (int)m_vColours.size();
+					}
+
+					m_vColours.push_back(pMatrix->GetColourCompact(xPosition_modified, yPosition_modified, zPosition_modified));
+					run.m_length++;
+				}
+			}
+
+			if (run.m_length > 0)
+			{
+				part.m_vRuns.push_back(run);
+			}
+		}
+	}
+
+	m_vParts.push_back(part);
+}
+
+
+PrefabManager::PrefabManager(QubicleBinaryManager* pQubicleBinaryManager)
+{
+	m_pQubicleBinaryManager = pQubicleBinaryManager;
+}
+
+PrefabManager::~PrefabManager()
+{
+	for (PrefabMap::iterator it = m_prefabMap.begin(); it != m_prefabMap.end(); ++it)
+	{
+		delete it->second;
+	}
+	m_prefabMap.clear();
+}
+
+Prefab* PrefabManager::GetPrefab(const char* filename, QubicleImportDirection direction)
+{
+	lock_guard<mutex> guard(m_prefabMapLock);
+
+	PrefabKey key(filename, (int)direction);
+	PrefabMap::iterator it = m_prefabMap.find(key);
+	if (it != m_prefabMap.end())
+	{
+		return it->second;
+	}
+
+	// Don't refresh the model, it is shared between the chunk worker threads
+	QubicleBinary* pQubicleBinary = m_pQubicleBinaryManager->GetQubicleBinaryFile(filename, false);
+	if (pQubicleBinary == NULL)
+	{
+		return NULL;
+	}
+
+	Prefab* pPrefab = new Prefab(pQubicleBinary, direction);
+	m_prefabMap[key] = pPrefab;
+
+	return pPrefab;
+}
@@ -0,0 +1,133 @@
+// ******************************************************************************
+// Filename:	Prefab.h
+// Project:	Game
+// Author:	Steven Ball
+//
+// Purpose:
+//   Prefabs are qubicle models that have been compiled for stamping into the
+//   world during chunk generation, e.g. trees and structures, and for qubicle
+//   imports. Each matrix is converted once into horizontal runs of solid
+//   blocks with cached bounds, so stamping a prefab is a few array copies
+//   instead of a chunk lookup and a colour read for every voxel in the model.
+//
+//   The PrefabManager compiles each model and import direction once and
+//   shares the result between the chunk worker threads.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "ChunkManager.h"
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "../tinythread/tinythread.h"
+using namespace tthread;
+
+class QubicleBinaryManager;
+
+// A run of solid blocks along x, the colours are stored one after another in the prefab colour list
+struct PrefabRun
+{
+	int m_x;
+	int m_y;
+	int m_z;
+	int m_length;
+	int m_colourOffset;
+};
+
+typedef vector<PrefabRun> PrefabRunList;
+
+// One qubicle matrix, centred on the stamp position in x and z
+struct PrefabPart
+{
+	float m_centreX;
+	float m_centreZ;
+
+	int m_sizeX;
+	int m_sizeY;
+	int m_sizeZ;
+
+	PrefabRunList m_vRuns;
+};
+
+typedef vector<PrefabPart> PrefabPartList;
+
+class Prefab
+{
+public:
+	/* Public methods */
+	Prefab(QubicleBinary* pQubicleBinary, QubicleImportDirection direction);
+	Prefab(QubicleMatrix* pMatrix, QubicleImportDirection direction);
+	~Prefab();
+
+	// Parts
+	int GetNumParts() const;
+	const PrefabPart& GetPart(int partIndex) const;
+	const unsigned int* GetColours() const;
+	int GetNumBlocks() const;
+
+	// World block co-ordinates of a part's first block when the prefab is stamped at position
+	void GetPartOrigin(int partIndex, vec3 position, int* blockX, int* blockY, int* blockZ) const;
+
+	// Inclusive world block bounds of the whole prefab when it is stamped at position
+	void GetBlockBounds(vec3 position, int* minX, int* minY, int* minZ, int* maxX, int* maxY, int* maxZ) const;
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	void CompileMatrix(QubicleMatrix* pMatrix, QubicleImportDirection direction);
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	PrefabPartList m_vParts;
+	vector<unsigned int> m_vColours;
+};
+
+typedef pair<string, int> PrefabKey;
+typedef map<PrefabKey, Prefab*> PrefabMap;
+
+class PrefabManager
+{
+public:
+	/* Public methods */
+	PrefabManager(QubicleBinaryManager* pQubicleBinaryManager);
+	~PrefabManager();
+
+	// Gets the compiled prefab for a model and import direction, compiling it the first time it is asked for
+	Prefab* GetPrefab(const char* filename, QubicleImportDirection direction);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+
+public:
+	/* Public members */
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	QubicleBinaryManager* m_pQubicleBinaryManager;
+
+	PrefabMap m_prefabMap;
+	mutex m_prefabMapLock;
+};
@@ -0,0 +1,299 @@
+// ******************************************************************************
+// Filename:	RegionFile.cpp
+// Project:	Game
+// Author:	Steven Ball
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#include "RegionFile.h"
+
+#include <string.h>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif //_WIN32
+
+
+RegionFile::RegionFile(string filename, int chunkSizeX, int chunkSizeY, int chunkSizeZ)
+{
+	m_filename = filename;
+	m_numBlocks = chunkSizeX * chunkSizeY * chunkSizeZ;
+
+	m_fileSize = 0;
+	m_pMappedData = NULL;
+	m_mappedSize = 0;
+#ifdef _WIN32
+	m_mappingHandle = NULL;
+#endif //_WIN32
+
+	memset(m_entries, 0, sizeof(m_entries));
+
+	RegionFileHeader header;
+	memcpy(header.m_magic, "VOXR", 4);
+	header.m_version = REGION_FILE_VERSION;
+	header.m_chunkSizeX = chunkSizeX;
+	header.m_chunkSizeY = chunkSizeY;
+	header.m_chunkSizeZ = chunkSizeZ;
+	header.m_regionSize = REGION_SIZE;
+
+	m_pFile = fopen(m_filename.c_str(), "r+b");
+	if (m_pFile != NULL)
+	{
+		RegionFileHeader fileHeader;
+		bool valid = (fread(&fileHeader, sizeof(fileHeader), 1, m_pFile) == 1);
+		valid = valid && (memcmp(&fileHeader, &header, sizeof(header)) == 0);
+		valid = valid && (fread(m_entries, sizeof(m_entries), 1, m_pFile) == 1);
+
+		if (valid == false)
+		{
+			// Don't overwrite a file we don't understand
+			cout << "Region file '" << m_filename << "' is not valid for this chunk size, chunks won't be saved to it\n";
+			fclose(m_pFile);
+			m_pFile = NULL;
+			memset(m_entries, 0, sizeof(m_entries));
+			return;
+		}
+
+		fseek(m_pFile, 0, SEEK_END);
+		m_fileSize = (unsigned int)ftell(m_pFile);
+	}
+	else
+	{
+		// New region file, with an empty offset table
+		m_pFile = fopen(m_filename.c_str(), "w+b");
+		if (m_pFile == NULL)
+		{
+			cout << "Can't create region file '" << m_filename << "'\n";
+			return;
+		}
+
+		fwrite(&header, sizeof(header), 1, m_pFile);
+		fwrite(m_entries, sizeof(m_entries), 1, m_pFile);
+		fflush(m_pFile);
+
+		m_fileSize = sizeof(header) + sizeof(m_entries);
+	}
+}
+
+RegionFile::~RegionFile()
+{
+	UnmapFile();
+
+	if (m_pFile != NULL)
+	{
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+}
+
+bool RegionFile::IsOpen()
+{
+	return m_pFile != NULL;
+}
+
+// Chunk data
+bool RegionFile::ReadChunk(int x, int y, int z, unsigned int* pColours)
+{
+	lock_guard<mutex> lock(m_lock);
+
+	if (m_pFile == NULL)
+	{
+		return false;
+	}
+
+	RegionFileChunkEntry* pEntry = &m_entries[GetEntryIndex(x, y, z)];
+	if (pEntry->m_size == 0)
+	{
+		return false;
+	}
+
+	// Remap if the chunk was written after we last mapped the file
+	unsigned long long entryEnd = (unsigned long long)pEntry->m_offset + pEntry->m_size;
+	if (entryEnd > m_mappedSize)
+	{
+		if (MapFile() == false)
+		{
+			return false;
+		}
+
+		// A truncated or corrupt file can have an offset table entry past the end of its data
+		if (entryEnd > m_mappedSize)
+		{
+			cout << "Region file '" << m_filename << "' has a chunk entry past the end of the file, the chunk won't be loaded\n";
+			return false;
+		}
+	}
+
+	return Decompress(m_pMappedData + pEntry->m_offset, pEntry->m_size, m_numBlocks, pColours);
+}
+
+bool RegionFile::WriteChunk(int x, int y, int z, const unsigned int* pColours)
+{
+	lock_guard<mutex> lock(m_lock);
+
+	if (m_pFile == NULL)
+	{
+		return false;
+	}
+
+	vector<unsigned char> vData;
+	Compress(pColours, m_numBlocks, &vData);
+
+	// Reuse the chunk's old space if the new data fits, otherwise append to the end of the file
+	int entryIndex = GetEntryIndex(x, y, z);
+	RegionFileChunkEntry entry = m_entries[entryIndex];
+	if (entry.m_size == 0 || entry.m_size < vData.size())
+	{
+		entry.m_offset = m_fileSize;
+	}
+	entry.m_size = (unsigned int)vData.size();
+
+	fseek(m_pFile, entry.m_offset, SEEK_SET);
+	if (fwrite(&vData[0], vData.size(), 1, m_pFile) != 1)
+	{
+		return false;
+	}
+	if (entry.m_offset + entry.m_size > m_fileSize)
+	{
+		m_fileSize = entry.m_offset + entry.m_size;
+	}
+
+	// Write through the offset table entry
+	m_entries[entryIndex] = entry;
+	fseek(m_pFile, sizeof(RegionFileHeader) + sizeof(RegionFileChunkEntry) * entryIndex, SEEK_SET);
+	fwrite(&entry, sizeof(entry), 1, m_pFile);
+	fflush(m_pFile);
+
+	return true;
+}
+
+// Region coordinates from chunk grid coordinates
+void RegionFile::GetRegionFromGrid(int gridX, int gridY, int gridZ, int* regionX, int* regionY, int* regionZ, int* localX, int* localY, int* localZ)
+{
+	// Round towards negative infinity, so negative grid coordinates get their own regions
+	*regionX = (gridX >= 0) ? gridX / REGION_SIZE : ((gridX + 1) / REGION_SIZE) - 1;
+	*regionY = (gridY >= 0) ? gridY / REGION_SIZE : ((gridY + 1) / REGION_SIZE) - 1;
+	*regionZ = (gridZ >= 0) ? gridZ / REGION_SIZE : ((gridZ + 1) / REGION_SIZE) - 1;
+
+	*localX = gridX - (*regionX * REGION_SIZE);
+	*localY = gridY - (*regionY * REGION_SIZE);
+	*localZ = gridZ - (*regionZ * REGION_SIZE);
+}
+
+// Run length encoding of block colours, each run is a 2 byte length followed by a 4 byte colour
+void RegionFile::Compress(const unsigned int* pColours, int numBlocks, vector<unsigned char>* pData)
+{
+	int index = 0;
+	while (index < numBlocks)
+	{
+		unsigned int colour = pColours[index];
+		unsigned short runLength = 1;
+		while (index + runLength < numBlocks && pColours[index + runLength] == colour && runLength < 0xFFFF)
+		{
+			runLength++;
+		}
+
+		unsigned char run[6];
+		memcpy(&run[0], &runLength, sizeof(runLength));
+		memcpy(&run[2], &colour, sizeof(colour));
+		pData->insert(pData->end(), run, run + 6);
+
+		index += runLength;
+	}
+}
+
+bool RegionFile::Decompress(const unsigned char* pData, unsigned int size, int numBlocks, unsigned int* pColours)
+{
+	int index = 0;
+	for (unsigned int i = 0; i + 6 <= size; i += 6)
+	{
+		unsigned short runLength;
+		unsigned int colour;
+		memcpy(&runLength, &pData[i], sizeof(runLength));
+		memcpy(&colour, &pData[i + 2], sizeof(colour));
+
+		if (index + runLength > numBlocks)
+		{
+			return false;
+		}
+
+		for (int j = 0; j < runLength; j++)
+		{
+			pColours[index + j] = colour;
+		}
+		index += runLength;
+	}
+
+	return index == numBlocks;
+}
+
+// Private methods
+bool RegionFile::MapFile()
+{
+	UnmapFile();
+
+	if (m_fileSize == 0)
+	{
+		return false;
+	}
+
+#ifdef _WIN32
+	HANDLE fileHandle = (HANDLE)_get_osfhandle(_fileno(m_pFile));
+	m_mappingHandle = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mappingHandle == NULL)
+	{
+		return false;
+	}
+
+	m_pMappedData = (const unsigned char*)MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (m_pMappedData == NULL)
+	{
+		CloseHandle(m_mappingHandle);
+		m_mappingHandle = NULL;
+		return false;
+	}
+#else
+	void* pMapping = mmap(NULL, m_fileSize, PROT_READ, MAP_SHARED, fileno(m_pFile), 0);
+	if (pMapping == MAP_FAILED)
+	{
+		return false;
+	}
+
+	m_pMappedData = (const unsigned char*)pMapping;
+#endif //_WIN32
+
+	m_mappedSize = m_fileSize;
+
+	return true;
+}
+
+void RegionFile::UnmapFile()
+{
+	if (m_pMappedData == NULL)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_pMappedData);
+	CloseHandle(m_mappingHandle);
+	m_mappingHandle = NULL;
+#else
+	munmap((void*)m_pMappedData, m_mappedSize);
+#endif //_WIN32
+
+	m_pMappedData = NULL;
+	m_mappedSize = 0;
+}
+
+int RegionFile::GetEntryIndex(int x, int y, int z)
+{
+	return x + y * REGION_SIZE + z * REGION_SIZE * REGION_SIZE;
+}
@@ -0,0 +1,108 @@
+// ******************************************************************************
+// Filename:	RegionFile.h
+// Project:	Game
+// Author:	Steven Ball
+//
+// Purpose:
+//   A region file stores the blocks for a REGION_SIZE cubed group of chunks.
+//   The file starts with a header and an offset table, one entry per chunk,
+//   followed by the run length encoded chunk data. Reading is done through a
+//   memory mapped view of the file.
+//
+// Revision History:
+//   Initial Revision - 17/10/26
+//
+// Copyright (c) 2005-2015, Steven Ball
+// ******************************************************************************
+
+#pragma once
+
+#include "../tinythread/tinythread.h"
+using namespace tthread;
+
+#ifdef _WIN32
+#include <windows.h>
+#endif //_WIN32
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct RegionFileHeader
+{
+	char m_magic[4];
+	unsigned int m_version;
+	unsigned int m_chunkSizeX;
+	unsigned int m_chunkSizeY;
+	unsigned int m_chunkSizeZ;
+	unsigned int m_regionSize;
+};
+
+struct RegionFileChunkEntry
+{
+	unsigned int m_offset;
+	unsigned int m_size;
+};
+
+class RegionFile
+{
+public:
+	/* Public methods */
+	RegionFile(string filename, int chunkSizeX, int chunkSizeY, int chunkSizeZ);
+	~RegionFile();
+
+	bool IsOpen();
+
+	// Chunk data, x, y, z are the chunk position inside the region
+	bool ReadChunk(int x, int y, int z, unsigned int* pColours);
+	bool WriteChunk(int x, int y, int z, const unsigned int* pColours);
+
+	// Region coordinates from chunk grid coordinates
+	static void GetRegionFromGrid(int gridX, int gridY, int gridZ, int* regionX, int* regionY, int* regionZ, int* localX, int* localY, int* localZ);
+
+	// Run length encoding of block colours, also used by the chunk cache
+	static void Compress(const unsigned int* pColours, int numBlocks, vector<unsigned char>* pData);
+	static bool Decompress(const unsigned char* pData, unsigned int size, int numBlocks, unsigned int* pColours);
+
+protected:
+	/* Protected methods */
+
+private:
+	/* Private methods */
+	bool MapFile();
+	void UnmapFile();
+
+	static int GetEntryIndex(int x, int y, int z);
+
+public:
+	/* Public members */
+	static const int REGION_SIZE = 8;
+	static const int REGION_SIZE_CUBED = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+
+protected:
+	/* Protected members */
+
+private:
+	/* Private members */
+	static const unsigned int REGION_FILE_VERSION = 2;
+
+	string m_filename;
+	int m_numBlocks;
+
+	FILE* m_pFile;
+	unsigned int m_fileSize;
+
+	// Offset table, kept in memory and written through on every chunk write
+	RegionFileChunkEntry m_entries[REGION_SIZE_CUBED];
+
+	// Memory mapped view of the file, used for reading
+	const unsigned char* m_pMappedData;
+	unsigned int m_mappedSize;
+#ifdef _WIN32
+	HANDLE m_mappingHandle;
+#endif //_WIN32
+
+	// Reads and writes can come from different threads
+	mutex m_lock;
+};
@@ -27,7 +27,11 @@ QubicleBinary::QubicleBinary(Renderer* pRenderer)
 
 	m_renderWireFrame = false;
 
-	pRenderer->CreateMaterial(Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(0.0f, 0.0f, 0.0f, 1.0f), 64, &m_materialID);
+	m_materialID = -1;
+	if (pRenderer != NULL)
+	{
+		pRenderer->CreateMaterial(Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(1.0f, 1.0f, 1.0f, 1.0f), Colour(0.0f, 0.0f, 0.0f, 1.0f), 64, &m_materialID);
+	}
 
 	float l_length = 0.5f; 
 	float l_height = 0.5f;
@@ -60,7 +64,10 @@ void QubicleBinary::ClearMatrices()
 {
 	for(unsigned int i = 0; i < m_vpMatrices.size(); i++)
 	{
-		m_pRenderer->ClearMesh(m_vpMatrices[i]->m_pMesh);
+		if (m_pRenderer != NULL)
+		{
+			m_pRenderer->ClearMesh(m_vpMatrices[i]->m_pMesh);
+		}
 		m_vpMatrices[i]->m_pMesh = NULL;
 
 		delete [] m_vpMatrices[i]->m_pColour;
@@ -249,7 +256,11 @@ bool QubicleBinary::Import(const char* fileName, bool faceMerging)
 
 		fclose(pQBfile);
 
-		CreateMesh(faceMerging);
+		// Headless tools only need the voxel data
+		if (m_pRenderer != NULL)
+		{
+			CreateMesh(faceMerging);
+		}
 
 		m_loaded = true;
 
@@ -38,6 +38,9 @@ void QubicleBinaryManager::ClearQubicleBinaryList()
 
 QubicleBinary* QubicleBinaryManager::GetQubicleBinaryFile(const char* fileName, bool refreshModel)
 {
+	// Chunk generation can request models from multiple threads
+	lock_guard<recursive_mutex> guard(m_qubicleBinaryListLock);
+
 	for(unsigned int i = 0; i < m_vpQubicleBinaryList.size(); i++)
 	{
 		if(strcmp(m_vpQubicleBinaryList[i]->GetFileName().c_str(), fileName) == 0)
@@ -57,6 +60,8 @@ QubicleBinary* QubicleBinaryManager::GetQubicleBinaryFile(const char* fileName,
 
 QubicleBinary* QubicleBinaryManager::AddQubicleBinaryFile(const char* fileName)
 {
+	lock_guard<recursive_mutex> guard(m_qubicleBinaryListLock);
+
 	QubicleBinary* pNewQubicleBinary = new QubicleBinary(m_pRenderer);
 	pNewQubicleBinary->Import(fileName, true);
 
@@ -18,6 +18,9 @@
 
 #include "QubicleBinary.h"
 
+#include "../tinythread/tinythread.h"
+using namespace tthread;
+
 typedef vector<QubicleBinary*> QubicleBinaryList;
 
 
@@ -50,4 +53,5 @@ private:
 	Renderer* m_pRenderer;
 
 	QubicleBinaryList m_vpQubicleBinaryList;
+	recursive_mutex m_qubicleBinaryListLock;
 };
@@ -19,6 +19,12 @@
 #include <math.h>
 
 #include "simplexnoise.h"
+#include "simplexnoise_simd.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
 
 
 /* 2D, 3D and 4D Simplex Noise functions return 'random' values in (-1, 1).
@@ -170,6 +176,182 @@ float scaled_raw_noise_4d( const float loBound, const float hiBound, const float
 
 
 
+// Batch Simplex noise.
+//
+// The code path is picked once, when the program starts.
+enum SimplexBatchPath { SimplexBatch_Scalar, SimplexBatch_SSE2, SimplexBatch_AVX2 };
+
+static bool cpu_supports_sse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+    return true;
+#elif defined(_MSC_VER) && defined(_M_IX86)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__i386__)
+    return __builtin_cpu_supports("sse2") != 0;
+#else
+    return false;
+#endif
+}
+
+static bool cpu_supports_avx2() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)) && _MSC_VER >= 1800
+    // AVX2 needs the CPU to support it, and the OS to save the YMM registers
+    int info[4];
+    __cpuid(info, 0);
+    if( info[0] < 7 ) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if( osxsave == false || avx == false ) return false;
+    if( (_xgetbv(0) & 6) != 6 ) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
+
+static SimplexBatchPath select_batch_path() {
+    if( simplex_avx2_compiled() && cpu_supports_avx2() ) return SimplexBatch_AVX2;
+    if( simplex_sse2_compiled() && cpu_supports_sse2() ) return SimplexBatch_SSE2;
+    return SimplexBatch_Scalar;
+}
+
+static const SimplexBatchPath batchPath = select_batch_path();
+
+const char* simplex_batch_instruction_set() {
+    switch( batchPath ) {
+        case SimplexBatch_AVX2: return "AVX2";
+        case SimplexBatch_SSE2: return "SSE2";
+        default: return "Scalar";
+    }
+}
+
+
+// 2D raw Simplex noise, for count points.
+void raw_noise_2d_batch( const int count, const float* xs, const float* ys, float* out ) {
+    switch( batchPath ) {
+        case SimplexBatch_AVX2: raw_noise_2d_batch_avx2(count, xs, ys, out); break;
+        case SimplexBatch_SSE2: raw_noise_2d_batch_sse2(count, xs, ys, out); break;
+        default:
+            for( int i=0; i < count; i++ ) {
+                out[i] = raw_noise_2d(xs[i], ys[i]);
+            }
+            break;
+    }
+}
+
+
+// 3D raw Simplex noise, for count points.
+void raw_noise_3d_batch( const int count, const float* xs, const float* ys, const float* zs, float* out ) {
+    switch( batchPath ) {
+        case SimplexBatch_AVX2: raw_noise_3d_batch_avx2(count, xs, ys, zs, out); break;
+        case SimplexBatch_SSE2: raw_noise_3d_batch_sse2(count, xs, ys, zs, out); break;
+        default:
+            for( int i=0; i < count; i++ ) {
+                out[i] = raw_noise_3d(xs[i], ys[i], zs[i]);
+            }
+            break;
+    }
+}
+
+
+// 2D Multi-octave Simplex noise, for count points.
+//
+// The points are done in blocks, each octave is one raw batch call per block.
+void octave_noise_2d_batch( const float octaves, const float persistence, const float scale, const int count, const float* xs, const float* ys, float* out ) {
+    const int BLOCK_SIZE = 256;
+    float octaveX[BLOCK_SIZE];
+    float octaveY[BLOCK_SIZE];
+    float noise[BLOCK_SIZE];
+
+    for( int start=0; start < count; start += BLOCK_SIZE ) {
+        int blockCount = (count - start < BLOCK_SIZE) ? count - start : BLOCK_SIZE;
+        float* total = &out[start];
+
+        float frequency = scale;
+        float amplitude = 1;
+        float maxAmplitude = 0;
+
+        for( int j=0; j < blockCount; j++ ) {
+            total[j] = 0;
+        }
+
+        for( int i=0; i < octaves; i++ ) {
+            for( int j=0; j < blockCount; j++ ) {
+                octaveX[j] = xs[start + j] * frequency;
+                octaveY[j] = ys[start + j] * frequency;
+            }
+
+            raw_noise_2d_batch(blockCount, octaveX, octaveY, noise);
+
+            for( int j=0; j < blockCount; j++ ) {
+                total[j] += noise[j] * amplitude;
+            }
+
+            frequency *= 2;
+            maxAmplitude += amplitude;
+            amplitude *= persistence;
+        }
+
+        for( int j=0; j < blockCount; j++ ) {
+            total[j] = total[j] / maxAmplitude;
+        }
+    }
+}
+
+
+// 3D Multi-octave Simplex noise, for count points.
+void octave_noise_3d_batch( const float octaves, const float persistence, const float scale, const int count, const float* xs, const float* ys, const float* zs, float* out ) {
+    const int BLOCK_SIZE = 256;
+    float octaveX[BLOCK_SIZE];
+    float octaveY[BLOCK_SIZE];
+    float octaveZ[BLOCK_SIZE];
+    float noise[BLOCK_SIZE];
+
+    for( int start=0; start < count; start += BLOCK_SIZE ) {
+        int blockCount = (count - start < BLOCK_SIZE) ? count - start : BLOCK_SIZE;
+        float* total = &out[start];
+
+        float frequency = scale;
+        float amplitude = 1;
+        float maxAmplitude = 0;
+
+        for( int j=0; j < blockCount; j++ ) {
+            total[j] = 0;
+        }
+
+        for( int i=0; i < octaves; i++ ) {
+            for( int j=0; j < blockCount; j++ ) {
+                octaveX[j] = xs[start + j] * frequency;
+                octaveY[j] = ys[start + j] * frequency;
+                octaveZ[j] = zs[start + j] * frequency;
+            }
+
+            raw_noise_3d_batch(blockCount, octaveX, octaveY, octaveZ, noise);
+
+            for( int j=0; j < blockCount; j++ ) {
+                total[j] += noise[j] * amplitude;
+            }
+
+            frequency *= 2;
+            maxAmplitude += amplitude;
+            amplitude *= persistence;
+        }
+
+        for( int j=0; j < blockCount; j++ ) {
+            total[j] = total[j] / maxAmplitude;
+        }
+    }
+}
+
+
+
 // 2D raw Simplex noise
 float raw_noise_2d( const float x, const float y ) {
     // Noise contributions from the three corners
@@ -120,6 +120,35 @@ float raw_noise_3d(const float x, const float y, const float z);
 float raw_noise_4d(const float x, const float y, const float, const float w);
 
 
+// Batch Simplex noise - count noise values at once, written to out.
+// Uses SSE2 or AVX2 when the CPU supports them. The results are within
+// SIMPLEX_BATCH_EPSILON of the single value functions, since the SIMD code does
+// all of its arithmetic in single precision.
+#define SIMPLEX_BATCH_EPSILON 1.0e-5f
+
+void raw_noise_2d_batch(const int count, const float* xs, const float* ys, float* out);
+void raw_noise_3d_batch(const int count, const float* xs, const float* ys, const float* zs, float* out);
+
+void octave_noise_2d_batch(const float octaves,
+                    const float persistence,
+                    const float scale,
+                    const int count,
+                    const float* xs,
+                    const float* ys,
+                    float* out);
+void octave_noise_3d_batch(const float octaves,
+                    const float persistence,
+                    const float scale,
+                    const int count,
+                    const float* xs,
+                    const float* ys,
+                    const float* zs,
+                    float* out);
+
+// The instruction set that the batch functions use, "AVX2", "SSE2" or "Scalar".
+const char* simplex_batch_instruction_set();
+
+
 int fastfloor(const float x);
 
 float dot(const int* g, const float x, const float y);
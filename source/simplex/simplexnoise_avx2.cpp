@@ -0,0 +1,100 @@
+/* Copyright (c) 2007-2012 Eliot Eshelman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+// AVX2 code path for the batch Simplex noise functions, 8 points at a time.
+// This file has to be built with AVX2 enabled (-mavx2 for GCC and Clang), it is
+// only called when the CPU supports AVX2.
+
+#if defined(__AVX2__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)) && _MSC_VER >= 1800)
+#define SIMPLEX_AVX2
+#endif
+
+#ifdef SIMPLEX_AVX2
+
+#include <immintrin.h>
+
+#define SIMPLEX_SIMD_KERNELS
+#include "simplexnoise_simd.h"
+
+
+namespace {
+
+struct AVX2Lanes {
+    typedef __m256 F;
+    typedef __m256i I;
+    enum { WIDTH = 8 };
+
+    static F load( const float* p ) { return _mm256_loadu_ps(p); }
+    static void store( float* p, F v ) { _mm256_storeu_ps(p, v); }
+    static F set1( const float v ) { return _mm256_set1_ps(v); }
+    static I set1i( const int v ) { return _mm256_set1_epi32(v); }
+    static F allones() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+
+    static F add( F a, F b ) { return _mm256_add_ps(a, b); }
+    static F sub( F a, F b ) { return _mm256_sub_ps(a, b); }
+    static F mul( F a, F b ) { return _mm256_mul_ps(a, b); }
+    static I addi( I a, I b ) { return _mm256_add_epi32(a, b); }
+    static I subi( I a, I b ) { return _mm256_sub_epi32(a, b); }
+    static I andi( I a, I b ) { return _mm256_and_si256(a, b); }
+
+    static F cmpgt( F a, F b ) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static F cmpge( F a, F b ) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static F cmplt( F a, F b ) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static F and_( F a, F b ) { return _mm256_and_ps(a, b); }
+    static F andnot( F a, F b ) { return _mm256_andnot_ps(a, b); }
+    static F or_( F a, F b ) { return _mm256_or_ps(a, b); }
+    static I tomask( F m ) { return _mm256_castps_si256(m); }
+
+    static F tofloat( I v ) { return _mm256_cvtepi32_ps(v); }
+
+    // Same as fastfloor(), truncate and take one off for x <= 0
+    static I fastfloor( F x ) { return _mm256_add_epi32(_mm256_cvttps_epi32(x), _mm256_castps_si256(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LE_OQ))); }
+
+    static I gather( const int* table, I index ) { return _mm256_i32gather_epi32(table, index, 4); }
+    static F gatherf( const float* table, I index ) { return _mm256_i32gather_ps(table, index, 4); }
+};
+
+}
+
+
+bool simplex_avx2_compiled() { return true; }
+
+void raw_noise_2d_batch_avx2( const int count, const float* xs, const float* ys, float* out ) {
+    raw_noise_2d_batch_kernel<AVX2Lanes>(count, xs, ys, out);
+}
+
+void raw_noise_3d_batch_avx2( const int count, const float* xs, const float* ys, const float* zs, float* out ) {
+    raw_noise_3d_batch_kernel<AVX2Lanes>(count, xs, ys, zs, out);
+}
+
+#else
+
+#include "simplexnoise_simd.h"
+
+// Built without AVX2, the batch functions never pick this code path
+bool simplex_avx2_compiled() { return false; }
+
+void raw_noise_2d_batch_avx2( const int count, const float* xs, const float* ys, float* out ) {
+    raw_noise_2d_batch_sse2(count, xs, ys, out);
+}
+
+void raw_noise_3d_batch_avx2( const int count, const float* xs, const float* ys, const float* zs, float* out ) {
+    raw_noise_3d_batch_sse2(count, xs, ys, zs, out);
+}
+
+#endif /*SIMPLEX_AVX2*/
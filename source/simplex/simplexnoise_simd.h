@@ -0,0 +1,273 @@
+/* Copyright (c) 2007-2012 Eliot Eshelman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef SIMPLEX_SIMD_H_
+#define SIMPLEX_SIMD_H_
+
+#include "simplexnoise.h"
+
+
+/* SIMD code paths for the batch Simplex noise functions.
+
+The SSE2 and AVX2 versions are compiled in their own files, so that only the
+AVX2 file needs to be built with AVX2 enabled. The batch functions in
+simplexnoise.cpp pick one of them at runtime, depending on what the CPU
+supports.
+
+The kernels follow the scalar raw_noise_2d/3d step by step. The scalar code
+does some of its arithmetic in double precision, the kernels do all of it in
+single precision, so results can differ from the scalar path by up to
+SIMPLEX_BATCH_EPSILON.
+
+A kernel file defines SIMPLEX_SIMD_KERNELS and a lane type before including
+this header, to get the kernel templates.
+*/
+
+
+// Whether the code path was compiled in (it may still not be supported by the CPU).
+bool simplex_sse2_compiled();
+bool simplex_avx2_compiled();
+
+void raw_noise_2d_batch_sse2(const int count, const float* xs, const float* ys, float* out);
+void raw_noise_3d_batch_sse2(const int count, const float* xs, const float* ys, const float* zs, float* out);
+
+void raw_noise_2d_batch_avx2(const int count, const float* xs, const float* ys, float* out);
+void raw_noise_3d_batch_avx2(const int count, const float* xs, const float* ys, const float* zs, float* out);
+
+
+#ifdef SIMPLEX_SIMD_KERNELS
+
+#include <math.h>
+
+namespace {
+
+// The grad3 gradients split into components, and perm % 12, so the kernels can look them up per lane.
+static const float grad3x[12] = { 1,-1, 1,-1, 1,-1, 1,-1, 0, 0, 0, 0 };
+static const float grad3y[12] = { 1, 1,-1,-1, 0, 0, 0, 0, 1,-1, 1,-1 };
+static const float grad3z[12] = { 0, 0, 0, 0, 1, 1,-1,-1, 1, 1,-1,-1 };
+
+struct PermMod12 {
+    int values[512];
+
+    PermMod12() {
+        for( int i=0; i < 512; i++ ) {
+            values[i] = perm[i] % 12;
+        }
+    }
+};
+static const PermMod12 permMod12;
+
+
+// 2D raw Simplex noise, for one vector of points.
+template <class V>
+typename V::F raw_noise_2d_kernel( typename V::F x, typename V::F y ) {
+    typedef typename V::F F;
+    typedef typename V::I I;
+
+    // The same single precision constants as the scalar code
+    const float F2 = 0.5 * (sqrtf(3.0) - 1.0);
+    const float G2 = (3.0 - sqrtf(3.0)) / 6.0;
+
+    const F zero = V::set1(0.0f);
+    const F one = V::set1(1.0f);
+    const I oneI = V::set1i(1);
+    const I mask255 = V::set1i(255);
+
+    // Skew the input space to determine which simplex cell we're in
+    F s = V::mul(V::add(x, y), V::set1(F2));
+    I i = V::fastfloor(V::add(x, s));
+    I j = V::fastfloor(V::add(y, s));
+
+    F t = V::mul(V::tofloat(V::addi(i, j)), V::set1(G2));
+    F x0 = V::sub(x, V::sub(V::tofloat(i), t));
+    F y0 = V::sub(y, V::sub(V::tofloat(j), t));
+
+    // Lower or upper triangle
+    F lower = V::cmpgt(x0, y0);
+    I i1 = V::andi(V::tomask(lower), oneI);
+    I j1 = V::subi(oneI, i1);
+
+    F x1 = V::add(V::sub(x0, V::and_(lower, one)), V::set1(G2));
+    F y1 = V::add(V::sub(y0, V::andnot(lower, one)), V::set1(G2));
+    F x2 = V::add(x0, V::set1((float)(-1.0 + 2.0 * G2)));
+    F y2 = V::add(y0, V::set1((float)(-1.0 + 2.0 * G2)));
+
+    // Work out the hashed gradient indices of the three simplex corners
+    I ii = V::andi(i, mask255);
+    I jj = V::andi(j, mask255);
+    I gi0 = V::gather(permMod12.values, V::addi(ii, V::gather(perm, jj)));
+    I gi1 = V::gather(permMod12.values, V::addi(V::addi(ii, i1), V::gather(perm, V::addi(jj, j1))));
+    I gi2 = V::gather(permMod12.values, V::addi(V::addi(ii, oneI), V::gather(perm, V::addi(jj, oneI))));
+
+    // Calculate the contribution from the three corners
+    const F cx[3] = { x0, x1, x2 };
+    const F cy[3] = { y0, y1, y2 };
+    const I gi[3] = { gi0, gi1, gi2 };
+
+    F n = zero;
+    for( int c=0; c < 3; c++ ) {
+        F tc = V::sub(V::sub(V::set1(0.5f), V::mul(cx[c], cx[c])), V::mul(cy[c], cy[c]));
+        F d = V::add(V::mul(V::gatherf(grad3x, gi[c]), cx[c]), V::mul(V::gatherf(grad3y, gi[c]), cy[c]));
+        F outside = V::cmplt(tc, zero);
+        tc = V::mul(tc, tc);
+        n = V::add(n, V::andnot(outside, V::mul(V::mul(tc, tc), d)));
+    }
+
+    return V::mul(V::set1(70.0f), n);
+}
+
+
+// 3D raw Simplex noise, for one vector of points.
+template <class V>
+typename V::F raw_noise_3d_kernel( typename V::F x, typename V::F y, typename V::F z ) {
+    typedef typename V::F F;
+    typedef typename V::I I;
+
+    const float F3 = 1.0/3.0;
+    const float G3 = 1.0/6.0;
+
+    const F zero = V::set1(0.0f);
+    const F one = V::set1(1.0f);
+    const I oneI = V::set1i(1);
+    const I mask255 = V::set1i(255);
+
+    // Skew the input space to determine which simplex cell we're in
+    F s = V::mul(V::add(V::add(x, y), z), V::set1(F3));
+    I i = V::fastfloor(V::add(x, s));
+    I j = V::fastfloor(V::add(y, s));
+    I k = V::fastfloor(V::add(z, s));
+
+    F t = V::mul(V::tofloat(V::addi(V::addi(i, j), k)), V::set1(G3));
+    F x0 = V::sub(x, V::sub(V::tofloat(i), t));
+    F y0 = V::sub(y, V::sub(V::tofloat(j), t));
+    F z0 = V::sub(z, V::sub(V::tofloat(k), t));
+
+    // Which of the six tetrahedra we are in, the same choice as the scalar branches
+    F xy = V::cmpge(x0, y0);
+    F yz = V::cmpge(y0, z0);
+    F xz = V::cmpge(x0, z0);
+
+    const F all = V::allones();
+    F i1 = V::and_(xy, xz);
+    F j1 = V::andnot(xy, yz);
+    F k1 = V::andnot(V::or_(xz, yz), all);
+    F i2 = V::or_(xy, xz);
+    F j2 = V::or_(V::andnot(xy, all), yz);
+    F k2 = V::andnot(V::and_(xz, yz), all);
+
+    F x1 = V::add(V::sub(x0, V::and_(i1, one)), V::set1(G3));
+    F y1 = V::add(V::sub(y0, V::and_(j1, one)), V::set1(G3));
+    F z1 = V::add(V::sub(z0, V::and_(k1, one)), V::set1(G3));
+    F x2 = V::add(V::sub(x0, V::and_(i2, one)), V::set1((float)(2.0 * G3)));
+    F y2 = V::add(V::sub(y0, V::and_(j2, one)), V::set1((float)(2.0 * G3)));
+    F z2 = V::add(V::sub(z0, V::and_(k2, one)), V::set1((float)(2.0 * G3)));
+    F x3 = V::add(x0, V::set1((float)(-1.0 + 3.0 * G3)));
+    F y3 = V::add(y0, V::set1((float)(-1.0 + 3.0 * G3)));
+    F z3 = V::add(z0, V::set1((float)(-1.0 + 3.0 * G3)));
+
+    // Work out the hashed gradient indices of the four simplex corners
+    I ii = V::andi(i, mask255);
+    I jj = V::andi(j, mask255);
+    I kk = V::andi(k, mask255);
+    I i1i = V::andi(V::tomask(i1), oneI);
+    I j1i = V::andi(V::tomask(j1), oneI);
+    I k1i = V::andi(V::tomask(k1), oneI);
+    I i2i = V::andi(V::tomask(i2), oneI);
+    I j2i = V::andi(V::tomask(j2), oneI);
+    I k2i = V::andi(V::tomask(k2), oneI);
+
+    I gi0 = V::gather(permMod12.values, V::addi(ii, V::gather(perm, V::addi(jj, V::gather(perm, kk)))));
+    I gi1 = V::gather(permMod12.values, V::addi(V::addi(ii, i1i), V::gather(perm, V::addi(V::addi(jj, j1i), V::gather(perm, V::addi(kk, k1i))))));
+    I gi2 = V::gather(permMod12.values, V::addi(V::addi(ii, i2i), V::gather(perm, V::addi(V::addi(jj, j2i), V::gather(perm, V::addi(kk, k2i))))));
+    I gi3 = V::gather(permMod12.values, V::addi(V::addi(ii, oneI), V::gather(perm, V::addi(V::addi(jj, oneI), V::gather(perm, V::addi(kk, oneI))))));
+
+    // Calculate the contribution from the four corners
+    const F cx[4] = { x0, x1, x2, x3 };
+    const F cy[4] = { y0, y1, y2, y3 };
+    const F cz[4] = { z0, z1, z2, z3 };
+    const I gi[4] = { gi0, gi1, gi2, gi3 };
+
+    F n = zero;
+    for( int c=0; c < 4; c++ ) {
+        F tc = V::sub(V::sub(V::sub(V::set1(0.6f), V::mul(cx[c], cx[c])), V::mul(cy[c], cy[c])), V::mul(cz[c], cz[c]));
+        F d = V::add(V::add(V::mul(V::gatherf(grad3x, gi[c]), cx[c]), V::mul(V::gatherf(grad3y, gi[c]), cy[c])), V::mul(V::gatherf(grad3z, gi[c]), cz[c]));
+        F outside = V::cmplt(tc, zero);
+        tc = V::mul(tc, tc);
+        n = V::add(n, V::andnot(outside, V::mul(V::mul(tc, tc), d)));
+    }
+
+    return V::mul(V::set1(32.0f), n);
+}
+
+
+// Runs a kernel over the arrays, the last partial vector is padded.
+template <class V>
+void raw_noise_2d_batch_kernel( const int count, const float* xs, const float* ys, float* out ) {
+    int index = 0;
+    for( ; index + V::WIDTH <= count; index += V::WIDTH ) {
+        V::store(&out[index], raw_noise_2d_kernel<V>(V::load(&xs[index]), V::load(&ys[index])));
+    }
+
+    if( index < count ) {
+        float x[V::WIDTH] = { 0 };
+        float y[V::WIDTH] = { 0 };
+        float n[V::WIDTH];
+        for( int i=index; i < count; i++ ) {
+            x[i-index] = xs[i];
+            y[i-index] = ys[i];
+        }
+
+        V::store(n, raw_noise_2d_kernel<V>(V::load(x), V::load(y)));
+
+        for( int i=index; i < count; i++ ) {
+            out[i] = n[i-index];
+        }
+    }
+}
+
+template <class V>
+void raw_noise_3d_batch_kernel( const int count, const float* xs, const float* ys, const float* zs, float* out ) {
+    int index = 0;
+    for( ; index + V::WIDTH <= count; index += V::WIDTH ) {
+        V::store(&out[index], raw_noise_3d_kernel<V>(V::load(&xs[index]), V::load(&ys[index]), V::load(&zs[index])));
+    }
+
+    if( index < count ) {
+        float x[V::WIDTH] = { 0 };
+        float y[V::WIDTH] = { 0 };
+        float z[V::WIDTH] = { 0 };
+        float n[V::WIDTH];
+        for( int i=index; i < count; i++ ) {
+            x[i-index] = xs[i];
+            y[i-index] = ys[i];
+            z[i-index] = zs[i];
+        }
+
+        V::store(n, raw_noise_3d_kernel<V>(V::load(x), V::load(y), V::load(z)));
+
+        for( int i=index; i < count; i++ ) {
+            out[i] = n[i-index];
+        }
+    }
+}
+
+}
+
+#endif /*SIMPLEX_SIMD_KERNELS*/
+
+#endif /*SIMPLEX_SIMD_H_*/
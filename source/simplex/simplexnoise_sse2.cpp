@@ -0,0 +1,112 @@
+/* Copyright (c) 2007-2012 Eliot Eshelman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+// SSE2 code path for the batch Simplex noise functions, 4 points at a time.
+// SSE2 has no gather instruction, so the table lookups are done per lane.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMPLEX_SSE2
+#endif
+
+#ifdef SIMPLEX_SSE2
+
+#include <emmintrin.h>
+
+#define SIMPLEX_SIMD_KERNELS
+#include "simplexnoise_simd.h"
+
+
+namespace {
+
+struct SSE2Lanes {
+    typedef __m128 F;
+    typedef __m128i I;
+    enum { WIDTH = 4 };
+
+    static F load( const float* p ) { return _mm_loadu_ps(p); }
+    static void store( float* p, F v ) { _mm_storeu_ps(p, v); }
+    static F set1( const float v ) { return _mm_set1_ps(v); }
+    static I set1i( const int v ) { return _mm_set1_epi32(v); }
+    static F allones() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+
+    static F add( F a, F b ) { return _mm_add_ps(a, b); }
+    static F sub( F a, F b ) { return _mm_sub_ps(a, b); }
+    static F mul( F a, F b ) { return _mm_mul_ps(a, b); }
+    static I addi( I a, I b ) { return _mm_add_epi32(a, b); }
+    static I subi( I a, I b ) { return _mm_sub_epi32(a, b); }
+    static I andi( I a, I b ) { return _mm_and_si128(a, b); }
+
+    static F cmpgt( F a, F b ) { return _mm_cmpgt_ps(a, b); }
+    static F cmpge( F a, F b ) { return _mm_cmpge_ps(a, b); }
+    static F cmplt( F a, F b ) { return _mm_cmplt_ps(a, b); }
+    static F and_( F a, F b ) { return _mm_and_ps(a, b); }
+    static F andnot( F a, F b ) { return _mm_andnot_ps(a, b); }
+    static F or_( F a, F b ) { return _mm_or_ps(a, b); }
+    static I tomask( F m ) { return _mm_castps_si128(m); }
+
+    static F tofloat( I v ) { return _mm_cvtepi32_ps(v); }
+
+    // Same as fastfloor(), truncate and take one off for x <= 0
+    static I fastfloor( F x ) { return _mm_add_epi32(_mm_cvttps_epi32(x), _mm_castps_si128(_mm_cmple_ps(x, _mm_setzero_ps()))); }
+
+    static I gather( const int* table, I index ) {
+        int lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, index);
+        return _mm_set_epi32(table[lanes[3]], table[lanes[2]], table[lanes[1]], table[lanes[0]]);
+    }
+
+    static F gatherf( const float* table, I index ) {
+        int lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, index);
+        return _mm_set_ps(table[lanes[3]], table[lanes[2]], table[lanes[1]], table[lanes[0]]);
+    }
+};
+
+}
+
+
+bool simplex_sse2_compiled() { return true; }
+
+void raw_noise_2d_batch_sse2( const int count, const float* xs, const float* ys, float* out ) {
+    raw_noise_2d_batch_kernel<SSE2Lanes>(count, xs, ys, out);
+}
+
+void raw_noise_3d_batch_sse2( const int count, const float* xs, const float* ys, const float* zs, float* out ) {
+    raw_noise_3d_batch_kernel<SSE2Lanes>(count, xs, ys, zs, out);
+}
+
+#else
+
+#include "simplexnoise_simd.h"
+
+// Not an x86 build, the batch functions use the scalar code instead
+bool simplex_sse2_compiled() { return false; }
+
+void raw_noise_2d_batch_sse2( const int count, const float* xs, const float* ys, float* out ) {
+    for( int i=0; i < count; i++ ) {
+        out[i] = raw_noise_2d(xs[i], ys[i]);
+    }
+}
+
+void raw_noise_3d_batch_sse2( const int count, const float* xs, const float* ys, const float* zs, float* out ) {
+    for( int i=0; i < count; i++ ) {
+        out[i] = raw_noise_3d(xs[i], ys[i], zs[i]);
+    }
+}
+
+#endif /*SIMPLEX_SSE2*/